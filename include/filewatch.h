@@ -0,0 +1,90 @@
+#ifndef _FILEWATCH_H
+#define _FILEWATCH_H
+
+// Observação de um arquivo do disco, usada para recarregar o nível em jogo
+// quando o seu arquivo é editado. No Linux é usado o inotify, observando o
+// diretório do arquivo: editores costumam gravar um arquivo novo e renomeá-lo
+// por cima do antigo, o que troca o inode observado. Nos demais sistemas (ou
+// caso o inotify falhe), o tamanho e a data de modificação do arquivo são
+// comparados a cada consulta.
+
+#include <string>
+#include <cstring>
+
+#include "mappedfile.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+struct FileWatch {
+    std::string path;
+    std::string name;             // Nome do arquivo, sem o diretório
+    int fd;                       // Descritor do inotify (-1: comparação de tamanho e data)
+    long long size;               // Tamanho e data da última consulta
+    long long modification_time;
+};
+
+static void StopFileWatch(FileWatch* watch)
+{
+#ifdef __linux__
+    if (watch->fd >= 0)
+        close(watch->fd);
+#endif
+    watch->fd = -1;
+}
+
+// Começa a observar um arquivo, parando de observar o anterior
+static void StartFileWatch(const std::string& path, FileWatch* watch)
+{
+    StopFileWatch(watch);
+    watch->path = path;
+
+    size_t separator = path.find_last_of("/\\");
+    std::string directory = separator == std::string::npos ? "." : path.substr(0, separator);
+    watch->name = separator == std::string::npos ? path : path.substr(separator + 1);
+
+#ifdef __linux__
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd >= 0 && inotify_add_watch(watch->fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+        StopFileWatch(watch);
+#endif
+
+    if (!GetFileStamp(path.c_str(), &watch->size, &watch->modification_time))
+        watch->size = watch->modification_time = -1;
+}
+
+// Testa, sem bloquear, se o arquivo foi gravado desde a última consulta.
+// Vários eventos seguidos (de uma mesma gravação) contam como uma alteração.
+static bool FileWatchChanged(FileWatch* watch)
+{
+#ifdef __linux__
+    if (watch->fd >= 0)
+    {
+        bool changed = false;
+        char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t length;
+        while ((length = read(watch->fd, buffer, sizeof(buffer))) > 0)
+        {
+            for (char* event = buffer; event < buffer + length; event += sizeof(struct inotify_event) + ((struct inotify_event*)event)->len)
+            {
+                const struct inotify_event* info = (const struct inotify_event*)event;
+                if (info->len > 0 && strcmp(info->name, watch->name.c_str()) == 0)
+                    changed = true;
+            }
+        }
+        return changed;
+    }
+#endif
+
+    long long size, modification_time;
+    if (!GetFileStamp(watch->path.c_str(), &size, &modification_time))
+        return false;
+    if (size == watch->size && modification_time == watch->modification_time)
+        return false;
+    watch->size = size;
+    watch->modification_time = modification_time;
+    return true;
+}
+
+#endif // _FILEWATCH_H
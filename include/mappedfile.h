@@ -0,0 +1,135 @@
+#ifndef _MAPPEDFILE_H
+#define _MAPPEDFILE_H
+
+// Leitura de arquivos mapeados em memória (somente leitura), usada pelos
+// caches binários de recursos. O conteúdo é acessado diretamente pelo
+// ponteiro "data", sem cópia para um buffer intermediário.
+
+#include <cstddef>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+struct MappedFile {
+    const unsigned char* data;
+    size_t size;
+};
+
+// Mapeia o arquivo inteiro em memória. Retorna false caso ele não exista ou
+// não possa ser mapeado (arquivos vazios também não são mapeados).
+static bool MapFile(const char* filename, MappedFile* file)
+{
+    file->data = NULL;
+    file->size = 0;
+
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(handle);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(handle);
+    if (mapping == NULL)
+        return false;
+
+    // A visão mantém o mapeamento aberto até UnmapViewOfFile()
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (data == NULL)
+        return false;
+
+    file->data = (const unsigned char*)data;
+    file->size = (size_t)size.QuadPart;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    file->data = (const unsigned char*)data;
+    file->size = (size_t)info.st_size;
+#endif
+
+    return true;
+}
+
+static void UnmapFile(MappedFile* file)
+{
+    if (file->data == NULL)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(file->data);
+#else
+    munmap((void*)file->data, file->size);
+#endif
+
+    file->data = NULL;
+    file->size = 0;
+}
+
+// Pede ao sistema operacional que leia o arquivo mapeado por inteiro, em
+// uma única leitura sequencial, em vez de página por página no primeiro
+// acesso a cada uma.
+static void PrefetchMappedFile(const MappedFile* file)
+{
+    if (file->data == NULL)
+        return;
+
+#ifdef _WIN32
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0602 // PrefetchVirtualMemory() existe a partir do Windows 8
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = (PVOID)file->data;
+    range.NumberOfBytes = file->size;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+#else
+    madvise((void*)file->data, file->size, MADV_SEQUENTIAL);
+    madvise((void*)file->data, file->size, MADV_WILLNEED);
+#endif
+}
+
+// Tamanho e data de modificação de um arquivo, usados para invalidar os
+// caches gerados a partir dele. Retorna false caso o arquivo não exista.
+static bool GetFileStamp(const char* filename, long long* size, long long* modification_time)
+{
+    struct stat info;
+    if (stat(filename, &info) != 0)
+        return false;
+
+    *size = (long long)info.st_size;
+    *modification_time = (long long)info.st_mtime;
+    return true;
+}
+
+#endif // _MAPPEDFILE_H
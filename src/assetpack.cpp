@@ -0,0 +1,229 @@
+// Pacote de recursos: um único arquivo com todos os arquivos do jogo
+// (níveis, caches de modelos e texturas, imagens, shaders, sons e músicas),
+// gerado por "main --build-pack" e mapeado em memória ao iniciar o jogo.
+//
+// Formato do arquivo:
+//   AssetPackHeader, num_entries x AssetPackEntry (ordenadas pelo nome, para
+//   busca binária), conteúdo de cada arquivo (alinhado em
+//   ASSET_PACK_ALIGNMENT bytes, na ordem dada ao construtor).
+//
+// Os nomes são os caminhos relativos à raiz do repositório, sem os "../"
+// iniciais ("data/levels/1", "src/shader_vertex.glsl"), de forma que os
+// caminhos usados pelo jogo ("../../data/levels/1") encontram a entrada
+// correspondente. O conteúdo é acessado diretamente no arquivo mapeado, sem
+// cópia.
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "mappedfile.h"
+
+#define ASSET_PACK_VERSION   1
+#define ASSET_PACK_NAME_SIZE 64
+#define ASSET_PACK_ALIGNMENT 64
+
+namespace {
+
+struct AssetPackHeader {
+    char     magic[4];    // "CPAK"
+    uint32_t version;     // ASSET_PACK_VERSION
+    uint32_t num_entries;
+    uint32_t alignment;   // ASSET_PACK_ALIGNMENT
+};
+
+struct AssetPackEntry {
+    char     name[ASSET_PACK_NAME_SIZE]; // Terminado em zero
+    uint64_t offset;                     // Em bytes, a partir do início do arquivo
+    uint64_t size;
+};
+
+MappedFile g_Pack = {NULL, 0};
+const AssetPackEntry* g_PackEntries = NULL;
+uint32_t g_PackNumEntries = 0;
+
+bool EntryNameLess(const AssetPackEntry& entry, const std::string& name)
+{
+    return strncmp(entry.name, name.c_str(), ASSET_PACK_NAME_SIZE) < 0;
+}
+
+bool ReadWholeFile(const std::string& filename, std::vector<unsigned char>* contents)
+{
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    contents->resize(size > 0 ? size : 0);
+    bool ok = size >= 0 && fread(contents->data(), 1, contents->size(), file) == contents->size();
+    fclose(file);
+    return ok;
+}
+
+} // namespace
+
+// Nome da entrada de um arquivo no pacote: o caminho sem os "./" e "../"
+// iniciais e com '/' como separador
+std::string AssetPackName(const std::string& path)
+{
+    std::string name = path;
+    std::replace(name.begin(), name.end(), '\\', '/');
+    for (;;)
+    {
+        if (name.compare(0, 3, "../") == 0)
+            name.erase(0, 3);
+        else if (name.compare(0, 2, "./") == 0)
+            name.erase(0, 2);
+        else
+            break;
+    }
+    return name;
+}
+
+// Mapeia o pacote em memória e pede ao sistema operacional que o leia por
+// inteiro, sequencialmente. Retorna false caso o arquivo não exista ou seja
+// inválido; nesse caso os recursos são lidos dos arquivos avulsos.
+bool OpenAssetPack(const char* filename)
+{
+    MappedFile pack;
+    if (!MapFile(filename, &pack))
+        return false;
+
+    const AssetPackHeader* header = (const AssetPackHeader*)pack.data;
+    bool valid = pack.size >= sizeof(AssetPackHeader)
+              && memcmp(header->magic, "CPAK", 4) == 0
+              && header->version == ASSET_PACK_VERSION
+              && pack.size >= sizeof(AssetPackHeader) + (size_t)header->num_entries * sizeof(AssetPackEntry);
+
+    const AssetPackEntry* entries = (const AssetPackEntry*)(pack.data + sizeof(AssetPackHeader));
+    for (uint32_t i = 0; valid && i < header->num_entries; ++i)
+    {
+        valid = memchr(entries[i].name, 0, ASSET_PACK_NAME_SIZE) != NULL
+             && entries[i].offset <= pack.size && entries[i].size <= pack.size - entries[i].offset
+             && (i == 0 || strcmp(entries[i - 1].name, entries[i].name) < 0);
+    }
+
+    if (!valid)
+    {
+        fprintf(stderr, "WARNING: invalid asset pack \"%s\".\n", filename);
+        UnmapFile(&pack);
+        return false;
+    }
+
+    PrefetchMappedFile(&pack);
+
+    g_Pack = pack;
+    g_PackEntries = entries;
+    g_PackNumEntries = header->num_entries;
+
+    printf("Pacote de recursos \"%s\" aberto (%u arquivos, %lu bytes).\n", filename, g_PackNumEntries, (unsigned long)g_Pack.size);
+    return true;
+}
+
+// Procura um arquivo no pacote pelo caminho usado para abri-lo do disco.
+// Retorna false caso não haja pacote aberto ou o arquivo não esteja nele.
+// Pode ser chamada de várias threads ao mesmo tempo.
+bool FindPackedAsset(const std::string& path, const unsigned char** data, size_t* size)
+{
+    if (g_PackEntries == NULL)
+        return false;
+
+    std::string name = AssetPackName(path);
+    const AssetPackEntry* end = g_PackEntries + g_PackNumEntries;
+    const AssetPackEntry* entry = std::lower_bound(g_PackEntries, end, name, EntryNameLess);
+    if (entry == end || strncmp(entry->name, name.c_str(), ASSET_PACK_NAME_SIZE) != 0)
+        return false;
+
+    *data = g_Pack.data + entry->offset;
+    *size = entry->size;
+    return true;
+}
+
+// Monta o pacote com os arquivos dados. O conteúdo é gravado na ordem da
+// lista, que deve começar pelos arquivos lidos na inicialização, e o
+// arquivo é escrito com outro nome e renomeado no final.
+bool WriteAssetPack(const char* filename, const std::vector<std::string>& files)
+{
+    std::vector<AssetPackEntry> entries(files.size());
+    size_t offset = sizeof(AssetPackHeader) + files.size() * sizeof(AssetPackEntry);
+    offset = (offset + ASSET_PACK_ALIGNMENT - 1) / ASSET_PACK_ALIGNMENT * ASSET_PACK_ALIGNMENT;
+
+    std::vector<std::vector<unsigned char> > contents(files.size());
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        std::string name = AssetPackName(files[i]);
+        if (name.size() >= ASSET_PACK_NAME_SIZE)
+        {
+            fprintf(stderr, "ERROR: asset name \"%s\" too long for the pack.\n", name.c_str());
+            return false;
+        }
+        if (!ReadWholeFile(files[i], &contents[i]))
+        {
+            fprintf(stderr, "ERROR: cannot read \"%s\".\n", files[i].c_str());
+            return false;
+        }
+
+        memset(&entries[i], 0, sizeof(AssetPackEntry));
+        memcpy(entries[i].name, name.c_str(), name.size());
+        entries[i].offset = offset;
+        entries[i].size = contents[i].size();
+        offset += (contents[i].size() + ASSET_PACK_ALIGNMENT - 1) / ASSET_PACK_ALIGNMENT * ASSET_PACK_ALIGNMENT;
+    }
+
+    // O índice é ordenado pelo nome; o conteúdo permanece na ordem da lista
+    std::vector<AssetPackEntry> toc(entries);
+    std::sort(toc.begin(), toc.end(), [](const AssetPackEntry& a, const AssetPackEntry& b) {
+        return strcmp(a.name, b.name) < 0;
+    });
+    for (size_t i = 1; i < toc.size(); ++i)
+    {
+        if (strcmp(toc[i - 1].name, toc[i].name) == 0)
+        {
+            fprintf(stderr, "ERROR: duplicated asset \"%s\".\n", toc[i].name);
+            return false;
+        }
+    }
+
+    AssetPackHeader header;
+    memcpy(header.magic, "CPAK", 4);
+    header.version = ASSET_PACK_VERSION;
+    header.num_entries = files.size();
+    header.alignment = ASSET_PACK_ALIGNMENT;
+
+    std::string temppath = std::string(filename) + ".tmp";
+    FILE* file = fopen(temppath.c_str(), "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "ERROR: cannot write asset pack \"%s\".\n", filename);
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (!toc.empty())
+        ok = ok && fwrite(toc.data(), sizeof(AssetPackEntry), toc.size(), file) == toc.size();
+
+    static const unsigned char padding[ASSET_PACK_ALIGNMENT] = {0};
+    size_t written = sizeof(AssetPackHeader) + toc.size() * sizeof(AssetPackEntry);
+    for (size_t i = 0; ok && i < files.size(); ++i)
+    {
+        ok = fwrite(padding, 1, entries[i].offset - written, file) == entries[i].offset - written;
+        ok = ok && fwrite(contents[i].data(), 1, contents[i].size(), file) == contents[i].size();
+        written = entries[i].offset + contents[i].size();
+    }
+    ok = (fclose(file) == 0) && ok;
+
+    remove(filename);
+    if (!ok || rename(temppath.c_str(), filename) != 0)
+    {
+        fprintf(stderr, "ERROR: cannot write asset pack \"%s\".\n", filename);
+        remove(temppath.c_str());
+        return false;
+    }
+
+    printf("Pacote de recursos \"%s\" gravado (%lu arquivos, %lu bytes).\n", filename, (unsigned long)files.size(), (unsigned long)written);
+    return true;
+}
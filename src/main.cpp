@@ -5,9 +5,12 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
 
 #include <map>
-#include <stack>
+#include <set>
 #include <string>
 #include <vector>
 #include <limits>
@@ -17,6 +20,16 @@
 #include <stdexcept>
 #include <algorithm>
 #include <initializer_list>
+#include <queue>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <random>
+#include <new>
+#include <cassert>
 
 // SFML: Músicas e Sons
 #include <SFML/Audio.hpp>
@@ -37,14 +50,23 @@
 // Headers locais, definidos na pasta "include/"
 #include "utils.h"
 #include "matrices.h"
+#include "mappedfile.h"
+#include "filewatch.h"
 
 #define PI 3.14159265358979323846
 
+typedef glm::vec2 vec2;
 typedef glm::vec3 vec3;
 typedef glm::vec4 vec4;
 typedef std::string string;
 typedef std::vector<int> vecInt;
 
+// Níveis de detalhe (LOD) gerados para cada malha ao carregá-la
+#define VERTEX_CACHE_SIZE 16     // Entradas do cache de vértices transformados assumido em OptimizeVertexCache()
+#define MAX_MESH_LODS 4          // LOD 0 (malha original) + 3 simplificações
+#define LOD_MIN_TRIANGLES 400    // Malhas menores que isso não são simplificadas
+#define LOD_PIXEL_THRESHOLD 160.0f // Diâmetro projetado (em pixels) abaixo do qual se usa o LOD 1; cada LOD seguinte usa metade
+
 ////////////////
 // ESTRUTURAS //
 ////////////////
@@ -59,8 +81,16 @@ struct SceneObject {
     GLuint       vertex_array_object_id; // ID do VAO onde estão armazenados os atributos do modelo
     vec3    bbox_min; // Axis-Aligned Bounding Box do objeto
     vec3    bbox_max;
+    vec3    position_offset; // Posição = position_offset + position_scale * (posição quantizada em [0,1])
+    vec3    position_scale;
+    int          num_lods; // Número de níveis de detalhe disponíveis (o LOD 0 é a malha original)
+    void*        lod_first_index[MAX_MESH_LODS]; // Deslocamento (em bytes) de cada LOD no index buffer
+    int          lod_num_indices[MAX_MESH_LODS];
 };
 
+// Leitura paralela de arquivos ".obj". Definida em "objloader.cpp".
+bool LoadObjParallel(const char* filename, tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes, std::string* err);
+
 // Estrutura que representa um modelo geométrico carregado a partir de um
 // arquivo ".obj".
 struct ObjModel {
@@ -68,13 +98,17 @@ struct ObjModel {
     std::vector<tinyobj::shape_t>     shapes;
     std::vector<tinyobj::material_t>  materials;
 
-    // Este construtor lê o modelo de um arquivo utilizando a biblioteca tinyobjloader.
+    // Este construtor lê o modelo de um arquivo utilizando várias threads
+    // (veja "objloader.cpp") ou, para modelos com materiais, a biblioteca
+    // tinyobjloader.
     ObjModel(const char* filename, const char* basepath = NULL, bool triangulate = true)
     {
-        printf("Carregando modelo \"%s\"... ", filename);
-
         string err;
-        bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filename, basepath, triangulate);
+        bool ret = false;
+        if (basepath == NULL && triangulate)
+            ret = LoadObjParallel(filename, &attrib, &shapes, &err);
+        if (!ret && err.empty())
+            ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filename, basepath, triangulate);
 
         if (!err.empty())
             fprintf(stderr, "\n%s\n", err.c_str());
@@ -82,19 +116,294 @@ struct ObjModel {
         if (!ret)
             throw std::runtime_error("Erro ao carregar modelo.");
 
-        printf("OK.\n");
+        // Uma única chamada: o modelo pode estar sendo lido em uma thread auxiliar
+        printf("Carregando modelo \"%s\"... OK.\n", filename);
+    }
+};
+
+// Vértice no formato enviado para a GPU (16 bytes), decodificado em
+// "shader_vertex.glsl":
+//  - position:  x,y,z em inteiros de 16 bits normalizados, relativos à
+//               caixa position_offset/position_scale do objeto (w é preenchimento);
+//  - normal:    codificação octaédrica, em inteiros de 16 bits com sinal normalizados;
+//  - texcoords: u,v em half float.
+struct PackedVertex {
+    uint16_t position[4];
+    int16_t  normal[2];
+    uint16_t texcoords[2];
+};
+
+// Vértices (intercalados, no formato PackedVertex) e índices de uma malha,
+// prontos para serem enviados para a GPU. Construídos fora da thread do
+// OpenGL por BuildTriangles() ou lidos do cache binário por LoadMeshCache().
+// Em ambos os casos, vertex_data e index_data apontam para os dados a serem
+// enviados: os vetores abaixo ou o arquivo de cache mapeado em memória.
+struct MeshData {
+    std::vector<float>  vertices; // Em ponto flutuante (MESH_VERTEX_FLOATS floats cada), usados só na construção
+    std::vector<PackedVertex> packed_vertices;
+    std::vector<GLuint> indices;
+    std::vector<SceneObject> objects; // Sem o VAO, criado em UploadMeshAndAddToVirtualScene()
+
+    const PackedVertex* vertex_data;
+    size_t        num_vertices;
+    const GLuint* index_data;
+    size_t        num_indices;
+    MappedFile    mapped;
+
+    MeshData() : vertex_data(NULL), num_vertices(0), index_data(NULL), num_indices(0) {
+        mapped.data = NULL;
+        mapped.size = 0;
+    }
+    ~MeshData() { UnmapFile(&mapped); }
+
+    MeshData(const MeshData&) = delete;
+    MeshData& operator=(const MeshData&) = delete;
+};
+
+// Cache binário de um modelo (arquivo "<modelo>.obj.meshcache"), gerado no
+// primeiro carregamento ou com "main --build-mesh-cache <modelos>":
+//   MeshCacheHeader, num_objects x MeshCacheObject, vértices, índices.
+// Os dados estão na ordem de bytes da máquina que gerou o cache. O cache é
+// descartado quando a versão do formato ou o ".obj" de origem mudam.
+#define MESH_CACHE_VERSION   4
+#define MESH_CACHE_NAME_SIZE 64
+
+struct MeshCacheHeader {
+    char     magic[4];      // "CMSH"
+    uint32_t version;       // MESH_CACHE_VERSION
+    int64_t  source_size;   // Tamanho e data de modificação do ".obj" de origem
+    int64_t  source_time;
+    uint32_t vertex_size;   // sizeof(PackedVertex)
+    uint32_t num_vertices;
+    uint32_t num_indices;
+    uint32_t num_objects;
+};
+
+struct MeshCacheObject {
+    char     name[MESH_CACHE_NAME_SIZE];
+    float    bbox_min[3];
+    float    bbox_max[3];
+    float    position_offset[3];
+    float    position_scale[3];
+    uint32_t num_lods;
+    uint32_t lod_first_index[MAX_MESH_LODS]; // Em número de índices (não em bytes)
+    uint32_t lod_num_indices[MAX_MESH_LODS];
+};
+
+// Imagem decodificada na memória, ainda não enviada para a GPU
+struct DecodedImage {
+    string filename;
+    int width;
+    int height;
+    unsigned char* data; // RGB, 3 bytes por pixel (liberar com stbi_image_free)
+};
+
+// Imagens que formam um GL_TEXTURE_2D_ARRAY: cada arquivo é dividido em
+// columns x rows células de mesmo tamanho, e cada célula vira uma camada. A
+// célula (coluna, linha) do arquivo i, com a linha 0 embaixo, é a camada
+// i * columns * rows + linha * columns + coluna.
+struct TextureArraySource {
+    string name; // Nome da textura residente e do cache ("<name>.texcache")
+    std::vector<string> files;
+    int columns;
+    int rows;
+};
+
+// Camadas de uma TextureArraySource decodificadas na memória, contíguas
+// (RGB, 3 bytes por pixel, linha 0 embaixo)
+struct DecodedLayers {
+    string name;
+    int width;
+    int height;
+    int count;
+    long long source_size; // Soma dos tamanhos e data de modificação mais recente dos arquivos
+    long long source_time;
+    std::vector<unsigned char> pixels;
+};
+
+// Cache de uma textura comprimida (arquivo "<name>.texcache"), gerado no
+// primeiro carregamento ou com "main --build-texture-cache":
+//   TextureCacheHeader, num_levels x TextureCacheLevel, blocos de cada nível
+//   (as num_layers camadas de um nível ficam em sequência).
+// Os níveis de mipmap são gerados offline e comprimidos em BC1 (S3TC/DXT1,
+// 8 bytes por bloco de 4x4 pixels). O cache é descartado quando a versão do
+// formato ou alguma imagem de origem mudam.
+#define TEXTURE_CACHE_VERSION 2
+#define MAX_TEXTURE_LEVELS    16
+
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C // GL_EXT_texture_sRGB + GL_EXT_texture_compression_s3tc
+#endif
+
+struct TextureCacheHeader {
+    char     magic[4];    // "CTEX"
+    uint32_t version;     // TEXTURE_CACHE_VERSION
+    int64_t  source_size; // Tamanho e data de modificação das imagens de origem
+    int64_t  source_time;
+    uint32_t format;      // GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+    uint32_t width;
+    uint32_t height;
+    uint32_t num_levels;
+    uint32_t num_layers;
+    uint32_t reserved;    // Mantém o tamanho múltiplo de 8 bytes
+};
+
+struct TextureCacheLevel {
+    uint32_t width;
+    uint32_t height;
+    uint32_t offset; // Em bytes, a partir do início do arquivo
+    uint32_t size;   // Todas as camadas do nível
+};
+
+// Textura comprimida pronta para ser enviada para a GPU: montada em memória
+// por BuildCompressedTexture() ou lida do cache por LoadTextureCache(). Em
+// ambos os casos, "data" aponta para o conteúdo de um arquivo ".texcache".
+struct TextureData {
+    string filename;
+    std::vector<unsigned char> buffer;
+    MappedFile mapped;
+
+    const unsigned char* data;
+    size_t size;
+
+    TextureData() : data(NULL), size(0) {
+        mapped.data = NULL;
+        mapped.size = 0;
     }
+    ~TextureData() { UnmapFile(&mapped); }
+
+    TextureData(const TextureData&) = delete;
+    TextureData& operator=(const TextureData&) = delete;
+};
+
+// Cache de um programa de GPU linkado (arquivo "<nome>.progcache", ao lado
+// do executável): ProgramCacheHeader seguido do binário devolvido por
+// glGetProgramBinary(). O cache é descartado quando o código dos shaders, o
+// driver ou a versão do formato mudam.
+#define PROGRAM_CACHE_VERSION 1
+
+// GL_ARB_get_program_binary (OpenGL 4.1) e KHR_parallel_shader_compile não
+// fazem parte do glad (OpenGL 3.3)
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH           0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS      0x87FE
+#endif
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+struct ProgramCacheHeader {
+    char     magic[4]; // "CPRG"
+    uint32_t version;  // PROGRAM_CACHE_VERSION
+    uint64_t key;      // HashGpuProgramSources()
+    uint32_t format;   // Formato do binário, devolvido por glGetProgramBinary()
+    uint32_t size;
+};
+
+// Programa de GPU cuja compilação foi disparada por BeginGpuProgram() e
+// ainda não foi verificada por FinishGpuProgram()
+struct PendingGpuProgram {
+    string   name; // Nome do cache
+    uint64_t key;
+    string   vertex_filename; // Usados nas mensagens de erro
+    string   fragment_filename;
+    GLuint   vertex_shader_id; // 0 quando o programa veio do cache
+    GLuint   fragment_shader_id;
 };
 
-// Estrutura que guarda uma lista de objetos presentes
+// Textura enviada para a GPU
+struct GpuTexture {
+    GLuint texture_id;
+    GLuint sampler_id;
+    size_t bytes; // Estimativa da memória ocupada na GPU (incluindo mipmaps)
+};
+
+// Textura gerenciada por PrepareLevelAssets(): carregada no primeiro nível
+// que a usa e descarregada (a menos usada recentemente primeiro) quando as
+// texturas residentes excedem TEXTURE_MEMORY_BUDGET.
+struct ResidentTexture {
+    GpuTexture   texture;
+    unsigned int last_used; // Valor de g_AssetUseStamp no último nível que usou a textura
+    bool         pinned;    // Usada pelos menus: nunca é descarregada
+};
+
+// Tarefa de carregamento: roda em uma thread auxiliar (leitura e decodificação
+// do arquivo, sem chamadas OpenGL) e devolve o trabalho que precisa ser feito
+// na thread do OpenGL, ou uma função vazia caso não haja nada a enviar.
+typedef std::function<void()> AssetUpload;
+typedef std::function<AssetUpload()> AssetLoadTask;
+
+// Dados de um objeto do mapa usados a cada quadro pelas colisões e pelo
+// movimento dos inimigos, em 32 bytes (dois objetos por linha de cache). Os
+// dados usados só no desenho e os raramente usados ficam em MapObjectDetail.
 struct MapObject {
-    int object_type;
-    vec4 object_position;
+    vec3 object_position;
     vec3 object_size;
-    vec3 model_size;
-    int direction;
+    uint8_t object_type;  // Todos os tipos cabem em um byte
+    uint8_t direction;
+    uint8_t flags;        // OBJECT_*, dadas pelo tipo (veja SetMapObjectType())
+    uint8_t reserved;
     float gravity;
+};
+
+// Dados de um objeto do mapa que não são usados nas colisões
+struct MapObjectDetail {
     const char * obj_file_name;
+    vec3 model_size;
+    int tile;           // Tile da planta que originou o objeto (-1: nenhum)
+    int anim_type;      // Animação feita no vertex shader (ANIM_*)
+    float anim_phase;   // Defasagem (em radianos) do giro desta instância
+};
+
+static_assert(sizeof(MapObject) == 32, "MapObject deve ocupar meia linha de cache.");
+
+// Lista de objetos do mapa: os MapObject em um vetor, percorrido pelas
+// colisões, e os MapObjectDetail de mesmo índice em um vetor paralelo. As
+// operações mantêm os dois vetores alinhados.
+struct MapObjectList {
+    std::vector<MapObject> objects;
+    std::vector<MapObjectDetail> details;
+
+    size_t size() const { return objects.size(); }
+    bool empty() const { return objects.empty(); }
+    MapObject& operator[](size_t index) { return objects[index]; }
+    const MapObject& operator[](size_t index) const { return objects[index]; }
+
+    void push_back(const MapObject& object, const MapObjectDetail& detail) {
+        objects.push_back(object);
+        details.push_back(detail);
+    }
+    void erase(size_t index) {
+        objects.erase(objects.begin() + index);
+        details.erase(details.begin() + index);
+    }
+    // Copia o objeto "from" sobre o objeto "to" (para compactar a lista)
+    void move(size_t from, size_t to) {
+        objects[to] = objects[from];
+        details[to] = details[from];
+    }
+    void resize(size_t size) {
+        objects.resize(size);
+        details.resize(size);
+    }
+    void clear() {
+        objects.clear();
+        details.clear();
+    }
+    void swap(MapObjectList& other) {
+        objects.swap(other.objects);
+        details.swap(other.details);
+    }
+};
+
+// Estado inicial de um inimigo, que substitui o padrão do seu tile. Só
+// existe nos níveis binários (veja RegisterLevelObjects()).
+struct LevelEntity {
+    int tile;       // Índice do tile na planta (linha * largura + coluna)
+    int direction;  // Direção inicial de jatos e bolas de praia (0 a 3)
+    float gravity;  // Velocidade vertical inicial de bolas de vôlei
 };
 
 // Estrutura que define a planta de um nível
@@ -104,7 +413,82 @@ struct Level {
     int theme;
     int height;
     int width;
-    std::vector<std::vector<string>> plant;
+    std::vector<uint8_t> tiles; // Códigos dos tiles (TileCode()), linha a linha
+    std::vector<LevelEntity> entities; // Ordenadas pelo tile
+};
+
+// Nível binário, gerado a partir do formato texto com
+// "main --build-level <nível> <saída>" e lido sem nenhum parsing:
+//   cabeçalho: "CLVL", versão, vacas, tempo, tema, largura, altura,
+//              num_entities, checksum
+//   largura x altura códigos de tiles (TileCode()), 1 byte cada, linha a linha
+//   num_entities x LevelEntity: tile, direção, gravidade
+// Todos os campos têm 32 bits, em little-endian (a gravidade é um float IEEE
+// 754). O checksum é o FNV-1a (32 bits) do arquivo inteiro, exceto ele mesmo.
+#define LEVEL_FORMAT_VERSION     1
+#define BINARY_LEVEL_HEADER_SIZE 36
+#define BINARY_LEVEL_ENTITY_SIZE 12
+
+// Modelo e tamanhos de um objeto do mapa, compartilhados por todos os
+// objetos registrados da mesma forma (veja SaveMapObject())
+struct ObjectShape {
+    const char* obj_file_name;
+    vec3 object_size;
+    vec3 model_size;
+};
+
+// Objeto de um chunk descarregado, em forma compacta (24 bytes, em vez dos
+// 64 de um MapObject e do seu MapObjectDetail)
+struct SavedMapObject {
+    float x, y, z;
+    float gravity;
+    int32_t tile;
+    uint8_t type;      // object_type (todos os tipos cabem em um byte)
+    uint8_t direction;
+    uint8_t shape;     // Índice em g_ObjectShapes
+    uint8_t reserved;
+};
+
+// Região de CHUNK_SIZE x CHUNK_SIZE tiles do nível. Só os chunks próximos do
+// jogador têm seus objetos em map_objects; os demais guardam o estado dos
+// seus objetos (portas abertas, água aterrada, itens coletados, inimigos e
+// blocos movidos) em "objects", ou ainda não foram carregados nenhuma vez e
+// são registrados a partir da planta do nível.
+struct LevelChunk {
+    bool loaded;
+    bool saved;                          // Já foi descarregado: a planta não vale mais
+    int enemies;                         // Inimigos no chunk enquanto carregado (0: dormindo)
+    std::vector<SavedMapObject> objects; // Objetos do chunk enquanto descarregado
+};
+
+// Próximo nível, preparado em uma thread auxiliar enquanto a mensagem de fim
+// do nível atual é mostrada (veja StartLevelPreload())
+struct LevelPreload {
+    int level_number;                 // 0: nenhum nível sendo preparado
+    std::thread worker;
+    std::atomic<bool> done;           // A thread auxiliar terminou
+    std::exception_ptr error;
+    Level level;
+    MapObjectList samples;            // Um objeto de cada tile (RegisterTileSamples())
+    MapObjectList objects;            // Objetos dos chunks ao redor do ponto de partida
+    std::vector<AssetUpload> uploads; // Envios para a GPU, feitos na thread do OpenGL
+    size_t next_upload;
+    sf::Music* music;                 // Música a abrir na thread auxiliar (NULL: nenhuma)
+    const char* music_path;
+    bool music_opened;                // A thread auxiliar abriu "music"
+};
+
+// Parâmetros do gerador de níveis (veja GenerateLevel())
+#define LEVEL_GENERATOR_MAX_SIZE 16384
+
+struct LevelGeneratorOptions {
+    unsigned int seed;
+    int size;           // Largura e altura
+    int theme;
+    int time;           // 0: proporcional ao tamanho
+    float wall_density; // Fração das paredes internas do labirinto mantidas (1: sem ciclos)
+    int fires, jets, balls, volleyballs, keys, cows;
+    bool binary;        // Gravar no formato binário (com a fase das bolas de vôlei)
 };
 
 // CPU representation of a particle
@@ -116,6 +500,14 @@ struct Particle {
 	float life; // Remaining life of the particle. if < 0 : dead and unused.
 };
 
+// Billboard pré-renderizado de um item giratório, usado quando o item está
+// longe da câmera. Veja BuildImpostorAtlas().
+struct Impostor {
+    int  row;       // Linha do atlas com as capturas deste tipo de objeto
+    vec3 offset;    // Centro do billboard em relação à posição do objeto
+    vec2 half_size; // Meia largura e meia altura do billboard
+};
+
 struct InventoryKeys {
     int red, green, blue, yellow;
 };
@@ -133,6 +525,9 @@ struct Inventory {
 float MaxFloat2(float a, float b);
 vec4 VectorSetHomogeneous(vec3 nonHomogVector, bool isVectorPosVector);
 constexpr unsigned int string2int(const char* str, int h = 0);
+constexpr uint8_t FindTileCode(unsigned int name_hash, unsigned int code);
+constexpr uint8_t TileCode(const char* name);
+uint8_t TileCodeFromChars(char first, char second);
 
 // Renderização de telas
 int RenderMainMenu(GLFWwindow* window);
@@ -144,47 +539,98 @@ void ShowInventory(GLFWwindow* window, int level_time);
 
 // Controle de um nível
 void ClearInventory();
-int GetCowMotherPosition();
-void RegisterLevelObjects(Level level);
-void RegisterFloor(float x, float z, int theme);
-void RegisterObjectInMapVector(string tile_type, float x, float z, int theme);
-void RegisterObjectInMap(int obj_id, vec4 obj_position, vec3 obj_size, const char * obj_file_name, vec3 model_size, int direction = 0, float gravity = 0);
-vec4 GetPlayerSpawnCoordinates(std::vector<std::vector<string>> plant);
-void BobCow();
+void RegisterLevelObjects(MapObjectList* objects, const Level& level, int first_line, int first_col, int last_line, int last_col);
+void RegisterTileSamples(MapObjectList* objects, const Level& level);
+void RegisterFloor(MapObjectList* objects, float x, float z, int theme);
+void RegisterObjectInMapVector(MapObjectList* objects, uint8_t tile, float x, float z, int theme);
+void RegisterObjectInMap(MapObjectList* objects, int obj_id, vec4 obj_position, vec3 obj_size, const char * obj_file_name, vec3 model_size, int direction = 0, float gravity = 0);
+vec4 GetPlayerSpawnCoordinates(const Level& level);
+int GetObjectAnimation(int obj_id);
+void SetMapObjectType(MapObject* object, int obj_id);
+
+// Carregamento dos chunks de um nível
+void StartLevelChunks();
+void UpdateLevelChunks(vec4 position);
+void LoadLevelChunk(int chunk);
+int GetChunkIndex(vec3 position);
+bool IsChunkInRadius(int chunk, int center, int radius);
+int GetChunkSimulationSteps(int chunk, int frame);
+SavedMapObject SaveMapObject(const MapObject& object, const MapObjectDetail& detail);
+void RestoreMapObject(MapObjectList* objects, const SavedMapObject& saved);
+void AdoptLevelChunks(MapObjectList* objects, vec4 position);
+void CountChunkEnemies();
+
+// Recarga do nível em jogo quando o seu arquivo é editado
+void ReloadLevel(const string& filepath);
+void ApplyLevelChanges(Level* level);
+void FindChangedTiles(const Level& old_level, const Level& new_level, std::vector<bool>* changed);
+
+// Preparação do próximo nível em segundo plano
+void StartLevelPreload(int level_number);
+void PreloadLevel(LevelPreload* preload);
+bool UpdateLevelPreload();
+void FinishLevelPreload();
+bool TakeLevelPreload(int level_number, Level* level, MapObjectList* samples, MapObjectList* objects);
+
+// Geração de níveis
+bool ParseLevelGeneratorOption(const string& argument, LevelGeneratorOptions* options);
+Level GenerateLevel(const LevelGeneratorOptions& options);
 
 // Desenho
 void DrawMapObjects();
 void DrawPlayer(vec4 position, float angle_y, float angle_x, float scale);
 void DrawVirtualObject(const char* object_name, int object_id, glm::mat4 model);
-void DrawSkyboxPlanes();
+void DrawAnimatedObject(const char* object_name, int object_id, glm::mat4 model, int anim_type, float anim_phase);
+void AdvanceAnimationTime();
+float GetItemSpinAngle(const MapObjectDetail& detail);
+float GetAnimPhase(vec3 position);
+int SelectMeshLod(const SceneObject& object, const glm::mat4& model);
+void DrawSkybox(int theme);
+glm::mat4 GetItemSpinMatrix(int obj_type, float angle);
+void BuildImpostorAtlas();
+void CaptureImpostor(int obj_type, const char* object_name, float model_scale, int row);
+float GetImpostorFade(const MapObject& object);
+void SetDitherRange(float first, float last);
+void DrawImpostor(const MapObject& object, const MapObjectDetail& detail);
 
 // Colisões
-vec4 GetObjectTopBoundary(vec4 object_position, vec3 object_size);
-float GetTileToleranceValue(int object_type);
-bool BBoxCollision(vec4 obj1_pos, vec4 obj2_pos, vec3 obj1_size, vec3 obj2_size, float epsilon);
-vecInt GetObjectsCollidingWithObject(int target_obj_index, vec4 target_obj_pos);
-vecInt GetObjectsCollidingWithPlayer(vec4 player_position);
-int GetVectorObjectType(vecInt vector_objects, int type);
-int GetVectorObjectType(vecInt vector_objects, vecInt types);
-bool vectorHasObjectBlockingObject(vecInt vector_objects, bool is_volleyball = false);
-bool vectorHasVolleyballBlockingObject(vecInt vector_objects);
-bool vectorHasPlayerBlockingObject(vecInt vector_objects);
-bool CollidedWithEnemy(vecInt vector_objects);
-void UnlockDoors(vecInt red, vecInt green, vecInt blue, vecInt yellow);
+struct CollisionQuery;
+struct NearbyObjects;
+vec3 GetObjectTopBoundary(vec3 object_position, vec3 object_size);
+bool BBoxCollision(vec3 obj1_pos, vec3 obj2_pos, vec3 obj1_size, vec3 obj2_size, float epsilon);
+void GetObjectsCollidingWithObject(int target_obj_index, vec4 target_obj_pos, CollisionQuery* query, const NearbyObjects* candidates = NULL);
+void GetObjectsCollidingWithPlayer(vec4 player_position, CollisionQuery* query);
+int GetCollidedObjectType(const CollisionQuery& query, int type);
+bool HasObjectBlockingObject(const CollisionQuery& query, bool is_volleyball = false);
+bool HasVolleyballBlockingObject(const CollisionQuery& query);
+bool HasPlayerBlockingObject(const CollisionQuery& query);
+bool CollidedWithEnemy(const CollisionQuery& query);
+void UnlockDoors(const CollisionQuery& query);
 
 // Movimentação
+void BeginSimulationStep();
+void EndSimulationStep();
 void MovePlayer(int theme);
 void MoveBlock(int block_index);
 void MoveEnemies();
-void MoveJet(int jet_index);
-void MoveBeachBall(int ball_index);
-void MoveVolleyBall(int ball_index);
+bool MoveEnemy(int enemy_index, int steps);
+void MoveJet(int jet_index, const NearbyObjects* nearby = NULL);
+void MoveBeachBall(int ball_index, const NearbyObjects* nearby = NULL);
+void MoveVolleyBall(int ball_index, const NearbyObjects* nearby = NULL);
 
 // Auxiliares para desenho
-void PushMatrix(glm::mat4 M);
-void PopMatrix(glm::mat4& M);
 void ComputeNormals(ObjModel* model);
+void BuildTriangles(ObjModel* model, MeshData* mesh);
+void UploadMeshAndAddToVirtualScene(MeshData* mesh);
 void BuildTrianglesAndAddToVirtualScene(ObjModel* model);
+void BuildPlayerModelAndAddToVirtualScene(const MeshData* cubemesh);
+void SetupMeshVertexAttributes();
+void PackMeshVertices(MeshData* mesh);
+std::shared_ptr<MeshData> LoadMesh(const string& filename);
+bool LoadMeshCache(const string& filename, MeshData* mesh);
+bool IsMeshCacheValid(const unsigned char* data, size_t size);
+void ReadMeshCache(const unsigned char* data, MeshData* mesh);
+bool SaveMeshCache(const string& filename, const MeshData& mesh);
 
 // Sistema de partículas (não funcional)
 void AnimateParticles();
@@ -192,23 +638,62 @@ void GenerateParticles(int amount, vec4 position, vec3 object_size);
 void DrawParticles();
 
 // Carregamento de arquivos
-Level LoadLevelFromFile(string filepath);
-void LoadTextureImage(const char* filename);
+Level LoadLevelFromFile(const string& filepath, bool use_pack = true);
+Level ParseLevel(const char* text, size_t size, const string& filepath);
+bool IsBinaryLevel(const unsigned char* data, size_t size);
+Level ReadBinaryLevel(const unsigned char* data, size_t size, const string& filepath);
+bool SaveBinaryLevel(const string& filename, const Level& level);
+uint32_t ChecksumBinaryLevel(const unsigned char* data, size_t size);
+bool SaveTextLevel(const string& filename, const Level& level);
+DecodedImage DecodeImage(const char* filename, bool flip_vertically);
+TextureArraySource TileTextureSource();
+TextureArraySource WaterTextureSource();
+bool GetTextureArrayStamp(const TextureArraySource& source, long long* size, long long* time);
+DecodedLayers DecodeTextureArray(const TextureArraySource& source);
+GpuTexture UploadTextureArray(const DecodedLayers& layers, GLuint textureunit);
+GpuTexture UploadCubemapTexture(const DecodedImage faces[6]);
+std::shared_ptr<TextureData> LoadCompressedTexture(const TextureArraySource& source);
+bool LoadTextureCache(const TextureArraySource& source, TextureData* texture);
+bool IsTextureCacheValid(const unsigned char* data, size_t size, const TextureArraySource& source);
+void BuildCompressedTexture(const DecodedLayers& layers, TextureData* texture);
+bool SaveTextureCache(const TextureData& texture);
+GpuTexture UploadCompressedTexture(const TextureData& texture, GLuint textureunit);
+bool IsExtensionSupported(const char* name);
+AssetLoadTask TextureArrayLoadTask(const TextureArraySource& source, GLuint textureunit, bool pinned = false);
+AssetLoadTask CubemapLoadTask(const char* basepath);
+AssetLoadTask MeshLoadTask(const string& filename);
+AssetLoadTask SoundLoadTask(const char* path, sf::SoundBuffer * buffer);
+void LoadAssetsInParallel(const std::vector<AssetLoadTask>& tasks);
+std::vector<AssetLoadTask> GetLevelAssetTasks(const MapObjectList& objects, int theme, std::vector<string>* textures);
+void PrepareLevelAssets(const MapObjectList& objects, int theme);
+bool TouchResidentTexture(const string& name);
+void EvictTextures();
+void PlayMusicStream(sf::Music * music, const char* path);
+void CompileShadersFromFiles();
 void LoadShadersFromFiles();
-GLuint LoadShader_Vertex(const char* filename);
-GLuint LoadShader_Fragment(const char* filename);
-void LoadShader(const char* filename, GLuint shader_id);
+string ReadShaderFile(const char* filename);
+string GetShaderDefines();
+string AddShaderDefines(const string& source);
+GLuint CompileShader(GLenum type, const string& source);
+void PrintShaderCompileLog(const char* filename, GLuint shader_id);
 void LoadSoundFromFile(const char* path, sf::SoundBuffer * buffer);
 void LoadMusicFromFile(const char* path, sf::Music * buffer);
 
 // Audio e música
+sf::Music* GetLevelMusic(int level_number, const char** path);
 void PlayLevelMusic(int level_number);
 void PlayMenuMusic();
 void StopAllMusic();
 void PlaySound(sf::SoundBuffer * buffer);
 
 // GPU
-GLuint CreateGpuProgram(GLuint vertex_shader_id, GLuint fragment_shader_id);
+bool PrintProgramLinkLog(GLuint program_id);
+void LoadGpuProgramExtensions();
+uint64_t HashGpuProgramSources(const string& vertex_source, const string& fragment_source);
+GLuint BeginGpuProgram(const char* name, const char* vertex_filename, const string& vertex_source, const char* fragment_filename, const string& fragment_source);
+void FinishGpuProgram(GLuint program_id);
+bool LoadProgramCache(const PendingGpuProgram& pending, GLuint program_id);
+bool SaveProgramCache(const PendingGpuProgram& pending, GLuint program_id);
 void FramebufferSizeCallback(GLFWwindow* window, int width, int height);
 void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 void CursorPosCallback(GLFWwindow* window, double xpos, double ypos);
@@ -222,6 +707,7 @@ void PrintObjModelInfo(ObjModel* model);
 
 // Declaração de funções auxiliares para renderizar texto dentro da janela
 // OpenGL. Estas funções estão definidas no arquivo "textrendering.cpp".
+void TextRendering_CompileShaders();
 void TextRendering_Init();
 float TextRendering_LineHeight(GLFWwindow* window);
 float TextRendering_CharWidth(GLFWwindow* window);
@@ -231,6 +717,24 @@ void TextRendering_PrintVector(GLFWwindow* window, vec4 v, float x, float y, flo
 void TextRendering_PrintMatrixVectorProduct(GLFWwindow* window, glm::mat4 M, vec4 v, float x, float y, float scale = 1.0f);
 void TextRendering_PrintMatrixVectorProductDivW(GLFWwindow* window, glm::mat4 M, vec4 v, float x, float y, float scale = 1.0f);
 
+// Simplificação de malhas para geração de LODs. Definida em "meshsimplification.cpp".
+std::vector<GLuint> SimplifyMesh(const float* positions, size_t stride, const std::vector<GLuint>& indices, size_t target_index_count);
+
+// Compressão de texturas. Definidas em "texturecompression.cpp".
+size_t CompressedSizeBC1(int width, int height);
+void CompressImageBC1(const unsigned char* rgb, int width, int height, unsigned char* blocks);
+void DownsampleImageSrgb(const unsigned char* source, int width, int height, unsigned char* destination);
+
+// Pacote de recursos. Definidas em "assetpack.cpp".
+bool OpenAssetPack(const char* filename);
+bool FindPackedAsset(const std::string& path, const unsigned char** data, size_t* size);
+bool WriteAssetPack(const char* filename, const std::vector<std::string>& files);
+
+// Otimizações de malhas na importação. Definidas em "meshoptimization.cpp".
+size_t WeldVertices(std::vector<float>& vertices, size_t stride, size_t first_vertex, std::vector<GLuint>& indices, size_t first_index);
+void OptimizeVertexCache(GLuint* indices, size_t num_indices, size_t num_vertices, int cache_size);
+size_t OptimizeVertexFetch(std::vector<float>& vertices, size_t stride, std::vector<GLuint>& indices);
+
 /***************************************/
 /** CONSTANTES ESPECÍFICAS DE OBJETOS **/
 /***************************************/
@@ -272,6 +776,11 @@ void TextRendering_PrintMatrixVectorProductDivW(GLFWwindow* window, glm::mat4 M,
 #define PLAYER_HAND 	63
 #define PLAYER_LEG 		64
 #define PLAYER_FOOT 	65
+#define PLAYER          66
+
+// Número de partes (cubos) do modelo hierárquico do jogador.
+// Cada parte tem sua matriz no palette enviado ao vertex shader.
+#define PLAYER_BONE_COUNT 14
 
 #define PARTICLE 	80
 
@@ -280,30 +789,174 @@ void TextRendering_PrintMatrixVectorProductDivW(GLFWwindow* window, glm::mat4 M,
 #define ROTATION_SPEED_X 0.01f
 #define ROTATION_SPEED_Y 0.004f
 
-#define SKYBOX_TOP      100
-#define SKYBOX_BOTTOM   101
-#define SKYBOX_EAST     102
-#define SKYBOX_WEST     103
-#define SKYBOX_SOUTH    104
-#define SKYBOX_NORTH    105
+#define SKYBOX          100
+
+// Unidades de textura dos materiais dos tiles (TileTextureSource()), dos
+// quadros da água (WaterTextureSource()) e do cubemap da skybox do tema atual
+#define TILE_TEXTURE_UNIT   0
+#define WATER_TEXTURE_UNIT  1
+#define SKYBOX_TEXTURE_UNIT 2
+
+// Divisão da imagem "textures.png" em materiais e número de quadros da água
+#define TILE_ATLAS_COLUMNS  5
+#define TILE_ATLAS_ROWS     4
+#define WATER_FRAMES        16
+
+// Camada de TileTextures da célula (coluna, linha) de "textures.png", com a
+// linha 0 embaixo
+#define TILE_LAYER(column, row) ((row) * TILE_ATLAS_COLUMNS + (column))
+#define DOOR_FRAME_LAYER        TILE_LAYER(2,1)  // Topo e base das portas
+
+// Características dos tipos de objetos do mapa (flags de MapObject)
+#define OBJECT_BLOCKS_PLAYER 1   // Sempre impede a passagem do jogador
+#define OBJECT_BLOCKS_OBJECT 2   // Impede a passagem de inimigos e blocos empurrados
+#define OBJECT_STOPS_FALL    4   // Piso onde a bola de vôlei quica
+#define OBJECT_HAZARD        8   // Mata o jogador ao ser tocado
+#define OBJECT_PICKUP        16  // Coletado pelo jogador ao ser tocado
+#define OBJECT_ENEMY         32  // Movido por MoveEnemies()
+
+// Tabela dos tipos de objetos do mapa: a única definição das suas
+// características. Dela saem OBJECT_TRAITS, usada nas colisões, e os
+// #define e a tabela TILE_LAYERS dos shaders (veja GetShaderDefines()).
+// Tipos fora da tabela não têm flags e têm a tolerância -0.1.
+//   tolerância: quanto o jogador pode andar "dentro" do objeto (negativa:
+//               quanto ele deve ficar longe)
+//   material:   camada de TileTextures, ou -1 caso o objeto não a use
+#define OBJECT_TYPE_TABLE(X) \
+    /* tipo        flags                                                tolerância material */ \
+    X(COW,         OBJECT_BLOCKS_OBJECT,                                0.1f,   TILE_LAYER(3,0)) \
+    X(WALL,        OBJECT_BLOCKS_PLAYER | OBJECT_BLOCKS_OBJECT,         0.25f,  TILE_LAYER(1,3)) \
+    X(LOCK,        0,                                                   -0.1f,  -1) \
+    X(DIRTBLOCK,   OBJECT_BLOCKS_OBJECT,                                0.25f,  TILE_LAYER(0,2)) \
+    X(FLOOR,       OBJECT_STOPS_FALL,                                   -0.1f,  TILE_LAYER(0,3)) \
+    X(DIRT,        OBJECT_BLOCKS_OBJECT,                                -0.1f,  TILE_LAYER(3,3)) \
+    X(WATER,       0,                                                   -0.1f,  -1) \
+    X(FIRE,        0,                                                   -0.1f,  -1) \
+    X(DOOR_RED,    OBJECT_BLOCKS_OBJECT,                                0.25f,  TILE_LAYER(2,2)) \
+    X(DOOR_GREEN,  OBJECT_BLOCKS_OBJECT,                                0.25f,  TILE_LAYER(3,2)) \
+    X(DOOR_BLUE,   OBJECT_BLOCKS_OBJECT,                                0.25f,  TILE_LAYER(0,1)) \
+    X(DOOR_YELLOW, OBJECT_BLOCKS_OBJECT,                                0.25f,  TILE_LAYER(1,1)) \
+    X(BABYCOW,     OBJECT_PICKUP,                                       0.4f,   -1) \
+    X(JET,         OBJECT_BLOCKS_OBJECT | OBJECT_HAZARD | OBJECT_ENEMY, -0.1f,  -1) \
+    X(BEACHBALL,   OBJECT_BLOCKS_OBJECT | OBJECT_HAZARD | OBJECT_ENEMY, -0.1f,  TILE_LAYER(3,1)) \
+    X(VOLLEYBALL,  OBJECT_BLOCKS_OBJECT | OBJECT_HAZARD | OBJECT_ENEMY, -0.1f,  TILE_LAYER(0,0)) \
+    X(GRASS,       OBJECT_STOPS_FALL,                                   -0.1f,  TILE_LAYER(2,3)) \
+    X(WOOD,        OBJECT_BLOCKS_PLAYER | OBJECT_BLOCKS_OBJECT,         0.25f,  TILE_LAYER(2,0)) \
+    X(SNOW,        OBJECT_STOPS_FALL,                                   -0.1f,  TILE_LAYER(1,0)) \
+    X(DARKFLOOR,   0,                                                   -0.1f,  -1) \
+    X(SNOWBLOCK,   OBJECT_BLOCKS_PLAYER | OBJECT_BLOCKS_OBJECT,         0.25f,  TILE_LAYER(4,0)) \
+    X(CRYSTAL,     OBJECT_BLOCKS_PLAYER | OBJECT_BLOCKS_OBJECT | OBJECT_HAZARD, 0.25f, TILE_LAYER(4,2)) \
+    X(DARKDIRT,    OBJECT_STOPS_FALL,                                   -0.1f,  TILE_LAYER(4,3)) \
+    X(DARKROCK,    OBJECT_BLOCKS_PLAYER | OBJECT_BLOCKS_OBJECT,         0.25f,  TILE_LAYER(4,1)) \
+    X(KEY_RED,     OBJECT_PICKUP,                                       0.4f,   -1) \
+    X(KEY_GREEN,   OBJECT_PICKUP,                                       0.4f,   -1) \
+    X(KEY_BLUE,    OBJECT_PICKUP,                                       0.4f,   -1) \
+    X(KEY_YELLOW,  OBJECT_PICKUP,                                       0.4f,   -1)
+
+// Tipos de objetos maiores que 0 e menores que OBJECT_TYPE_LIMIT
+#define OBJECT_TYPE_LIMIT 48
+
+// Demais constantes do C++ usadas pelos shaders (veja GetShaderDefines())
+#define SHADER_CONSTANTS(X) \
+    X(PLAYER_HEAD) X(PLAYER_TORSO) X(PLAYER_ARM) X(PLAYER_HAND) X(PLAYER_LEG) X(PLAYER_FOOT) X(PLAYER) \
+    X(PLAYER_BONE_COUNT) X(PARTICLE) X(IMPOSTOR) X(IMPOSTOR_YAW_STEPS) X(IMPOSTOR_ROWS) X(SKYBOX) \
+    X(ANIM_NONE) X(ANIM_SPIN_KEY) X(ANIM_SPIN_COW) X(ANIM_SPIN_BOB_COW) X(DOOR_FRAME_LAYER)
+
+// Escala dos modelos dos itens coletáveis
+#define KEY_MODEL_SCALE     0.1f
+#define BABYCOW_MODEL_SCALE 0.35f
+
+// Chunks: os objetos do nível são carregados e desenhados só a até
+// CHUNK_LOAD_RADIUS chunks do chunk do jogador. Os inimigos andam a cada
+// quadro até CHUNK_SIMULATION_RADIUS, de ENEMY_COARSE_INTERVAL em
+// ENEMY_COARSE_INTERVAL quadros até CHUNK_COARSE_RADIUS e ficam parados além
+// disso (veja MoveEnemies()). O raio de simulação é menor que o de
+// carregamento para que os inimigos sempre colidam com os objetos dos chunks
+// vizinhos.
+#define CHUNK_SIZE              16
+#define CHUNK_LOAD_RADIUS       3
+#define CHUNK_SIMULATION_RADIUS 1
+#define CHUNK_COARSE_RADIUS     2
+#define ENEMY_COARSE_INTERVAL   4
+
+// Capacidade dos buffers das consultas de colisão (veja CollisionQuery) e dos
+// objetos próximos ao caminho de um inimigo (veja MoveEnemy())
+#define COLLISION_QUERY_CAPACITY 64
+#define NEARBY_OBJECTS_CAPACITY  256
+
+// Sons tocados ao mesmo tempo e sons pedidos em um passo da simulação (veja
+// PlaySound())
+#define SOUND_VOICES            4
+#define DEFERRED_SOUND_CAPACITY 8
+
+// Impostores: billboards dos itens giratórios distantes
+#define IMPOSTOR            90
+#define IMPOSTOR_YAW_STEPS  16      // Ângulos capturados por tipo de item
+#define IMPOSTOR_ROWS       5       // Linhas do atlas: 4 cores de chave e a vaca bebê
+#define IMPOSTOR_CELL_SIZE  64      // Resolução (em pixels) de cada captura
+#define IMPOSTOR_DISTANCE   10.0f   // Distância da câmera a partir da qual o item vira billboard
+#define IMPOSTOR_FADE_BAND  2.0f    // Largura da faixa (antes de IMPOSTOR_DISTANCE) em que o modelo se funde no billboard
+#define IMPOSTOR_TEXTURE_UNIT 3
+
+// Pacote de recursos gerado por "main --build-pack", procurado no diretório
+// do executável
+#define ASSET_PACK_FILENAME "cowmaze.pack"
+
+// Memória de GPU (em bytes) disponível para as texturas carregadas sob demanda
+#define TEXTURE_MEMORY_BUDGET (24 * 1024 * 1024)
+
+// Formato dos vértices das malhas durante a importação: posição (vec4), normal
+// (vec4) e coordenadas de textura (vec2), intercalados. Na GPU e no cache os
+// vértices são quantizados (veja PackedVertex).
+#define MESH_VERTEX_FLOATS 10
 
 #define ANIMATION_SPEED 10
 #define ITEM_ROTATION_SPEED 0.1
 
+// Animações procedurais calculadas no vertex shader (ver "shader_vertex.glsl")
+#define ANIM_NONE           0
+#define ANIM_SPIN_KEY       1   // Giro inclinado das chaves
+#define ANIM_SPIN_COW       2   // Giro da vaca bebê
+#define ANIM_SPIN_BOB_COW   3   // Giro lento e flutuação da vaca mãe
+
 #define SCREEN_EXIT         0
 #define SCREEN_MAINMENU     1
 #define SCREEN_LEVELSELECT  2
 #define SCREEN_GAME         3
 #define SCREEN_NEXTLEVEL    4
 
+// Níveis do jogo: "data/levels/1" a "data/levels/<LAST_LEVEL>"
+#define LAST_LEVEL          5
+
 ///////////////////////
 // VARIÁVEIS GLOBAIS //
 ///////////////////////
 
 std::map<string, SceneObject> g_VirtualScene;
-std::stack<glm::mat4>  g_MatrixStack;
+// Tipo (material) de cada parte do jogador, na mesma ordem em que DrawPlayer()
+// preenche o palette de matrizes
+const int g_PlayerBoneTypes[PLAYER_BONE_COUNT] = {
+    PLAYER_TORSO,
+    PLAYER_ARM, PLAYER_ARM, PLAYER_HAND,   // Braço direito
+    PLAYER_ARM, PLAYER_ARM, PLAYER_HAND,   // Braço esquerdo
+    PLAYER_LEG, PLAYER_LEG, PLAYER_FOOT,   // Perna direita
+    PLAYER_LEG, PLAYER_LEG, PLAYER_FOOT,   // Perna esquerda
+    PLAYER_HEAD
+};
 // Vetor que contém dados sobre os objetos dentro do mapa (usado para tratar colisões)
-std::vector<MapObject> map_objects;
+MapObjectList map_objects;
+// Nível em jogo e os seus chunks (veja UpdateLevelChunks())
+Level g_ActiveLevel;
+std::vector<LevelChunk> g_LevelChunks;
+int g_LevelChunkColumns = 0;
+int g_LevelChunkRows = 0;
+int g_LevelChunkCenter = -1; // Chunk do jogador na última atualização
+int g_EnemyFrame = 0;         // Quadros de simulação dos inimigos no nível
+std::vector<ObjectShape> g_ObjectShapes;
+// Próximo nível sendo preparado em segundo plano
+LevelPreload g_LevelPreload;
+// Arquivo do nível em jogo, recarregado quando editado (veja ReloadLevel())
+FileWatch g_LevelWatch = {"", "", -1, -1, -1};
 // Vetor de articulas
 std::vector<Particle> particles;
 
@@ -311,6 +964,10 @@ std::vector<Particle> particles;
 float g_ScreenRatio = 1.0f;
 int g_WindowWidth = 800, g_WindowHeight = 600;
 
+// Fator que converte tamanho/distância em pixels na tela para a seleção de LOD
+// (altura da janela / (2*tan(fov/2))). Zero desativa os LODs (ex.: menus ortográficos).
+float g_LodProjectionScale = 0.0f;
+
 // Variável que controla o tipo de projeção utilizada: perspectiva ou ortográfica.
 bool g_UsePerspectiveProjection = true;
 
@@ -333,10 +990,9 @@ bool g_LeftMouseButtonPressed = false;
 // Variável de controle da tela atual (menu principal, level select, jogo, etc)
 int g_CurrentScreen = SCREEN_MAINMENU;
 
-// Angulos de rotação dos itens
-// utilizado para controlar a rotação dos itens
-float g_ItemAngleY = 0.0f;
-float g_CowAngleY = 0.0f;
+// Tempo (em quadros) das animações procedurais dos itens. O ângulo de giro e
+// a flutuação são calculados a partir dele no vertex shader.
+float g_AnimationTime = 0.0f;
 
 // Variável de controle de encerramento de nível
 bool g_MapEnded = false;
@@ -399,7 +1055,33 @@ sf::SoundBuffer ball1sound;
 sf::SoundBuffer deathsound;
 sf::SoundBuffer winsound;
 sf::SoundBuffer bellsound;
-sf::Sound       sound;
+sf::Sound       sounds[SOUND_VOICES];
+int             g_NextSoundVoice = 0;
+// Sons pedidos durante um passo da simulação, tocados ao final dele (veja
+// BeginSimulationStep())
+bool g_InSimulationStep = false;
+sf::SoundBuffer* g_DeferredSounds[DEFERRED_SOUND_CAPACITY];
+int g_NumDeferredSounds = 0;
+
+#ifdef COWMAZE_CHECK_ALLOCATIONS
+// Alocações feitas por cada thread, contadas pelo operator new abaixo para
+// verificar que os passos da simulação não alocam memória. Só nos executáveis
+// de depuração ("make debug" e o alvo Debug do Code::Blocks).
+thread_local size_t g_ThreadHeapAllocations = 0;
+size_t g_SimulationStepAllocations = 0;
+
+void* operator new(size_t size) {
+    g_ThreadHeapAllocations++;
+    void* memory = malloc(size > 0 ? size : 1);
+    if (memory == NULL)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+#endif
 
 // Música
 sf::Music menumusic;
@@ -409,8 +1091,6 @@ sf::Music naturemusic;
 sf::Music crystalmusic;
 
 // Variáveis que definem um programa de GPU (shaders). Veja função LoadShadersFromFiles().
-GLuint vertex_shader_id;
-GLuint fragment_shader_id;
 GLuint program_id = 0;
 GLint model_uniform;
 GLint view_uniform;
@@ -418,15 +1098,171 @@ GLint projection_uniform;
 GLint object_id_uniform;
 GLint bbox_min_uniform;
 GLint bbox_max_uniform;
+GLint position_offset_uniform;
+GLint position_scale_uniform;
 GLint anim_timer_uniform;
 GLint yellow_particle_color_uniform;
-GLint skytheme_uniform;
+GLint bone_matrices_uniform;
+
+// Cubemaps da skybox, indexados pelo tema do nível (0 = sem skybox ou não
+// residente). Preenchidos por PrepareLevelAssets().
+GLuint g_SkyboxCubemaps[5] = {0, 0, 0, 0, 0};
+
+// Prefixo dos arquivos da skybox de cada tema (tema 0 e 2 não possuem céu)
+const char* g_ThemeSkyboxes[5] = {
+    NULL,
+    "../../data/textures/skyboxes/abra",
+    NULL,
+    "../../data/textures/skyboxes/froz",
+    "../../data/textures/skyboxes/mid"
+};
+
+// Funções de GL_ARB_get_program_binary, carregadas por
+// LoadGpuProgramExtensions() (NULL caso o driver não as ofereça)
+PFNGLGETPROGRAMBINARYPROC  g_glGetProgramBinary = NULL;
+PFNGLPROGRAMBINARYPROC     g_glProgramBinary = NULL;
+PFNGLPROGRAMPARAMETERIPROC g_glProgramParameteri = NULL;
+
+// Programas de GPU disparados por BeginGpuProgram() e ainda não concluídos
+std::map<GLuint, PendingGpuProgram> g_PendingGpuPrograms;
 
-// Número de texturas carregadas pela função LoadTextureImage()
-GLuint g_NumLoadedTextures = 0;
+// Diretório do executável (terminado em separador, ou vazio para o diretório
+// atual), onde ficam o pacote de recursos e o cache dos programas de GPU
+string g_ExecutableDirectory;
+
+// Texturas residentes na GPU, indexadas pelo nome do arquivo (ou da TextureArraySource)
+std::map<string, ResidentTexture> g_ResidentTextures;
+
+// Texturas comprimidas em BC1 (sRGB) são suportadas pela GPU? Definido logo
+// após a criação do contexto OpenGL; caso contrário, as imagens são enviadas
+// sem compressão.
+bool g_SupportsS3TC = false;
+unsigned int g_AssetUseStamp = 0;
+
+// Músicas já abertas por PlayMusicStream()
+std::set<sf::Music*> g_OpenedMusic;
+
+// Impostores dos itens giratórios, indexados pelo tipo do objeto
+std::map<int, Impostor> g_Impostors;
+GLint impostor_cell_uniform;
+GLint dither_range_uniform;
+GLint anim_time_uniform;
+GLint anim_type_uniform;
+GLint anim_phase_uniform;
 
 int main(int argc, char* argv[])
 {
+    // Conversor: "main --build-mesh-cache <modelos>" gera os caches binários
+    // dos modelos ".obj" dados e encerra, sem abrir a janela.
+    if ( argc > 1 && string(argv[1]) == "--build-mesh-cache" )
+    {
+        for (int i = 2; i < argc; i++)
+        {
+            ObjModel model(argv[i]);
+            ComputeNormals(&model);
+            MeshData mesh;
+            BuildTriangles(&model, &mesh);
+            if (!SaveMeshCache(argv[i], mesh))
+                return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // Conversor: "main --build-texture-cache" gera as texturas comprimidas
+    // (com mipmaps) dos materiais e da água e encerra.
+    if ( argc > 1 && string(argv[1]) == "--build-texture-cache" )
+    {
+        TextureArraySource sources[2] = {TileTextureSource(), WaterTextureSource()};
+        for (int i = 0; i < 2; i++)
+        {
+            TextureData texture;
+            BuildCompressedTexture(DecodeTextureArray(sources[i]), &texture);
+            if (!SaveTextureCache(texture))
+                return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // Conversor: "main --build-level <nível> <saída>" grava um nível (texto
+    // ou binário) no formato binário e encerra.
+    if ( argc == 4 && string(argv[1]) == "--build-level" )
+    {
+        try
+        {
+            return SaveBinaryLevel(argv[3], LoadLevelFromFile(argv[2])) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        catch ( std::exception& e )
+        {
+            fprintf(stderr, "\nERROR: %s\n", e.what());
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Gerador de níveis: "main --generate-level <saída> [--seed=N] [--size=N]
+    // [--theme=N] [--time=N] [--walls=F] [--fires=N] [--jets=N] [--balls=N]
+    // [--volleyballs=N] [--keys=N] [--cows=N] [--binary]" grava um labirinto
+    // aleatório (com solução) e encerra.
+    if ( argc > 2 && string(argv[1]) == "--generate-level" )
+    {
+        LevelGeneratorOptions options = {1, 64, 0, 0, 0.9f, 0, 0, 0, 0, 0, 0, false};
+        for (int i = 3; i < argc; i++)
+        {
+            if (!ParseLevelGeneratorOption(argv[i], &options))
+            {
+                fprintf(stderr, "ERROR: invalid option \"%s\".\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        if (options.size < 5 || options.size > LEVEL_GENERATOR_MAX_SIZE || options.theme > 4)
+        {
+            fprintf(stderr, "ERROR: size must be between 5 and %d and theme between 0 and 4.\n", LEVEL_GENERATOR_MAX_SIZE);
+            return EXIT_FAILURE;
+        }
+
+        Level level = GenerateLevel(options);
+        bool saved = options.binary ? SaveBinaryLevel(argv[2], level) : SaveTextLevel(argv[2], level);
+        return saved ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Construtor do pacote de recursos: "main --build-pack <pacote> <arquivos>"
+    // atualiza os caches das texturas e dos modelos ".obj" dados e grava o
+    // pacote com eles (no lugar dos ".obj") e com os demais arquivos, na
+    // ordem em que foram dados.
+    if ( argc > 2 && string(argv[1]) == "--build-pack" )
+    {
+        std::vector<string> files;
+
+        // As imagens de origem também vão para o pacote, para GPUs sem BC1
+        TextureArraySource sources[2] = {TileTextureSource(), WaterTextureSource()};
+        for (int i = 0; i < 2; i++)
+        {
+            LoadCompressedTexture(sources[i]);
+            files.push_back(sources[i].name + ".texcache");
+            files.insert(files.end(), sources[i].files.begin(), sources[i].files.end());
+        }
+
+        for (int i = 3; i < argc; i++)
+        {
+            string filename = argv[i];
+            if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".obj") == 0)
+            {
+                LoadMesh(filename);
+                filename += ".meshcache";
+            }
+            files.push_back(filename);
+        }
+        return WriteAssetPack(argv[2], files) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Pacote de recursos: procurado ao lado do executável, para que o jogo
+    // funcione a partir de qualquer diretório. Sem ele, os recursos são lidos
+    // dos arquivos avulsos em "../../data" e "../../src".
+    string executable = argv[0];
+    size_t separator = executable.find_last_of("/\\");
+    if (separator != string::npos)
+        g_ExecutableDirectory = executable.substr(0, separator + 1);
+    OpenAssetPack((g_ExecutableDirectory + ASSET_PACK_FILENAME).c_str());
+
     // Inicializações
     int success = glfwInit();
     if (!success)
@@ -459,62 +1295,58 @@ int main(int argc, char* argv[])
     glfwSetWindowSize(window, g_WindowWidth, g_WindowHeight); // Forçamos a chamada do callback acima, para definir g_ScreenRatio.
 
     PrintGPUInfoInTerminal();
-    LoadShadersFromFiles();
-
-    // Carregamento de imagens
-    LoadTextureImage("../../data/textures/textures.png");   		// TextureImage0
-    LoadTextureImage("../../data/textures/water.png");              // TextureImage1
-    LoadTextureImage("../../data/textures/abra.png");               // TextureImage2
-    LoadTextureImage("../../data/textures/frozen.png");             // TextureImage3
-    LoadTextureImage("../../data/textures/midnat.png");             // TextureImage4
-
-    // Carregamento de models
-    ObjModel spheremodel("../../data/objects/sphere.obj");
-    ComputeNormals(&spheremodel);
-    BuildTrianglesAndAddToVirtualScene(&spheremodel);
+    LoadGpuProgramExtensions();
 
-    ObjModel bunnymodel("../../data/objects/bunny.obj");
-    ComputeNormals(&bunnymodel);
-    BuildTrianglesAndAddToVirtualScene(&bunnymodel);
+    // Os programas de GPU são compilados pelo driver (ao mesmo tempo, caso
+    // ele suporte KHR_parallel_shader_compile) enquanto os recursos são
+    // carregados abaixo
+    CompileShadersFromFiles();
+    TextRendering_CompileShaders();
 
-    ObjModel planemodel("../../data/objects/plane.obj");
-    ComputeNormals(&planemodel);
-    BuildTrianglesAndAddToVirtualScene(&planemodel);
+    g_SupportsS3TC = IsExtensionSupported("GL_EXT_texture_compression_s3tc")
+                  && (IsExtensionSupported("GL_EXT_texture_sRGB") || IsExtensionSupported("GL_EXT_texture_compression_s3tc_srgb"));
 
-    ObjModel cubemodel("../../data/objects/cube.obj");
-    ComputeNormals(&cubemodel);
-    BuildTrianglesAndAddToVirtualScene(&cubemodel);
+    // Os arquivos são lidos e decodificados em paralelo; a thread principal
+    // só envia para a GPU o que já está pronto.
+    std::vector<AssetLoadTask> tasks;
 
-    ObjModel cowmodel("../../data/objects/cow.obj");
-    ComputeNormals(&cowmodel);
-    BuildTrianglesAndAddToVirtualScene(&cowmodel);
+    // Aqui são carregados apenas os recursos usados pelos menus e por todos os
+    // níveis; os demais (skyboxes, água, modelos específicos, músicas dos
+    // níveis) são carregados sob demanda por PrepareLevelAssets().
 
-    ObjModel keymodel("../../data/objects/key.obj");
-    ComputeNormals(&keymodel);
-    BuildTrianglesAndAddToVirtualScene(&keymodel);
+    // Carregamento de imagens
+    tasks.push_back(TextureArrayLoadTask(TileTextureSource(), TILE_TEXTURE_UNIT, true));
 
-    ObjModel jetmodel("../../data/objects/jet.obj");
-    ComputeNormals(&jetmodel);
-    BuildTrianglesAndAddToVirtualScene(&jetmodel);
+    // Carregamento de models
+    tasks.push_back(MeshLoadTask("../../data/objects/plane.obj"));
+    tasks.push_back(MeshLoadTask("../../data/objects/cow.obj"));
+    tasks.push_back(MeshLoadTask("../../data/objects/key.obj"));
+
+    // O cubo também dá origem ao modelo do jogador
+    tasks.push_back([]() -> AssetUpload {
+        std::shared_ptr<MeshData> mesh = LoadMesh("../../data/objects/cube.obj");
+        return [mesh]() {
+            UploadMeshAndAddToVirtualScene(mesh.get());
+            BuildPlayerModelAndAddToVirtualScene(mesh.get());
+        };
+    });
 
     // Carregamento de sons
-    LoadSoundFromFile("../../data/sound/menucursor.wav", &menucursorsound);
-    LoadSoundFromFile("../../data/sound/menuenter.wav", &menuentersound);
-    LoadSoundFromFile("../../data/sound/key.wav", &keysound);
-    LoadSoundFromFile("../../data/sound/cow.wav", &cowsound);
-    LoadSoundFromFile("../../data/sound/door.wav", &doorsound);
-    LoadSoundFromFile("../../data/sound/splash.wav", &splashsound);
-    LoadSoundFromFile("../../data/sound/ball1.wav", &ball1sound);
-    LoadSoundFromFile("../../data/sound/death.wav", &deathsound);
-    LoadSoundFromFile("../../data/sound/win.wav", &winsound);
-    LoadSoundFromFile("../../data/sound/bell.wav", &bellsound);
-
-    // Carregamento de música
-    LoadMusicFromFile("../../data/music/velapax.ogg", &menumusic);
-    LoadMusicFromFile("../../data/music/landingbase.ogg", &techmusic);
-    LoadMusicFromFile("../../data/music/highway.ogg", &watermusic);
-    LoadMusicFromFile("../../data/music/rock1.ogg", &naturemusic);
-    LoadMusicFromFile("../../data/music/lax_here.ogg", &crystalmusic);
+    tasks.push_back(SoundLoadTask("../../data/sound/menucursor.wav", &menucursorsound));
+    tasks.push_back(SoundLoadTask("../../data/sound/menuenter.wav", &menuentersound));
+    tasks.push_back(SoundLoadTask("../../data/sound/key.wav", &keysound));
+    tasks.push_back(SoundLoadTask("../../data/sound/cow.wav", &cowsound));
+    tasks.push_back(SoundLoadTask("../../data/sound/door.wav", &doorsound));
+    tasks.push_back(SoundLoadTask("../../data/sound/splash.wav", &splashsound));
+    tasks.push_back(SoundLoadTask("../../data/sound/ball1.wav", &ball1sound));
+    tasks.push_back(SoundLoadTask("../../data/sound/death.wav", &deathsound));
+    tasks.push_back(SoundLoadTask("../../data/sound/win.wav", &winsound));
+    tasks.push_back(SoundLoadTask("../../data/sound/bell.wav", &bellsound));
+
+    double load_start = glfwGetTime();
+    LoadAssetsInParallel(tasks);
+    LoadShadersFromFiles();
+    printf("Recursos carregados em %.2f s.\n", glfwGetTime() - load_start);
 
     if ( argc > 1 )
     {
@@ -522,6 +1354,9 @@ int main(int argc, char* argv[])
         BuildTrianglesAndAddToVirtualScene(&model);
     }
 
+    // Capturas dos itens giratórios usadas como billboards à distância
+    BuildImpostorAtlas();
+
     // Inicializamos o código para renderização de texto.
     TextRendering_Init();
 
@@ -552,6 +1387,7 @@ int main(int argc, char* argv[])
     	if (g_CurrentScreen == SCREEN_GAME) {
             PlayLevelMusic(g_CurrentLevel);
     		g_CurrentScreen = RenderLevel(g_CurrentLevel, window);
+            FinishLevelPreload();
     		if ((g_CurrentScreen != SCREEN_GAME && g_CurrentScreen != SCREEN_NEXTLEVEL) || (g_CurrentLevel != 1 && g_CurrentScreen == SCREEN_NEXTLEVEL))
                 PlayMenuMusic();
         }
@@ -559,7 +1395,7 @@ int main(int argc, char* argv[])
     	// Next level
     	if (g_CurrentScreen == SCREEN_NEXTLEVEL) {
     		g_CurrentLevel++;
-    		if (g_CurrentLevel > 5) {
+    		if (g_CurrentLevel > LAST_LEVEL) {
                 g_CurrentLevel = 1;
                 g_CurrentScreen = SCREEN_MAINMENU;
                 PlayMenuMusic();
@@ -626,6 +1462,123 @@ constexpr unsigned int string2int(const char* str, int h) {
     return !str[h] ? 5381 : (string2int(str, h+1)*33) ^ str[h];
 }
 
+// Nomes dos tiles da planta de um nível. O código de cada tile é a sua
+// posição nesta lista; o código 0 indica um tile desconhecido. Os códigos
+// são gravados nos níveis binários: novos tiles vão no final da lista.
+constexpr const char* TILE_NAMES[] = {
+    "",
+    "BL", "WO", "SB", "BR", "CR", "WA", "FI", "DI", "BD",
+    "kr", "kg", "kb", "ky", "DR", "DG", "DB", "DY",
+    "co", "CW", "J0", "J1", "J2", "J3", "B0", "B1", "B2", "B3", "V0",
+    "PS", "FF", "GR", "SN", "DD",
+};
+#define TILE_UNKNOWN 0
+#define TILE_COUNT   (sizeof(TILE_NAMES) / sizeof(TILE_NAMES[0]))
+
+// Procura na lista o tile com o código string2int() dado
+constexpr uint8_t FindTileCode(unsigned int name_hash, unsigned int code) {
+    return code == TILE_COUNT ? TILE_UNKNOWN
+         : string2int(TILE_NAMES[code]) == name_hash ? code
+         : FindTileCode(name_hash, code + 1);
+}
+
+// Código de um tile pelo seu nome, em tempo de compilação
+// (ex.: "case TileCode("BL"):")
+constexpr uint8_t TileCode(const char* name) {
+    return FindTileCode(string2int(name), 1);
+}
+
+// Verifica se os códigos string2int() dos nomes são todos diferentes
+constexpr bool TileNamesAreUnique(unsigned int code = 1) {
+    return code == TILE_COUNT || (TileCode(TILE_NAMES[code]) == code && TileNamesAreUnique(code + 1));
+}
+static_assert(TileNamesAreUnique(), "Nomes de tiles repetidos ou com o mesmo string2int().");
+static_assert(TILE_COUNT <= 256, "Códigos de tiles não cabem em um byte.");
+
+// Características de um tipo de objeto do mapa (veja OBJECT_TYPE_TABLE)
+struct ObjectTraits {
+    uint8_t flags;    // OBJECT_*
+    float tolerance;
+    int material;
+};
+
+struct ObjectTypeTraits {
+    int type;
+    ObjectTraits traits;
+};
+
+#define OBJECT_TYPE_ROW(type, flags, tolerance, material) {type, {flags, tolerance, material}},
+constexpr ObjectTypeTraits OBJECT_TYPE_ROWS[] = { OBJECT_TYPE_TABLE(OBJECT_TYPE_ROW) };
+#undef OBJECT_TYPE_ROW
+#define OBJECT_TYPE_ROW_COUNT (sizeof(OBJECT_TYPE_ROWS) / sizeof(OBJECT_TYPE_ROWS[0]))
+
+// Procura um tipo em OBJECT_TYPE_TABLE
+constexpr ObjectTraits FindObjectTraits(int type, unsigned int row = 0) {
+    return row == OBJECT_TYPE_ROW_COUNT ? ObjectTraits{0, -0.1f, -1}
+         : OBJECT_TYPE_ROWS[row].type == type ? OBJECT_TYPE_ROWS[row].traits
+         : FindObjectTraits(type, row + 1);
+}
+
+// Características de cada tipo, indexadas pelo tipo (montadas em tempo de
+// compilação a partir de OBJECT_TYPE_TABLE)
+#define OBJECT_TRAITS_8(type) \
+    FindObjectTraits(type),     FindObjectTraits(type + 1), FindObjectTraits(type + 2), FindObjectTraits(type + 3), \
+    FindObjectTraits(type + 4), FindObjectTraits(type + 5), FindObjectTraits(type + 6), FindObjectTraits(type + 7)
+constexpr ObjectTraits OBJECT_TRAITS[OBJECT_TYPE_LIMIT] = {
+    OBJECT_TRAITS_8(0), OBJECT_TRAITS_8(8), OBJECT_TRAITS_8(16), OBJECT_TRAITS_8(24), OBJECT_TRAITS_8(32), OBJECT_TRAITS_8(40)
+};
+#undef OBJECT_TRAITS_8
+
+// Verifica se os tipos da tabela cabem em OBJECT_TRAITS e não se repetem
+constexpr unsigned int CountObjectTypeRows(int type, unsigned int row = 0) {
+    return row == OBJECT_TYPE_ROW_COUNT ? 0
+         : (OBJECT_TYPE_ROWS[row].type == type ? 1 : 0) + CountObjectTypeRows(type, row + 1);
+}
+constexpr bool ObjectTypesAreValid(unsigned int row = 0) {
+    return row == OBJECT_TYPE_ROW_COUNT
+        || (OBJECT_TYPE_ROWS[row].type > 0 && OBJECT_TYPE_ROWS[row].type < OBJECT_TYPE_LIMIT
+            && CountObjectTypeRows(OBJECT_TYPE_ROWS[row].type) == 1 && ObjectTypesAreValid(row + 1));
+}
+static_assert(ObjectTypesAreValid(), "Tipos de objetos repetidos ou fora de OBJECT_TRAITS.");
+static_assert(OBJECT_TYPE_LIMIT % 8 == 0, "OBJECT_TRAITS é montada de 8 em 8 tipos.");
+
+// Resultado de uma consulta de colisão (GetObjectsCollidingWithObject()),
+// em um buffer do chamador, sem alocações. Os objetos encontrados são
+// classificados na mesma varredura que os encontra: as perguntas feitas em
+// seguida (há parede? há água? qual chave?) não percorrem a lista de novo.
+struct CollisionQuery {
+    int count;                             // Objetos em "objects"
+    int objects[COLLISION_QUERY_CAPACITY]; // Índices em map_objects, em ordem crescente
+    uint8_t flags;                         // União das flags dos objetos (OBJECT_*)
+    uint64_t types;                        // Bit "tipo" ligado: há objeto do tipo
+    int first_of_type[OBJECT_TYPE_LIMIT];  // Primeiro objeto de cada tipo em "types"
+};
+
+// Objetos que um inimigo pode tocar em vários quadros seguidos (veja MoveEnemy())
+struct NearbyObjects {
+    int count;
+    int objects[NEARBY_OBJECTS_CAPACITY]; // Índices em map_objects, em ordem crescente
+};
+
+static_assert(OBJECT_TYPE_LIMIT <= 64, "Os tipos de objetos devem caber em CollisionQuery::types.");
+
+// Tabela com o código de cada par de caracteres, montada uma única vez a
+// partir de TILE_NAMES e usada na leitura dos níveis
+struct TileCodeTable {
+    uint8_t codes[256 * 256];
+    TileCodeTable() {
+        memset(codes, TILE_UNKNOWN, sizeof(codes));
+        for (unsigned int code = 1; code < TILE_COUNT; code++)
+            codes[(unsigned char)TILE_NAMES[code][0] * 256 + (unsigned char)TILE_NAMES[code][1]] = code;
+    }
+};
+
+// Código do tile de nome "first second" (TILE_UNKNOWN caso não exista)
+uint8_t TileCodeFromChars(char first, char second) {
+    static const TileCodeTable table;
+    return table.codes[(unsigned char)first * 256 + (unsigned char)second];
+}
+
 ////////////////////////////
 // RENDERIZAÇÕES DE TELAS //
 ////////////////////////////
@@ -637,6 +1590,7 @@ int RenderMainMenu(GLFWwindow* window) {
 	camera_position_c = vec4(0.0f, 0.0f, 0.0f, 1.0f);
 	camera_view_vector = camera_lookat_l - camera_position_c;
 	g_CameraDistance = 2.5f;
+    g_LodProjectionScale = 0.0f;
     key_space_pressed = false;
     int menu_position = 0;
 
@@ -653,9 +1607,7 @@ int RenderMainMenu(GLFWwindow* window) {
         string exit_text = "EXIT GAME";
 
         // Rotação/animação da vaca
-        g_ItemAngleY += ITEM_ROTATION_SPEED;
-        if (g_ItemAngleY >= 2*PI)
-            g_ItemAngleY = 0;
+        AdvanceAnimationTime();
 
         // Movimentação do menu
         if (key_w_pressed and menu_position > 0) {
@@ -696,11 +1648,8 @@ int RenderMainMenu(GLFWwindow* window) {
 
         // Desenhamos a vaca
     	glm::mat4 cowmodel = Matrix_Translate(1.0f, 0.21f - menu_position * 0.3f, -0.45f)
-        	* Matrix_Scale(0.1f, 0.1f, 0.1f)
-        	* Matrix_Translate(-0.2f, 0.0f, 0.0f)
-        	* Matrix_Rotate_Y(g_ItemAngleY)
-        	* Matrix_Translate(0.2f, 0.0f, 0.0f);
-        DrawVirtualObject("cow", BABYCOW, cowmodel);
+        	* Matrix_Scale(0.1f, 0.1f, 0.1f);
+        DrawAnimatedObject("cow", BABYCOW, cowmodel, ANIM_SPIN_COW, 0.0f);
 
         // Imprimimos o texto
         // Caso o texto esteja selecionado, ele fica maior.
@@ -734,6 +1683,7 @@ int RenderLevelSelection(GLFWwindow* window) {
 	camera_position_c = vec4(0.0f, 0.0f, 0.0f, 1.0f);
 	g_CameraDistance = 2.5f;
 	camera_view_vector = camera_lookat_l - camera_position_c;
+    g_LodProjectionScale = 0.0f;
 	key_space_pressed = false;
     int menu_position = 0;
     int chosen_level = 1;
@@ -752,9 +1702,7 @@ int RenderLevelSelection(GLFWwindow* window) {
         string go_text = "GO!";
 
         // Animação da vaca
-        g_ItemAngleY += ITEM_ROTATION_SPEED;
-        if (g_ItemAngleY >= 2*PI)
-            g_ItemAngleY = 0;
+        AdvanceAnimationTime();
 
         // Se o usuário aperta esc, volta para o menu anterior
         if (esc_pressed) {
@@ -808,11 +1756,8 @@ int RenderLevelSelection(GLFWwindow* window) {
         glUniformMatrix4fv(projection_uniform , 1 , GL_FALSE , glm::value_ptr(projection));
 
     	glm::mat4 cowmodel = Matrix_Translate(1.0f, 0.21f - menu_position * 0.3f, -0.45f)
-        	* Matrix_Scale(0.1f, 0.1f, 0.1f)
-        	* Matrix_Translate(-0.2f, 0.0f, 0.0f)
-        	* Matrix_Rotate_Y(g_ItemAngleY)
-        	* Matrix_Translate(0.2f, 0.0f, 0.0f);
-        DrawVirtualObject("cow", BABYCOW, cowmodel);
+        	* Matrix_Scale(0.1f, 0.1f, 0.1f);
+        DrawAnimatedObject("cow", BABYCOW, cowmodel, ANIM_SPIN_COW, 0.0f);
 
         // Escrita dos textos na tela
         if(menu_position == 0 && !choosing_level)
@@ -852,7 +1797,9 @@ int RenderLevel(int level_number, GLFWwindow* window) {
 	g_MapEnded = false;
 	g_DeathByWater = false;
 	g_DeathByEnemy = false;
-    g_ItemAngleY = 0;
+    g_AnimationTime = 0.0f;
+    glUseProgram(program_id);
+    glUniform1f(anim_time_uniform, g_AnimationTime);
 	g_useFirstPersonCamera = false;
     straight_vector_sign = 1.0f;
     sideways_vector_sign = 0.0f;
@@ -878,13 +1825,31 @@ int RenderLevel(int level_number, GLFWwindow* window) {
     // Variáveis de controle da mensagem de morte
     string message = "";
 
-    // Carrega nível um
+    // Carrega o nível: o preparado em segundo plano durante o fim do nível
+    // anterior ou, caso não haja um, diretamente do arquivo
     string levelpath = "../../data/levels/" + std::to_string(level_number);
-    Level level = LoadLevelFromFile(levelpath);
-    RegisterLevelObjects(level);
+    Level& level = g_ActiveLevel;
+    MapObjectList preloaded_objects;
+    bool preloaded = TakeLevelPreload(level_number, &level, &map_objects, &preloaded_objects);
+    if (!preloaded) {
+        level = LoadLevelFromFile(levelpath);
+        RegisterTileSamples(&map_objects, level);
+    }
+    PrepareLevelAssets(map_objects, level.theme);
+    map_objects.clear();
     g_LevelCowAmount = level.cow_no;
-    player_position = GetPlayerSpawnCoordinates(level.plant);
+    player_position = GetPlayerSpawnCoordinates(level);
     camera_lookat_l = player_position;
+    StartLevelChunks();
+    if (preloaded)
+        AdoptLevelChunks(&preloaded_objects, player_position);
+
+    // Espaço pressionado na mensagem de fim do nível, antes de o próximo
+    // nível estar pronto
+    bool next_level_requested = false;
+
+    // Edições do arquivo do nível são aplicadas durante o jogo
+    StartFileWatch(levelpath, &g_LevelWatch);
 
     // Ficamos em loop, renderizando
     while (true)
@@ -897,7 +1862,12 @@ int RenderLevel(int level_number, GLFWwindow* window) {
         // Retorno para tela inicial
         if(esc_pressed)
         	return SCREEN_MAINMENU;
+        if (FileWatchChanged(&g_LevelWatch))
+            ReloadLevel(levelpath);
         if(g_MapEnded) {
+            // O próximo nível é preparado enquanto a mensagem é mostrada
+            if (level_number < LAST_LEVEL)
+                StartLevelPreload(level_number + 1);
             g_ShowingMessage = true;
             message = "Congratulations! You finished this level :)";
         }
@@ -940,6 +1910,7 @@ int RenderLevel(int level_number, GLFWwindow* window) {
         // Projeção perspectiva
         float field_of_view = 3.141592 / 3.0f;
         projection = Matrix_Perspective(field_of_view, g_ScreenRatio, nearplane, farplane);
+        g_LodProjectionScale = g_WindowHeight / (2.0f * tan(field_of_view / 2.0f));
         glUniformMatrix4fv(view_uniform       , 1 , GL_FALSE , glm::value_ptr(view));
         glUniformMatrix4fv(projection_uniform , 1 , GL_FALSE , glm::value_ptr(projection));
 
@@ -947,12 +1918,19 @@ int RenderLevel(int level_number, GLFWwindow* window) {
         // JOGADOR //
         /////////////
 
+        // Chunks ao redor do jogador
+        UpdateLevelChunks(player_position);
+
         // Movimentação do personagem, mensagens e animações de morte
         if (g_ShowingMessage) {
             //TextRendering_PrintString(window, message.c_str(), -0.7f, 0.3f, 2.5f);
+            // Envios para a GPU do próximo nível, um por quadro
+            bool next_level_ready = UpdateLevelPreload();
             if (key_space_pressed && !g_MapEnded)
                 return SCREEN_GAME;
             else if (key_space_pressed)
+                next_level_requested = true;
+            if (next_level_requested && next_level_ready)
                 return SCREEN_NEXTLEVEL;
         } else if (g_DeathByWater || g_DeathByEnemy) {
             death_timer -= 10;
@@ -971,7 +1949,11 @@ int RenderLevel(int level_number, GLFWwindow* window) {
             else if (g_DeathByEnemy && death_timer >= 990)
                 PlaySound(&deathsound);
         }
-        else MovePlayer(level.theme);
+        else {
+            BeginSimulationStep();
+            MovePlayer(level.theme);
+            EndSimulationStep();
+        }
 
         // Ajusta vetores de direção
         straight_vector = straight_vector_sign * camera_xz_direction;
@@ -995,19 +1977,18 @@ int RenderLevel(int level_number, GLFWwindow* window) {
         ///////////////////
 
         DrawMapObjects(); // Desenha
-        if (!g_ShowingMessage)
+        if (!g_ShowingMessage) {
+            BeginSimulationStep();
             MoveEnemies();    // Movimenta inimigos
-
-        BobCow();
+            EndSimulationStep();
+        }
 
         ////////////
         // SKYBOX //
         ////////////
 
-        if (level.theme > 0) {
-            DrawSkyboxPlanes();
-            glUniform1i(skytheme_uniform, level.theme);
-        }
+        // Desenhada por último: só preenche os pixels que restaram no far plane
+        DrawSkybox(level.theme);
 
         ///////////////
         // ANIMAÇÕES //
@@ -1021,15 +2002,8 @@ int RenderLevel(int level_number, GLFWwindow* window) {
         	curr_anim_tile = (curr_anim_tile+1) % 16;
 		glUniform1i(anim_timer_uniform, curr_anim_tile);
 
-		// Rotação dos itens
-		g_ItemAngleY += ITEM_ROTATION_SPEED;
-		if (g_ItemAngleY >= 2*PI)
-			g_ItemAngleY = 0;
-
-        // Rotação da vaca mãe
-        g_CowAngleY += ITEM_ROTATION_SPEED / 4;
-        if (g_CowAngleY >= 2*PI)
-            g_CowAngleY = 0;
+		// Rotação dos itens e flutuação da vaca mãe (feitas no vertex shader)
+		AdvanceAnimationTime();
 
 		// Fogo: partículas
 		AnimateParticles();
@@ -1087,59 +2061,84 @@ void ClearInventory() {
     player_inventory.cows = 0;
 }
 
-// Retorna a posição da vaca mãe no vetor de objetos
-int GetCowMotherPosition() {
-    for(unsigned int i=0; i < map_objects.size(); i++) {
-        if (map_objects[i].object_type == COW)
-            return i;
-    }
-    return -1;
-}
-
-// Função que registra os objetos do nível com base na sua planta
-void RegisterLevelObjects(Level level) {
+// Função que registra em "objects" os objetos de uma região do nível com base
+// na sua planta (linhas first_line a last_line - 1, colunas first_col a
+// last_col - 1)
+void RegisterLevelObjects(MapObjectList* objects, const Level& level, int first_line, int first_col, int last_line, int last_col) {
     float center_x = (level.width-1)/2.0f;
     float center_z = (level.height-1)/2.0f;
 
-    for(int line = 0; line < level.height; line++) {
-        for(int col = 0; col < level.width; col++) {
-            string current_tile = level.plant[line][col];
+    for(int line = first_line; line < last_line; line++) {
+        // Primeira entidade desta linha da região (ordenadas pelo tile)
+        LevelEntity first = {line * level.width + first_col, 0, 0.0f};
+        std::vector<LevelEntity>::const_iterator next_entity = std::lower_bound(level.entities.begin(), level.entities.end(), first,
+            [](const LevelEntity& a, const LevelEntity& b) { return a.tile < b.tile; });
+
+        for(int col = first_col; col < last_col; col++) {
+            int tile_index = line * level.width + col;
+            uint8_t current_tile = level.tiles[tile_index];
             float x = -(center_x - col);
             float z = -(center_z - line);
 
-            RegisterObjectInMapVector(current_tile, x, z, level.theme);
+            size_t first_object = objects->size();
+            RegisterObjectInMapVector(objects, current_tile, x, z, level.theme);
+            for (size_t i = first_object; i < objects->size(); i++)
+                objects->details[i].tile = tile_index;
+
+            // Estado inicial dado pelo nível para o inimigo deste tile
+            if (next_entity != level.entities.end() && next_entity->tile == tile_index) {
+                const LevelEntity& entity = *next_entity++;
+                for (size_t i = first_object; i < objects->size(); i++) {
+                    if ((*objects)[i].flags & OBJECT_ENEMY) {
+                        (*objects)[i].direction = entity.direction;
+                        (*objects)[i].gravity = entity.gravity;
+                    }
+                }
+            }
         }
     }
 }
 
+// Registra um objeto de cada tipo de tile usado pelo nível (na origem), para
+// que PrepareLevelAssets() carregue os recursos de todos os chunks antes do
+// início do nível
+void RegisterTileSamples(MapObjectList* objects, const Level& level) {
+    bool used[TILE_COUNT] = {false};
+    for (size_t i = 0; i < level.tiles.size(); i++)
+        used[level.tiles[i]] = true;
+    for (unsigned int code = 0; code < TILE_COUNT; code++)
+        if (used[code])
+            RegisterObjectInMapVector(objects, code, 0.0f, 0.0f, level.theme);
+}
+
 // Registra um piso com base no tema do nível
-void RegisterFloor(float x, float z, int theme) {
+void RegisterFloor(MapObjectList* objects, float x, float z, int theme) {
     vec3 tile_size = vec3(1.0f, 0.0f, 1.0f);
     vec3 planemodel_size = vec3(1.0f, 1.0f, 1.0f);
     float floor_shift = -1.0f;
 
     switch(theme) {
         case 0:
-            RegisterObjectInMap(FLOOR, vec4(x, floor_shift, z, 1.0f), tile_size, "plane", planemodel_size);
+            RegisterObjectInMap(objects, FLOOR, vec4(x, floor_shift, z, 1.0f), tile_size, "plane", planemodel_size);
             break;
         case 1:
-            RegisterObjectInMap(GRASS, vec4(x, floor_shift, z, 1.0f), tile_size, "plane", planemodel_size);
+            RegisterObjectInMap(objects, GRASS, vec4(x, floor_shift, z, 1.0f), tile_size, "plane", planemodel_size);
             break;
         case 2:
-            RegisterObjectInMap(DARKFLOOR, vec4(x, floor_shift, z, 1.0f), tile_size, "plane", planemodel_size);
+            RegisterObjectInMap(objects, DARKFLOOR, vec4(x, floor_shift, z, 1.0f), tile_size, "plane", planemodel_size);
             break;
         case 3:
-            RegisterObjectInMap(SNOW, vec4(x, floor_shift, z, 1.0f), tile_size, "plane", planemodel_size);
+            RegisterObjectInMap(objects, SNOW, vec4(x, floor_shift, z, 1.0f), tile_size, "plane", planemodel_size);
             break;
         case 4:
-            RegisterObjectInMap(DARKDIRT, vec4(x, floor_shift, z, 1.0f), tile_size, "plane", planemodel_size);
+            RegisterObjectInMap(objects, DARKDIRT, vec4(x, floor_shift, z, 1.0f), tile_size, "plane", planemodel_size);
             break;
     }
 }
 
 // Função que registra um objeto em dada posição do mapa
 // CASO SE QUEIRA ADICIONAR NOVOS OBJETOS, DEVE-SE FAZÊ-LO AQUI
-void RegisterObjectInMapVector(string tile_type, float x, float z, int theme) {
+void RegisterObjectInMapVector(MapObjectList* objects, uint8_t tile, float x, float z, int theme) {
     /* Propriedades de objetos (deslocamento, tamanho, etc) */
 
     // Cubo (genérico)
@@ -1151,7 +2150,7 @@ void RegisterObjectInMapVector(string tile_type, float x, float z, int theme) {
     float dirtblock_vertical_shift = -0.6f;
 
     // Chaves
-    vec3 keymodel_size = vec3(0.1f, 0.1f, 0.1f);
+    vec3 keymodel_size = vec3(KEY_MODEL_SCALE, KEY_MODEL_SCALE, KEY_MODEL_SCALE);
     float key_vertical_shift = -1.0f;
     vec3 key_size = vec3(0.5f, 0.5f, 0.5f);
 
@@ -1160,7 +2159,7 @@ void RegisterObjectInMapVector(string tile_type, float x, float z, int theme) {
     float cow_vertical_shift = -0.5f;
 
     // Vaca bebê (a ser coletada)
-    vec3 babycow_size = vec3(0.35f, 0.35f, 0.35f);
+    vec3 babycow_size = vec3(BABYCOW_MODEL_SCALE, BABYCOW_MODEL_SCALE, BABYCOW_MODEL_SCALE);
     float babycow_vertical_shift = -0.5f;
 
     // Jet
@@ -1179,194 +2178,194 @@ void RegisterObjectInMapVector(string tile_type, float x, float z, int theme) {
     float floor_shift = -1.0f;
 
     /* Adicione novos tipos de objetos abaixo */
-    switch(string2int(tile_type.c_str())) {
+    switch(tile) {
     // Parede
-    case string2int("BL"): {
-        RegisterObjectInMap(WALL, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
+    case TileCode("BL"): {
+        RegisterObjectInMap(objects, WALL, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
         break;
     }
 
     // Madeira
-    case string2int("WO"): {
-        RegisterObjectInMap(WOOD, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
+    case TileCode("WO"): {
+        RegisterObjectInMap(objects, WOOD, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
         break;
     }
 
     // Bloco com neve
-    case string2int("SB"): {
-        RegisterObjectInMap(SNOWBLOCK, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
+    case TileCode("SB"): {
+        RegisterObjectInMap(objects, SNOWBLOCK, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
         break;
     }
 
     // Rocha negra
-    case string2int("BR"): {
-        RegisterObjectInMap(DARKROCK, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
+    case TileCode("BR"): {
+        RegisterObjectInMap(objects, DARKROCK, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
         break;
     }
 
     // Cristal
-    case string2int("CR"): {
-        RegisterObjectInMap(CRYSTAL, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
+    case TileCode("CR"): {
+        RegisterObjectInMap(objects, CRYSTAL, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
         break;
     }
 
     // Água
-    case string2int("WA"):{
-        RegisterObjectInMap(WATER, vec4(x, floor_shift, z, 1.0f), cube_size, "plane", planemodel_size);
+    case TileCode("WA"):{
+        RegisterObjectInMap(objects, WATER, vec4(x, floor_shift, z, 1.0f), cube_size, "plane", planemodel_size);
         break;
     }
 
     // Fogo:
-    case string2int("FI"):{
-        RegisterObjectInMap(FIRE, vec4(x, floor_shift, z, 1.0f), cube_size, "fire", cube_size);
-        RegisterFloor(x, z, theme);
+    case TileCode("FI"):{
+        RegisterObjectInMap(objects, FIRE, vec4(x, floor_shift, z, 1.0f), cube_size, "fire", cube_size);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
     // Terra
-    case string2int("DI"):{
-        RegisterObjectInMap(DIRT, vec4(x, floor_shift, z, 1.0f), tile_size, "plane", planemodel_size);
+    case TileCode("DI"):{
+        RegisterObjectInMap(objects, DIRT, vec4(x, floor_shift, z, 1.0f), tile_size, "plane", planemodel_size);
         break;
     }
 
     // Bloco de terra
-    case string2int("BD"):{
-        RegisterObjectInMap(DIRTBLOCK, vec4(x, dirtblock_vertical_shift, z, 1.0f), dirtblock_size, "cube", dirtblock_size);
-        RegisterFloor(x, z, theme);
+    case TileCode("BD"):{
+        RegisterObjectInMap(objects, DIRTBLOCK, vec4(x, dirtblock_vertical_shift, z, 1.0f), dirtblock_size, "cube", dirtblock_size);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
     // Chave vermelha
-    case string2int("kr"):{
-    	RegisterObjectInMap(KEY_RED, vec4(x, key_vertical_shift, z, 1.0f), key_size, "key", keymodel_size);
-    	RegisterFloor(x, z, theme);
+    case TileCode("kr"):{
+    	RegisterObjectInMap(objects, KEY_RED, vec4(x, key_vertical_shift, z, 1.0f), key_size, "key", keymodel_size);
+    	RegisterFloor(objects, x, z, theme);
     	break;
     }
 
     // Chave verde
-    case string2int("kg"):{
-    	RegisterObjectInMap(KEY_GREEN, vec4(x, key_vertical_shift, z, 1.0f), key_size, "key", keymodel_size);
-    	RegisterFloor(x, z, theme);
+    case TileCode("kg"):{
+    	RegisterObjectInMap(objects, KEY_GREEN, vec4(x, key_vertical_shift, z, 1.0f), key_size, "key", keymodel_size);
+    	RegisterFloor(objects, x, z, theme);
     	break;
     }
 
 	// Chave azul
-    case string2int("kb"):{
-    	RegisterObjectInMap(KEY_BLUE, vec4(x, key_vertical_shift, z, 1.0f), key_size, "key", keymodel_size);
-    	RegisterFloor(x, z, theme);
+    case TileCode("kb"):{
+    	RegisterObjectInMap(objects, KEY_BLUE, vec4(x, key_vertical_shift, z, 1.0f), key_size, "key", keymodel_size);
+    	RegisterFloor(objects, x, z, theme);
     	break;
     }
 
 	// Chave amarela
-    case string2int("ky"):{
-    	RegisterObjectInMap(KEY_YELLOW, vec4(x, key_vertical_shift, z, 1.0f), key_size, "key", keymodel_size);
-    	RegisterFloor(x, z, theme);
+    case TileCode("ky"):{
+    	RegisterObjectInMap(objects, KEY_YELLOW, vec4(x, key_vertical_shift, z, 1.0f), key_size, "key", keymodel_size);
+    	RegisterFloor(objects, x, z, theme);
     	break;
     }
 
     // Porta vermelha:
-    case string2int("DR"):{
-        RegisterObjectInMap(DOOR_RED, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
-        RegisterFloor(x, z, theme);
+    case TileCode("DR"):{
+        RegisterObjectInMap(objects, DOOR_RED, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
     // Porta verde:
-    case string2int("DG"):{
-        RegisterObjectInMap(DOOR_GREEN, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
-        RegisterFloor(x, z, theme);
+    case TileCode("DG"):{
+        RegisterObjectInMap(objects, DOOR_GREEN, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
     // Porta azul:
-    case string2int("DB"):{
-        RegisterObjectInMap(DOOR_BLUE, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
-        RegisterFloor(x, z, theme);
+    case TileCode("DB"):{
+        RegisterObjectInMap(objects, DOOR_BLUE, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
     // Porta amarela:
-    case string2int("DY"):{
-        RegisterObjectInMap(DOOR_YELLOW, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
-        RegisterFloor(x, z, theme);
+    case TileCode("DY"):{
+        RegisterObjectInMap(objects, DOOR_YELLOW, vec4(x, cube_vertical_shift, z, 1.0f), cube_size, "cube", cube_size);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
     // Vaquinha bebê:
-    case string2int("co"):{
-        RegisterObjectInMap(BABYCOW, vec4(x, babycow_vertical_shift, z, 1.0f), babycow_size, "cow", babycow_size);
-        RegisterFloor(x, z, theme);
+    case TileCode("co"):{
+        RegisterObjectInMap(objects, BABYCOW, vec4(x, babycow_vertical_shift, z, 1.0f), babycow_size, "cow", babycow_size);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
     // Vaca mãe:
-    case string2int("CW"):{
-        RegisterObjectInMap(COW, vec4(x, cow_vertical_shift, z, 1.0f), cow_size, "cow", cow_size, 1);
-        RegisterFloor(x, z, theme);
+    case TileCode("CW"):{
+        RegisterObjectInMap(objects, COW, vec4(x, cow_vertical_shift, z, 1.0f), cow_size, "cow", cow_size);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
-    case string2int("J0"):{
-        RegisterObjectInMap(JET, vec4(x, jet_vertical_shift, z, 1.0f), jet_size, "jet", jetmodel_size);
-        RegisterFloor(x, z, theme);
+    case TileCode("J0"):{
+        RegisterObjectInMap(objects, JET, vec4(x, jet_vertical_shift, z, 1.0f), jet_size, "jet", jetmodel_size);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
-    case string2int("J1"):{
-        RegisterObjectInMap(JET, vec4(x, jet_vertical_shift, z, 1.0f), jet_size, "jet", jetmodel_size, 1);
-        RegisterFloor(x, z, theme);
+    case TileCode("J1"):{
+        RegisterObjectInMap(objects, JET, vec4(x, jet_vertical_shift, z, 1.0f), jet_size, "jet", jetmodel_size, 1);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
-    case string2int("J2"):{
-        RegisterObjectInMap(JET, vec4(x, jet_vertical_shift, z, 1.0f), jet_size, "jet", jetmodel_size, 2);
-        RegisterFloor(x, z, theme);
+    case TileCode("J2"):{
+        RegisterObjectInMap(objects, JET, vec4(x, jet_vertical_shift, z, 1.0f), jet_size, "jet", jetmodel_size, 2);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
-    case string2int("J3"):{
-        RegisterObjectInMap(JET, vec4(x, jet_vertical_shift, z, 1.0f), jet_size, "jet", jetmodel_size, 3);
-        RegisterFloor(x, z, theme);
+    case TileCode("J3"):{
+        RegisterObjectInMap(objects, JET, vec4(x, jet_vertical_shift, z, 1.0f), jet_size, "jet", jetmodel_size, 3);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
-    case string2int("B0"):{
-        RegisterObjectInMap(BEACHBALL, vec4(x, sphere_vertical_shift, z, 1.0f), ball_size, "sphere", sphere_size);
-        RegisterFloor(x, z, theme);
+    case TileCode("B0"):{
+        RegisterObjectInMap(objects, BEACHBALL, vec4(x, sphere_vertical_shift, z, 1.0f), ball_size, "sphere", sphere_size);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
-    case string2int("B1"):{
-        RegisterObjectInMap(BEACHBALL, vec4(x, sphere_vertical_shift, z, 1.0f), ball_size, "sphere", sphere_size, 1);
-        RegisterFloor(x, z, theme);
+    case TileCode("B1"):{
+        RegisterObjectInMap(objects, BEACHBALL, vec4(x, sphere_vertical_shift, z, 1.0f), ball_size, "sphere", sphere_size, 1);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
-    case string2int("B2"):{
-        RegisterObjectInMap(BEACHBALL, vec4(x, sphere_vertical_shift, z, 1.0f), ball_size, "sphere", sphere_size, 2);
-        RegisterFloor(x, z, theme);
+    case TileCode("B2"):{
+        RegisterObjectInMap(objects, BEACHBALL, vec4(x, sphere_vertical_shift, z, 1.0f), ball_size, "sphere", sphere_size, 2);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
-    case string2int("B3"):{
-        RegisterObjectInMap(BEACHBALL, vec4(x, sphere_vertical_shift, z, 1.0f), ball_size, "sphere", sphere_size, 3);
-        RegisterFloor(x, z, theme);
+    case TileCode("B3"):{
+        RegisterObjectInMap(objects, BEACHBALL, vec4(x, sphere_vertical_shift, z, 1.0f), ball_size, "sphere", sphere_size, 3);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
-    case string2int("V0"):{
-        RegisterObjectInMap(VOLLEYBALL, vec4(x, sphere_vertical_shift, z, 1.0f), ball_size, "sphere", sphere_size);
-        RegisterFloor(x, z, theme);
+    case TileCode("V0"):{
+        RegisterObjectInMap(objects, VOLLEYBALL, vec4(x, sphere_vertical_shift, z, 1.0f), ball_size, "sphere", sphere_size);
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
     // Jogador e piso
-    case string2int("PS"):
-    case string2int("FF"):
-    case string2int("GR"):
-    case string2int("SN"):
-    case string2int("DD"):{
-        RegisterFloor(x, z, theme);
+    case TileCode("PS"):
+    case TileCode("FF"):
+    case TileCode("GR"):
+    case TileCode("SN"):
+    case TileCode("DD"):{
+        RegisterFloor(objects, x, z, theme);
         break;
     }
 
@@ -1375,255 +2374,867 @@ void RegisterObjectInMapVector(string tile_type, float x, float z, int theme) {
     }
 }
 
-// Função que adiciona um objeto ao mapa
-void RegisterObjectInMap(int obj_id, vec4 obj_position, vec3 obj_size, const char * obj_file_name, vec3 model_size, int direction, float gravity) {
+// Defasagem do giro de um item, derivada da sua posição no chão: itens
+// vizinhos não giram em sincronia, e um objeto restaurado por
+// RestoreMapObject() mantém a fase que tinha
+float GetAnimPhase(vec3 position) {
+    uint32_t hash = (uint32_t)(int)floor(position.x) * 73856093u ^ (uint32_t)(int)floor(position.z) * 19349663u;
+    hash ^= hash >> 15;
+    hash *= 2246822519u;
+    hash ^= hash >> 13;
+    return (hash % 1024) * (2*PI / 1024);
+}
+
+// Função que adiciona um objeto ao mapa (em "objects")
+void RegisterObjectInMap(MapObjectList* objects, int obj_id, vec4 obj_position, vec3 obj_size, const char * obj_file_name, vec3 model_size, int direction, float gravity) {
     MapObject new_object;
-    new_object.object_type = obj_id;
+    SetMapObjectType(&new_object, obj_id);
     new_object.object_size = obj_size;
-    new_object.object_position = obj_position;
-    new_object.obj_file_name = obj_file_name;
-    new_object.model_size = model_size;
+    new_object.object_position = vec3(obj_position);
     new_object.direction = direction;
+    new_object.reserved = 0;
     new_object.gravity = gravity;
-    map_objects.push_back(new_object);
+
+    MapObjectDetail detail;
+    detail.obj_file_name = obj_file_name;
+    detail.model_size = model_size;
+    detail.tile = -1;
+    detail.anim_type = GetObjectAnimation(obj_id);
+    detail.anim_phase = GetAnimPhase(new_object.object_position);
+    objects->push_back(new_object, detail);
 }
 
-// Função que encontra as coordenadas do spawn do jogador na planta do mapa
-vec4 GetPlayerSpawnCoordinates(std::vector<std::vector<string>> plant) {
-    int map_height = plant.size();
-    int map_width = plant[0].size();
-    float center_x = (map_width-1)/2.0f;
-    float center_z = (map_height-1)/2.0f;
-
-    for(int line = 0; line < map_height; line++) {
-        for(int col = 0; col < map_width; col++) {
-            if(plant[line][col] == "PS") {
-                float x = -(center_x - col);
-                float z = -(center_z - line);
+// Animação procedural de cada tipo de objeto
+int GetObjectAnimation(int obj_id) {
+    if (isIn(obj_id, {KEY_RED, KEY_GREEN, KEY_BLUE, KEY_YELLOW}))
+        return ANIM_SPIN_KEY;
+    if (obj_id == BABYCOW)
+        return ANIM_SPIN_COW;
+    if (obj_id == COW)
+        return ANIM_SPIN_BOB_COW;
+    return ANIM_NONE;
+}
 
-                return vec4(x, -0.5f, z, 1.0f);
-            }
-        }
-    }
+// Muda o tipo de um objeto, junto com as flags dadas pelo tipo
+void SetMapObjectType(MapObject* object, int obj_id) {
+    assert(obj_id > 0 && obj_id < OBJECT_TYPE_LIMIT);
+    object->object_type = obj_id;
+    object->flags = OBJECT_TRAITS[obj_id].flags;
+}
 
-    // Caso o spawn não seja encontrado, spawna o player no centro por padrão
-    return vec4(0.5f, 0.0f, 0.5f, 1.0f);
+// Divide o nível em jogo (g_ActiveLevel) em chunks, ainda não carregados.
+// Os primeiros são carregados por UpdateLevelChunks().
+void StartLevelChunks() {
+    g_LevelChunkColumns = (g_ActiveLevel.width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    g_LevelChunkRows = (g_ActiveLevel.height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    g_LevelChunks.clear();
+    g_LevelChunks.resize(g_LevelChunkColumns * g_LevelChunkRows);
+    for (size_t i = 0; i < g_LevelChunks.size(); i++) {
+        g_LevelChunks[i].loaded = false;
+        g_LevelChunks[i].saved = false;
+        g_LevelChunks[i].enemies = 0;
+    }
+    g_LevelChunkCenter = -1;
+    g_EnemyFrame = 0;
 }
 
-// Faz a vaca ficar levemente flutuando
-void BobCow() {
-    int index = GetCowMotherPosition();
+// Mantém carregados apenas os chunks a até CHUNK_LOAD_RADIUS chunks do chunk
+// da posição dada. Só faz algo quando a posição muda de chunk. Os objetos
+// dos chunks descarregados (pela sua posição atual, já que inimigos e blocos
+// se movem) são guardados em forma compacta no estado do chunk.
+void UpdateLevelChunks(vec4 position) {
+    int center = GetChunkIndex(vec3(position));
+    if (center == g_LevelChunkCenter)
+        return;
+    g_LevelChunkCenter = center;
 
-    // Queda
-    if (map_objects[index].direction == 0) {
-        if (map_objects[index].object_position.y > -0.5f)
-            map_objects[index].object_position.y -= 0.0025;
-        else map_objects[index].direction = 1;
-    } else {
-        // Elevação
-        if (map_objects[index].object_position.y < -0.2f)
-            map_objects[index].object_position.y += 0.0025;
-        else map_objects[index].direction = 0;
+    for (size_t i = 0; i < g_LevelChunks.size(); i++) {
+        if (g_LevelChunks[i].loaded && !IsChunkInRadius(i, center, CHUNK_LOAD_RADIUS)) {
+            g_LevelChunks[i].loaded = false;
+            g_LevelChunks[i].saved = true;
+            g_LevelChunks[i].enemies = 0;
+        }
     }
-}
 
-/////////////
-// DESENHO //
-/////////////
+    size_t kept = 0;
+    for (size_t i = 0; i < map_objects.size(); i++) {
+        LevelChunk& chunk = g_LevelChunks[GetChunkIndex(map_objects[i].object_position)];
+        if (chunk.loaded)
+            map_objects.move(i, kept++);
+        else
+            chunk.objects.push_back(SaveMapObject(map_objects[i], map_objects.details[i]));
+    }
+    map_objects.resize(kept);
 
-// Função que desenha os objetos na cena (com base no vetor de objetos)
-void DrawMapObjects() {
-    for(unsigned int i = 0; i < map_objects.size(); i++) {
-        MapObject current_object = map_objects[i];
-        int obj_type = current_object.object_type;
-        glm::mat4 model = Matrix_Translate(current_object.object_position.x, current_object.object_position.y, current_object.object_position.z)
-                        * Matrix_Scale(current_object.model_size.x, current_object.model_size.y, current_object.model_size.z);
-
-        // Aplica rotações dependendo do objeto (animações, inimigos, etc)
-        if (isIn(obj_type, {KEY_RED, KEY_GREEN, KEY_BLUE, KEY_YELLOW})) {
-        	model = model * Matrix_Translate(0.0f, 5.7f, 0.0f)
-        		* Matrix_Rotate_Y(g_ItemAngleY)
-        		* Matrix_Rotate_Z(PI/5)
-        		* Matrix_Translate(0.0f, -5.7f, 0.0f);
-        } else if (obj_type == BABYCOW) {
-    		model = model * Matrix_Translate(-0.2f, 0.0f, 0.0f)
-        		* Matrix_Rotate_Y(g_ItemAngleY)
-        		* Matrix_Translate(0.2f, 0.0f, 0.0f);
-        } else if (obj_type == COW) {
-            model = model * Matrix_Translate(-0.2f, 0.0f, 0.0f)
-                * Matrix_Rotate_Y(g_CowAngleY)
-                * Matrix_Translate(0.2f, 0.0f, 0.0f);
-        } else if (obj_type == FIRE) {
-        	GenerateParticles(5, current_object.object_position, current_object.model_size);
-        	DrawParticles();
-        } else if (obj_type == JET) {
-        	model = model * Matrix_Translate(-0.2f, 0.0f, 0.0f)
-        		* Matrix_Rotate_Y(current_object.direction * PI/2)
-        		* Matrix_Translate(0.2f, 0.0f, 0.0f);
-   		}
+    for (size_t i = 0; i < g_LevelChunks.size(); i++)
+        if (!g_LevelChunks[i].loaded && IsChunkInRadius(i, center, CHUNK_LOAD_RADIUS))
+            LoadLevelChunk(i);
+}
 
-        DrawVirtualObject(current_object.obj_file_name, current_object.object_type, model);
+// Coloca os objetos de um chunk em map_objects: os da planta do nível, caso
+// ele nunca tenha sido descarregado, e os guardados no seu estado
+void LoadLevelChunk(int chunk) {
+    LevelChunk& loading = g_LevelChunks[chunk];
+    size_t first_object = map_objects.size();
+    if (!loading.saved) {
+        int first_line = (chunk / g_LevelChunkColumns) * CHUNK_SIZE;
+        int first_col = (chunk % g_LevelChunkColumns) * CHUNK_SIZE;
+        RegisterLevelObjects(&map_objects, g_ActiveLevel, first_line, first_col,
+                                           std::min(first_line + CHUNK_SIZE, g_ActiveLevel.height),
+                                           std::min(first_col + CHUNK_SIZE, g_ActiveLevel.width));
     }
+
+    for (size_t i = 0; i < loading.objects.size(); i++)
+        RestoreMapObject(&map_objects, loading.objects[i]);
+    std::vector<SavedMapObject>().swap(loading.objects);
+    loading.loaded = true;
+
+    loading.enemies = 0;
+    for (size_t i = first_object; i < map_objects.size(); i++)
+        if (map_objects[i].flags & OBJECT_ENEMY)
+            loading.enemies++;
 }
 
-// Função que desenha o jogador usando transformações hierárquicas
-// Desenha na posição dada, com escala dada e ângulo de rotação dado
-void DrawPlayer(vec4 position, float angle_y, float angle_x, float scale) {
-    float x = position.x;
-    float y = position.y + 0.2f; // Shift vertical do player
-    float z = position.z;
-    glm::mat4 model = Matrix_Identity();
-
-    model = Matrix_Translate(x, y, z) * Matrix_Rotate_Y(angle_y);
-    model = model * Matrix_Translate(0.0f, -0.6f, 0.0f) * Matrix_Rotate_X(angle_x) * Matrix_Translate(0.0f, 0.6f, 0.0f);
-    PushMatrix(model);
-        model = model * Matrix_Scale(0.8f * scale, 1.1f * scale, 0.2f * scale);
-        DrawVirtualObject("cube", PLAYER_TORSO, model);
-    PopMatrix(model);
-    PushMatrix(model);
-        model = model * Matrix_Translate(-0.55f * scale, 0.05f * scale, 0.0f * scale); // Translação do braço direito
-        PushMatrix(model);
-            model = model * Matrix_Scale(0.2f * scale, 0.7f * scale, 0.2f * scale); // Escalamento do braço direito
-            DrawVirtualObject("cube", PLAYER_ARM, model);
-        PopMatrix(model);
-        PushMatrix(model);
-            model = model * Matrix_Translate(0.0f * scale, -0.75f * scale, 0.0f * scale); // Translação do antebraço direito
-            PushMatrix(model);
-                model = model * Matrix_Scale(0.2f * scale, 0.7f * scale, 0.2f * scale); // Escalamento do antebraço direito
-                DrawVirtualObject("cube", PLAYER_ARM, model);
-            PopMatrix(model);
-            PushMatrix(model);
-                model = model * Matrix_Translate(0.0f * scale, -0.45f * scale, 0.0f * scale); // Translação da mão direita
-                model = model * Matrix_Scale(0.2f * scale, 0.1f * scale, 0.2f * scale);
-                DrawVirtualObject("cube", PLAYER_HAND, model);
-            PopMatrix(model);
-        PopMatrix(model);
-    PopMatrix(model);
-    PushMatrix(model);
-        model = model * Matrix_Translate(0.55f * scale, 0.05f * scale, 0.0f * scale); // Translação para o braço esquerdo
-        PushMatrix(model);
-            model = model * Matrix_Scale(0.2f * scale, 0.7f * scale, 0.2f * scale); // Escalamento do braço esquerdo
-            DrawVirtualObject("cube", PLAYER_ARM, model);
-        PopMatrix(model);
-        PushMatrix(model);
-            model = model * Matrix_Translate(0.0f * scale, -0.75f * scale, 0.0f * scale); // Translação do antebraço esquerdo
-            PushMatrix(model);
-                model = model * Matrix_Scale(0.2f * scale, 0.7f * scale, 0.2f * scale); // Escalamento do antebraço esquerdo
-                DrawVirtualObject("cube", PLAYER_ARM, model);
-            PopMatrix(model);
-            PushMatrix(model);
-                model = model * Matrix_Translate(0.0f * scale, -0.45f * scale, 0.0f * scale); // Translação da mão esquerda
-                model = model * Matrix_Scale(0.2f * scale, 0.1f * scale, 0.2f * scale);
-                DrawVirtualObject("cube", PLAYER_HAND, model);
-            PopMatrix(model);
-        PopMatrix(model);
-    PopMatrix(model);
-    PushMatrix(model);
-        model = model * Matrix_Translate(-0.2f * scale, -1.0f * scale, 0.0f * scale); // Translação para a perna direita
-        PushMatrix(model);
-            model = model * Matrix_Scale(0.3f * scale, 0.8f * scale, 0.3f * scale); // Escalamento da coxa direita
-            DrawVirtualObject("cube", PLAYER_LEG, model);
-        PopMatrix(model);
-        PushMatrix(model);
-            model = model * Matrix_Translate(0.0f * scale, -0.85f * scale, 0.0f * scale); // Translação para a canela direita
-            PushMatrix(model);
-                model = model * Matrix_Scale(0.25f * scale, 0.8f * scale, 0.25f * scale); // Escalamento da canela direita
-                DrawVirtualObject("cube", PLAYER_LEG, model);
-            PopMatrix(model);
-            PushMatrix(model);
-                model = model * Matrix_Translate(0.0f * scale, -0.5f * scale, 0.1f * scale); // Translação para o pé direito
-                model = model * Matrix_Scale(0.2f * scale, 0.1f * scale, 0.4f * scale); // Escalamento do pé direito
-                DrawVirtualObject("cube", PLAYER_FOOT, model);
-            PopMatrix(model);
-        PopMatrix(model);
-    PopMatrix(model);
-    PushMatrix(model);
-        model = model * Matrix_Translate(0.2f * scale, -1.0f * scale, 0.0f * scale); // Translação para a perna esquerda
-        PushMatrix(model);
-            model = model * Matrix_Scale(0.3f * scale, 0.8f * scale, 0.3f * scale); // Escalamento da coxa esquerda
-            DrawVirtualObject("cube", PLAYER_LEG, model);
-        PopMatrix(model);
-        PushMatrix(model);
-            model = model * Matrix_Translate(0.0f * scale, -0.85f * scale, 0.0f * scale); // Translação para a canela esquerda
-            PushMatrix(model);
-                model = model * Matrix_Scale(0.25f * scale, 0.8f * scale, 0.25f * scale); // Escalamento da canela esquerda
-                DrawVirtualObject("cube", PLAYER_LEG, model);
-            PopMatrix(model);
-            PushMatrix(model);
-                model = model * Matrix_Translate(0.0f * scale, -0.5f * scale, 0.1f * scale); // Translação para o pé esquerdo
-                model = model * Matrix_Scale(0.2f * scale, 0.1f * scale, 0.4f * scale); // Escalamento do pé esquerdo
-                DrawVirtualObject("cube", PLAYER_FOOT, model);
-            PopMatrix(model);
-        PopMatrix(model);
-    PopMatrix(model);
-    model = model * Matrix_Rotate_Z(3.14);
-    model = model * Matrix_Translate(0.0f * scale, -0.75f * scale, 0.0f * scale); // Translação para a cabeça
-    model = model * Matrix_Scale(0.35f * scale, 0.35f * scale, 0.35f * scale); // Escalamento da cabeça
-    DrawVirtualObject("cube", PLAYER_HEAD, model);
+// Chunk (linha * g_LevelChunkColumns + coluna) que contém uma posição do
+// mapa. Posições fora do mapa ficam no chunk mais próximo.
+int GetChunkIndex(vec3 position) {
+    int col = (int)floor(position.x + (g_ActiveLevel.width - 1) / 2.0f + 0.5f);
+    int line = (int)floor(position.z + (g_ActiveLevel.height - 1) / 2.0f + 0.5f);
+    col = std::max(0, std::min(col, g_ActiveLevel.width - 1));
+    line = std::max(0, std::min(line, g_ActiveLevel.height - 1));
+    return (line / CHUNK_SIZE) * g_LevelChunkColumns + col / CHUNK_SIZE;
 }
 
-// Função que desenha um objeto armazenado em g_VirtualScene. Veja definição
-// dos objetos na função BuildTrianglesAndAddToVirtualScene().
-void DrawVirtualObject(const char* object_name, int object_id, glm::mat4 model) {
-    glUniformMatrix4fv(model_uniform, 1 , GL_FALSE , glm::value_ptr(model));
-    glUniform1i(object_id_uniform, object_id);
+// Testa se um chunk está a até "radius" chunks (em linhas e em colunas) de outro
+bool IsChunkInRadius(int chunk, int center, int radius) {
+    return abs(chunk / g_LevelChunkColumns - center / g_LevelChunkColumns) <= radius
+        && abs(chunk % g_LevelChunkColumns - center % g_LevelChunkColumns) <= radius;
+}
 
-    // "Ligamos" o VAO.
-    glBindVertexArray(g_VirtualScene[object_name].vertex_array_object_id);
+// Número de quadros que os inimigos de um chunk andam no quadro "frame" da
+// simulação: 1 perto do jogador, ENEMY_COARSE_INTERVAL a cada
+// ENEMY_COARSE_INTERVAL quadros um pouco mais longe (cada chunk em um quadro
+// diferente, para distribuir o custo) e 0 nos chunks distantes ou sem
+// inimigos, que dormem.
+int GetChunkSimulationSteps(int chunk, int frame) {
+    if (g_LevelChunks[chunk].enemies == 0 || !IsChunkInRadius(chunk, g_LevelChunkCenter, CHUNK_COARSE_RADIUS))
+        return 0;
+    if (IsChunkInRadius(chunk, g_LevelChunkCenter, CHUNK_SIMULATION_RADIUS))
+        return 1;
+    return (frame + chunk) % ENEMY_COARSE_INTERVAL == 0 ? ENEMY_COARSE_INTERVAL : 0;
+}
 
-    vec3 bbox_min = g_VirtualScene[object_name].bbox_min;
-    vec3 bbox_max = g_VirtualScene[object_name].bbox_max;
-    glUniform4f(bbox_min_uniform, bbox_min.x, bbox_min.y, bbox_min.z, 1.0f);
-    glUniform4f(bbox_max_uniform, bbox_max.x, bbox_max.y, bbox_max.z, 1.0f);
+// Usa como carregados os chunks a até CHUNK_LOAD_RADIUS do chunk da posição
+// dada, com os objetos já registrados para eles em "objects" (veja
+// PreloadLevel()), como se UpdateLevelChunks() os tivesse carregado
+void AdoptLevelChunks(MapObjectList* objects, vec4 position) {
+    int center = GetChunkIndex(vec3(position));
+    for (size_t i = 0; i < g_LevelChunks.size(); i++)
+        if (IsChunkInRadius(i, center, CHUNK_LOAD_RADIUS))
+            g_LevelChunks[i].loaded = true;
+
+    map_objects.swap(*objects);
+    g_LevelChunkCenter = center;
+    CountChunkEnemies();
+}
 
-    // Pedimos para a GPU rasterizar os vértices dos eixos XYZ
-    // apontados pelo VAO como linhas.
-    glDrawElements(
-        g_VirtualScene[object_name].rendering_mode,
-        g_VirtualScene[object_name].num_indices,
+// Recalcula o número de inimigos dos chunks carregados
+void CountChunkEnemies() {
+    for (size_t i = 0; i < g_LevelChunks.size(); i++)
+        g_LevelChunks[i].enemies = 0;
+    for (size_t i = 0; i < map_objects.size(); i++)
+        if (map_objects[i].flags & OBJECT_ENEMY)
+            g_LevelChunks[GetChunkIndex(map_objects[i].object_position)].enemies++;
+}
+
+// Lê de novo o arquivo do nível em jogo (do disco, e não do pacote de
+// recursos, para pegar as edições) e aplica as mudanças. Erros no arquivo só
+// são mostrados: o jogo continua com a versão anterior.
+void ReloadLevel(const string& filepath) {
+    Level level;
+    try {
+        level = LoadLevelFromFile(filepath, false);
+    } catch (std::exception& e) {
+        fprintf(stderr, "\nERROR: %s\n", e.what());
+        return;
+    }
+
+    // ApplyLevelChanges() carrega recursos na thread principal, o que não
+    // pode ocorrer ao mesmo tempo que a preparação do próximo nível (que lê
+    // os mesmos mapas e escolheu o que enviar à GPU sem os recursos novos).
+    // A preparação é descartada e recomeça no próximo quadro, caso a
+    // mensagem de fim de nível ainda esteja sendo mostrada.
+    Level unused_level;
+    MapObjectList unused_samples, unused_objects;
+    TakeLevelPreload(0, &unused_level, &unused_samples, &unused_objects);
+
+    ApplyLevelChanges(&level);
+}
+
+// Troca a planta do nível em jogo por uma nova versão, registrando de novo só
+// os objetos dos tiles que mudaram (em map_objects e nos chunks
+// descarregados). Os demais objetos mantêm o seu estado, assim como o
+// inventário, a posição do jogador e o tempo restante. Mudanças de tamanho ou
+// de tema registram o nível inteiro de novo.
+void ApplyLevelChanges(Level* level) {
+    std::vector<bool> changed;
+    FindChangedTiles(g_ActiveLevel, *level, &changed);
+    bool rebuild = level->width != g_ActiveLevel.width || level->height != g_ActiveLevel.height || level->theme != g_ActiveLevel.theme;
+    level->time = g_ActiveLevel.time;
+    g_ActiveLevel = std::move(*level);
+    g_LevelCowAmount = g_ActiveLevel.cow_no;
+
+    MapObjectList samples;
+    RegisterTileSamples(&samples, g_ActiveLevel);
+    PrepareLevelAssets(samples, g_ActiveLevel.theme);
+
+    int num_changed = std::count(changed.begin(), changed.end(), true);
+    if (rebuild) {
+        map_objects.clear();
+        StartLevelChunks();
+    } else if (num_changed > 0) {
+        // Objetos originados nos tiles alterados, onde quer que estejam agora
+        size_t kept = 0;
+        for (size_t i = 0; i < map_objects.size(); i++)
+            if (map_objects.details[i].tile < 0 || !changed[map_objects.details[i].tile])
+                map_objects.move(i, kept++);
+        map_objects.resize(kept);
+        for (size_t c = 0; c < g_LevelChunks.size(); c++) {
+            std::vector<SavedMapObject>& objects = g_LevelChunks[c].objects;
+            kept = 0;
+            for (size_t i = 0; i < objects.size(); i++)
+                if (objects[i].tile < 0 || !changed[objects[i].tile])
+                    objects[kept++] = objects[i];
+            objects.resize(kept);
+        }
+
+        // Novos objetos dos tiles alterados. Os chunks nunca carregados serão
+        // registrados a partir da nova planta.
+        MapObjectList registered;
+        for (int line = 0; line < g_ActiveLevel.height; line++) {
+            for (int col = 0; col < g_ActiveLevel.width; col++) {
+                if (!changed[(size_t)line * g_ActiveLevel.width + col])
+                    continue;
+                LevelChunk& chunk = g_LevelChunks[(line / CHUNK_SIZE) * g_LevelChunkColumns + col / CHUNK_SIZE];
+                if (chunk.loaded) {
+                    RegisterLevelObjects(&map_objects, g_ActiveLevel, line, col, line + 1, col + 1);
+                } else if (chunk.saved) {
+                    registered.clear();
+                    RegisterLevelObjects(&registered, g_ActiveLevel, line, col, line + 1, col + 1);
+                    for (size_t i = 0; i < registered.size(); i++)
+                        chunk.objects.push_back(SaveMapObject(registered[i], registered.details[i]));
+                }
+            }
+        }
+        CountChunkEnemies();
+    }
+
+    // O jogador volta ao início caso tenha ficado fora do mapa ou dentro de
+    // um objeto. HasPlayerBlockingObject() não serve aqui: ela empurra
+    // blocos, abre portas e termina o nível ao tocar a vaca.
+    UpdateLevelChunks(player_position);
+    float half_width = g_ActiveLevel.width / 2.0f, half_height = g_ActiveLevel.height / 2.0f;
+    CollisionQuery collided_objects;
+    GetObjectsCollidingWithPlayer(player_position, &collided_objects);
+    uint64_t solid_types = ((uint64_t)1 << DOOR_RED) | ((uint64_t)1 << DOOR_GREEN) | ((uint64_t)1 << DOOR_BLUE) |
+                           ((uint64_t)1 << DOOR_YELLOW) | ((uint64_t)1 << COW) | ((uint64_t)1 << DIRTBLOCK);
+    if (fabs(player_position.x) > half_width || fabs(player_position.z) > half_height ||
+        (collided_objects.flags & OBJECT_BLOCKS_PLAYER) || (collided_objects.types & solid_types)) {
+        player_position = GetPlayerSpawnCoordinates(g_ActiveLevel);
+        UpdateLevelChunks(player_position);
+    }
+
+    printf("Nível recarregado (%s).\n", rebuild ? "completo" : (std::to_string(num_changed) + " tiles alterados").c_str());
+}
+
+// Marca os tiles que mudaram de uma versão da planta de um nível para outra:
+// o código do tile ou o estado inicial do inimigo (níveis binários). Com
+// tamanhos diferentes, todos os tiles da nova versão contam como alterados.
+void FindChangedTiles(const Level& old_level, const Level& new_level, std::vector<bool>* changed) {
+    if (old_level.width != new_level.width || old_level.height != new_level.height) {
+        changed->assign(new_level.tiles.size(), true);
+        return;
+    }
+
+    changed->assign(new_level.tiles.size(), false);
+    for (size_t i = 0; i < new_level.tiles.size(); i++)
+        (*changed)[i] = old_level.tiles[i] != new_level.tiles[i];
+
+    // As entidades estão ordenadas pelo tile nas duas versões
+    std::vector<LevelEntity>::const_iterator old_entity = old_level.entities.begin();
+    std::vector<LevelEntity>::const_iterator new_entity = new_level.entities.begin();
+    while (old_entity != old_level.entities.end() || new_entity != new_level.entities.end()) {
+        if (new_entity == new_level.entities.end() || (old_entity != old_level.entities.end() && old_entity->tile < new_entity->tile)) {
+            (*changed)[old_entity->tile] = true;
+            ++old_entity;
+        } else if (old_entity == old_level.entities.end() || new_entity->tile < old_entity->tile) {
+            (*changed)[new_entity->tile] = true;
+            ++new_entity;
+        } else {
+            if (old_entity->direction != new_entity->direction || old_entity->gravity != new_entity->gravity)
+                (*changed)[new_entity->tile] = true;
+            ++old_entity;
+            ++new_entity;
+        }
+    }
+}
+
+// Começa a preparar um nível em uma thread auxiliar (veja PreloadLevel()),
+// caso ele ainda não esteja sendo preparado. Se a música do nível precisa ser
+// aberta é decidido aqui, na thread principal, que é a única a ler e alterar
+// g_MusicOn e g_OpenedMusic.
+void StartLevelPreload(int level_number) {
+    LevelPreload& preload = g_LevelPreload;
+    if (preload.level_number == level_number)
+        return;
+
+    Level unused_level;
+    MapObjectList unused_samples, unused_objects;
+    TakeLevelPreload(0, &unused_level, &unused_samples, &unused_objects);
+
+    const char* music_path;
+    sf::Music* music = GetLevelMusic(level_number, &music_path);
+    if (g_MusicOn && music != NULL && g_OpenedMusic.count(music) == 0) {
+        preload.music = music;
+        preload.music_path = music_path;
+    }
+
+    preload.level_number = level_number;
+    preload.done = false;
+    preload.worker = std::thread(PreloadLevel, &preload);
+}
+
+// Roda na thread auxiliar: lê a planta do nível, registra os objetos dos
+// chunks ao redor do ponto de partida (os que UpdateLevelChunks() carregaria
+// primeiro), lê e decodifica os recursos que ainda não estão na GPU e abre a
+// música do nível, caso StartLevelPreload() tenha pedido. Só lê o estado do
+// jogo; os envios para a GPU ficam para UpdateLevelPreload(), na thread do
+// OpenGL.
+void PreloadLevel(LevelPreload* preload) {
+    try {
+        string levelpath = "../../data/levels/" + std::to_string(preload->level_number);
+        preload->level = LoadLevelFromFile(levelpath);
+        const Level& level = preload->level;
+        RegisterTileSamples(&preload->samples, level);
+
+        // Chunks a até CHUNK_LOAD_RADIUS do chunk do ponto de partida
+        vec4 spawn = GetPlayerSpawnCoordinates(level);
+        int spawn_col = (int)floor(spawn.x + (level.width - 1) / 2.0f + 0.5f);
+        int spawn_line = (int)floor(spawn.z + (level.height - 1) / 2.0f + 0.5f);
+        spawn_col = std::max(0, std::min(spawn_col, level.width - 1));
+        spawn_line = std::max(0, std::min(spawn_line, level.height - 1));
+        int first_line = std::max(0, (spawn_line / CHUNK_SIZE - CHUNK_LOAD_RADIUS) * CHUNK_SIZE);
+        int first_col = std::max(0, (spawn_col / CHUNK_SIZE - CHUNK_LOAD_RADIUS) * CHUNK_SIZE);
+        int last_line = std::min(level.height, (spawn_line / CHUNK_SIZE + CHUNK_LOAD_RADIUS + 1) * CHUNK_SIZE);
+        int last_col = std::min(level.width, (spawn_col / CHUNK_SIZE + CHUNK_LOAD_RADIUS + 1) * CHUNK_SIZE);
+        RegisterLevelObjects(&preload->objects, level, first_line, first_col, last_line, last_col);
+
+        std::vector<string> textures;
+        std::vector<AssetLoadTask> tasks = GetLevelAssetTasks(preload->samples, level.theme, &textures);
+        for (size_t i = 0; i < tasks.size(); i++) {
+            AssetUpload upload = tasks[i]();
+            if (upload)
+                preload->uploads.push_back(upload);
+        }
+
+        if (preload->music != NULL) {
+            LoadMusicFromFile(preload->music_path, preload->music);
+            preload->music_opened = true;
+        }
+    } catch (...) {
+        preload->error = std::current_exception();
+    }
+    preload->done = true;
+}
+
+// Chamada a cada quadro da mensagem de fim de nível: faz um dos envios para a
+// GPU do nível preparado, assim que a thread auxiliar termina. Retorna true
+// quando não há mais nada a fazer (ou nenhum nível sendo preparado).
+bool UpdateLevelPreload() {
+    LevelPreload& preload = g_LevelPreload;
+    if (preload.level_number == 0)
+        return true;
+    if (!preload.done)
+        return false;
+
+    FinishLevelPreload();
+    if (preload.error)
+        return true;
+    if (preload.next_upload < preload.uploads.size())
+        preload.uploads[preload.next_upload++]();
+    return preload.next_upload == preload.uploads.size();
+}
+
+// Espera a thread auxiliar terminar. Deve ser chamada antes de qualquer
+// carregamento de recursos ou música na thread principal, que não pode
+// ocorrer ao mesmo tempo que a preparação.
+void FinishLevelPreload() {
+    LevelPreload& preload = g_LevelPreload;
+    if (!preload.worker.joinable())
+        return;
+
+    preload.worker.join();
+    if (preload.music_opened)
+        g_OpenedMusic.insert(preload.music);
+}
+
+// Entrega o nível preparado em segundo plano, caso seja o nível dado e a
+// preparação não tenha falhado, fazendo os envios para a GPU que faltam. Em
+// qualquer caso, descarta a preparação. Retorna false caso o nível deva ser
+// carregado do arquivo.
+bool TakeLevelPreload(int level_number, Level* level, MapObjectList* samples, MapObjectList* objects) {
+    LevelPreload& preload = g_LevelPreload;
+    FinishLevelPreload();
+
+    bool taken = preload.level_number != 0 && preload.level_number == level_number && !preload.error;
+    if (taken) {
+        while (preload.next_upload < preload.uploads.size())
+            preload.uploads[preload.next_upload++]();
+        *level = std::move(preload.level);
+        samples->swap(preload.samples);
+        objects->swap(preload.objects);
+    }
+
+    preload.level_number = 0;
+    preload.error = std::exception_ptr();
+    preload.level = Level();
+    MapObjectList().swap(preload.samples);
+    MapObjectList().swap(preload.objects);
+    preload.uploads.clear();
+    preload.next_upload = 0;
+    preload.music = NULL;
+    preload.music_path = NULL;
+    preload.music_opened = false;
+    return taken;
+}
+
+// Forma compacta de um objeto, para o estado de um chunk descarregado. O
+// modelo e os tamanhos viram um índice em g_ObjectShapes.
+SavedMapObject SaveMapObject(const MapObject& object, const MapObjectDetail& detail) {
+    size_t shape = 0;
+    while (shape < g_ObjectShapes.size() &&
+           (strcmp(g_ObjectShapes[shape].obj_file_name, detail.obj_file_name) != 0 ||
+            g_ObjectShapes[shape].object_size != object.object_size ||
+            g_ObjectShapes[shape].model_size != detail.model_size))
+        shape++;
+    if (shape == g_ObjectShapes.size())
+        g_ObjectShapes.push_back({detail.obj_file_name, object.object_size, detail.model_size});
+    assert(shape < 256);
+
+    SavedMapObject saved;
+    saved.x = object.object_position.x;
+    saved.y = object.object_position.y;
+    saved.z = object.object_position.z;
+    saved.gravity = object.gravity;
+    saved.tile = detail.tile;
+    saved.type = object.object_type;
+    saved.direction = object.direction;
+    saved.shape = shape;
+    saved.reserved = 0;
+    return saved;
+}
+
+// Coloca de volta em "objects" um objeto guardado por SaveMapObject()
+void RestoreMapObject(MapObjectList* objects, const SavedMapObject& saved) {
+    const ObjectShape& shape = g_ObjectShapes[saved.shape];
+    MapObject object;
+    SetMapObjectType(&object, saved.type);
+    object.object_position = vec3(saved.x, saved.y, saved.z);
+    object.object_size = shape.object_size;
+    object.direction = saved.direction;
+    object.reserved = 0;
+    object.gravity = saved.gravity;
+
+    MapObjectDetail detail;
+    detail.obj_file_name = shape.obj_file_name;
+    detail.model_size = shape.model_size;
+    detail.tile = saved.tile;
+    detail.anim_type = GetObjectAnimation(saved.type);
+    detail.anim_phase = GetAnimPhase(object.object_position);
+    objects->push_back(object, detail);
+}
+
+// Função que encontra as coordenadas do spawn do jogador na planta do mapa
+vec4 GetPlayerSpawnCoordinates(const Level& level) {
+    float center_x = (level.width-1)/2.0f;
+    float center_z = (level.height-1)/2.0f;
+
+    for(int line = 0; line < level.height; line++) {
+        for(int col = 0; col < level.width; col++) {
+            if(level.tiles[(size_t)line * level.width + col] == TileCode("PS")) {
+                float x = -(center_x - col);
+                float z = -(center_z - line);
+
+                return vec4(x, -0.5f, z, 1.0f);
+            }
+        }
+    }
+
+    // Caso o spawn não seja encontrado, spawna o player no centro por padrão
+    return vec4(0.5f, 0.0f, 0.5f, 1.0f);
+}
+
+/////////////
+// DESENHO //
+/////////////
+
+// Função que desenha os objetos na cena (com base no vetor de objetos)
+void DrawMapObjects() {
+    for(unsigned int i = 0; i < map_objects.size(); i++) {
+        const MapObject& current_object = map_objects[i];
+        const MapObjectDetail& detail = map_objects.details[i];
+        int obj_type = current_object.object_type;
+
+        // Itens distantes são desenhados como billboards. Na faixa de
+        // transição, o billboard e o modelo são desenhados com pontilhados
+        // complementares, que trocam um pelo outro aos poucos.
+        float impostor_fade = GetImpostorFade(current_object);
+        if (impostor_fade >= 1.0f) {
+            DrawImpostor(current_object, detail);
+            continue;
+        }
+        if (impostor_fade > 0.0f) {
+            SetDitherRange(0.0f, impostor_fade);
+            DrawImpostor(current_object, detail);
+            SetDitherRange(impostor_fade, 1.0f);
+        }
+
+        glm::mat4 model = Matrix_Translate(current_object.object_position.x, current_object.object_position.y, current_object.object_position.z)
+                        * Matrix_Scale(detail.model_size.x, detail.model_size.y, detail.model_size.z);
+
+        // Giro e flutuação dos itens são feitos no vertex shader
+        if (detail.anim_type != ANIM_NONE) {
+            DrawAnimatedObject(detail.obj_file_name, obj_type, model, detail.anim_type, detail.anim_phase);
+            // (todos os itens com impostor são animados)
+            if (impostor_fade > 0.0f)
+                SetDitherRange(0.0f, 1.0f);
+            continue;
+        }
+
+        // Aplica rotações dependendo do objeto (inimigos, etc)
+        if (obj_type == FIRE) {
+        	GenerateParticles(5, vec4(current_object.object_position, 1.0f), detail.model_size);
+        	DrawParticles();
+        } else if (obj_type == JET) {
+        	model = model * Matrix_Translate(-0.2f, 0.0f, 0.0f)
+        		* Matrix_Rotate_Y(current_object.direction * PI/2)
+        		* Matrix_Translate(0.2f, 0.0f, 0.0f);
+   		}
+
+        DrawVirtualObject(detail.obj_file_name, current_object.object_type, model);
+    }
+}
+
+// Avança o relógio das animações procedurais em um quadro
+void AdvanceAnimationTime() {
+    g_AnimationTime += 1.0f;
+    glUniform1f(anim_time_uniform, g_AnimationTime);
+}
+
+// Ângulo de giro atual de um item (o mesmo calculado no vertex shader)
+float GetItemSpinAngle(const MapObjectDetail& detail) {
+    return fmod(g_AnimationTime * ITEM_ROTATION_SPEED + detail.anim_phase, 2*PI);
+}
+
+// Rotação (em coordenadas do modelo) dos itens que giram no mapa. Usada apenas
+// para enquadrar as capturas dos impostores; deve ser igual à animação
+// ANIM_SPIN_KEY/ANIM_SPIN_COW de "shader_vertex.glsl".
+glm::mat4 GetItemSpinMatrix(int obj_type, float angle) {
+    if (obj_type == BABYCOW)
+        return Matrix_Translate(-0.2f, 0.0f, 0.0f)
+             * Matrix_Rotate_Y(angle)
+             * Matrix_Translate(0.2f, 0.0f, 0.0f);
+
+    // Chaves: giram inclinadas em torno do eixo Y
+    return Matrix_Translate(0.0f, 5.7f, 0.0f)
+         * Matrix_Rotate_Y(angle)
+         * Matrix_Rotate_Z(PI/5)
+         * Matrix_Translate(0.0f, -5.7f, 0.0f);
+}
+
+// Renderiza, uma única vez, as chaves e a vaca bebê vistas de IMPOSTOR_YAW_STEPS
+// ângulos para um atlas (uma linha por tipo, uma coluna por ângulo). De longe,
+// esses itens são desenhados como um quad virado para a câmera com a captura
+// correspondente ao ângulo atual.
+void BuildImpostorAtlas() {
+    int atlas_width = IMPOSTOR_CELL_SIZE * IMPOSTOR_YAW_STEPS;
+    int atlas_height = IMPOSTOR_CELL_SIZE * IMPOSTOR_ROWS;
+
+    // Textura sRGB: o shader já aplica a correção gamma na saída, então a
+    // leitura da captura a converte de volta para o espaço linear.
+    GLuint texture_id;
+    GLuint sampler_id;
+    glGenTextures(1, &texture_id);
+    glGenSamplers(1, &sampler_id);
+    glSamplerParameteri(sampler_id, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(sampler_id, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(sampler_id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glSamplerParameteri(sampler_id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glActiveTexture(GL_TEXTURE0 + IMPOSTOR_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, atlas_width, atlas_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindSampler(IMPOSTOR_TEXTURE_UNIT, sampler_id);
+
+    GLuint depth_id;
+    glGenRenderbuffers(1, &depth_id);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_id);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, atlas_width, atlas_height);
+
+    GLuint framebuffer_id;
+    glGenFramebuffers(1, &framebuffer_id);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_id);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture_id, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_id);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "ERROR: impostor framebuffer incomplete, distant items will use meshes.\n");
+    } else {
+        glViewport(0, 0, atlas_width, atlas_height);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+        glUseProgram(program_id);
+
+        CaptureImpostor(KEY_RED, "key", KEY_MODEL_SCALE, 0);
+        CaptureImpostor(KEY_GREEN, "key", KEY_MODEL_SCALE, 1);
+        CaptureImpostor(KEY_BLUE, "key", KEY_MODEL_SCALE, 2);
+        CaptureImpostor(KEY_YELLOW, "key", KEY_MODEL_SCALE, 3);
+        CaptureImpostor(BABYCOW, "cow", BABYCOW_MODEL_SCALE, 4);
+
+        glEnable(GL_BLEND);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer_id);
+    glDeleteRenderbuffers(1, &depth_id);
+    glViewport(0, 0, g_WindowWidth, g_WindowHeight);
+}
+
+// Captura um tipo de item em todos os ângulos, na linha "row" do atlas
+void CaptureImpostor(int obj_type, const char* object_name, float model_scale, int row) {
+    const SceneObject& object = g_VirtualScene[object_name];
+    glm::mat4 scale = Matrix_Scale(model_scale, model_scale, model_scale);
+    float step_angle = 2*PI / IMPOSTOR_YAW_STEPS;
+
+    // Eixo de rotação: média das posições da origem do modelo em todos os ângulos
+    vec4 axis = vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    for (int step = 0; step < IMPOSTOR_YAW_STEPS; step++)
+        axis += scale * GetItemSpinMatrix(obj_type, step * step_angle) * vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    axis /= (float)IMPOSTOR_YAW_STEPS;
+
+    // Enquadramento comum a todos os ângulos (raio horizontal em torno do eixo e altura)
+    float radius = 0.0f;
+    float y_min = std::numeric_limits<float>::max();
+    float y_max = -std::numeric_limits<float>::max();
+    for (int step = 0; step < IMPOSTOR_YAW_STEPS; step++) {
+        glm::mat4 model = scale * GetItemSpinMatrix(obj_type, step * step_angle);
+        for (int corner = 0; corner < 8; corner++) {
+            vec4 p = model * vec4(corner & 1 ? object.bbox_max.x : object.bbox_min.x,
+                                  corner & 2 ? object.bbox_max.y : object.bbox_min.y,
+                                  corner & 4 ? object.bbox_max.z : object.bbox_min.z, 1.0f);
+            radius = std::max(radius, (float)sqrt(pow(p.x - axis.x, 2) + pow(p.z - axis.z, 2)));
+            y_min = std::min(y_min, p.y);
+            y_max = std::max(y_max, p.y);
+        }
+    }
+
+    Impostor impostor;
+    impostor.row = row;
+    impostor.offset = vec3(axis.x, (y_min + y_max) / 2.0f, axis.z);
+    impostor.half_size = vec2(radius * 1.05f, (y_max - y_min) / 2.0f * 1.05f);
+    g_Impostors[obj_type] = impostor;
+
+    // Câmera ortográfica olhando na direção -Z, centrada no eixo do item
+    float distance = 2.0f * impostor.half_size.x + 1.0f;
+    vec4 camera = vec4(impostor.offset.x, impostor.offset.y, impostor.offset.z + distance, 1.0f);
+    glm::mat4 view = Matrix_Camera_View(camera, vec4(0.0f, 0.0f, -1.0f, 0.0f), vec4(0.0f, 1.0f, 0.0f, 0.0f));
+    glm::mat4 projection = Matrix_Orthographic(-impostor.half_size.x, impostor.half_size.x,
+                                               -impostor.half_size.y, impostor.half_size.y,
+                                               -0.1f, -2.0f * distance);
+    glUniformMatrix4fv(view_uniform       , 1 , GL_FALSE , glm::value_ptr(view));
+    glUniformMatrix4fv(projection_uniform , 1 , GL_FALSE , glm::value_ptr(projection));
+
+    // O giro de cada captura é feito pelo próprio vertex shader (com tempo
+    // zero e a defasagem do ângulo), igual ao dos itens desenhados no nível.
+    glUniform1f(anim_time_uniform, 0.0f);
+    for (int step = 0; step < IMPOSTOR_YAW_STEPS; step++) {
+        glViewport(step * IMPOSTOR_CELL_SIZE, row * IMPOSTOR_CELL_SIZE, IMPOSTOR_CELL_SIZE, IMPOSTOR_CELL_SIZE);
+        DrawAnimatedObject(object_name, obj_type, scale, GetObjectAnimation(obj_type), step * step_angle);
+    }
+    glUniform1f(anim_time_uniform, g_AnimationTime);
+}
+
+// Quanto um objeto deve ser desenhado como billboard: 0 (só o modelo) até
+// IMPOSTOR_FADE_BAND antes de IMPOSTOR_DISTANCE, 1 (só o billboard) a partir
+// de IMPOSTOR_DISTANCE e, entre os dois, a fração dos pixels do billboard.
+// Billboards só são usados nos níveis, com projeção perspectiva.
+float GetImpostorFade(const MapObject& object) {
+    if (g_LodProjectionScale <= 0.0f || g_Impostors.count(object.object_type) == 0)
+        return 0.0f;
+    float distance = norm(vec4(object.object_position, 1.0f) - camera_position_c);
+    return std::max(0.0f, std::min(1.0f, (distance - (IMPOSTOR_DISTANCE - IMPOSTOR_FADE_BAND)) / IMPOSTOR_FADE_BAND));
+}
+
+// Desenha só os pixels cujo limiar no pontilhado ordenado do fragment shader
+// está em [first, last). (0, 1) desenha todos.
+void SetDitherRange(float first, float last) {
+    glUniform2f(dither_range_uniform, first, last);
+}
+
+// Desenha um item como um quad virado para a câmera. A captura usada é a do
+// ângulo do item relativo à direção de onde a câmera o observa.
+void DrawImpostor(const MapObject& object, const MapObjectDetail& detail) {
+    const Impostor& impostor = g_Impostors[object.object_type];
+    vec4 center = vec4(object.object_position, 1.0f) + VectorSetHomogeneous(impostor.offset, false);
+
+    vec4 to_camera = camera_position_c - center;
+    float view_angle = atan2(to_camera.x, to_camera.z);
+    float step_angle = 2*PI / IMPOSTOR_YAW_STEPS;
+    int step = (int)floor((GetItemSpinAngle(detail) - view_angle) / step_angle + 0.5f);
+    step = ((step % IMPOSTOR_YAW_STEPS) + IMPOSTOR_YAW_STEPS) % IMPOSTOR_YAW_STEPS;
+    glUniform2i(impostor_cell_uniform, step, impostor.row);
+
+    // O modelo "plane" tem lado 1; o vertex shader o alinha com a câmera
+    glm::mat4 model = Matrix_Translate(center.x, center.y, center.z)
+                    * Matrix_Scale(2.0f * impostor.half_size.x, 2.0f * impostor.half_size.y, 1.0f);
+    DrawVirtualObject("plane", IMPOSTOR, model);
+}
+
+// Função que desenha o jogador usando transformações hierárquicas
+// Desenha na posição dada, com escala dada e ângulo de rotação dado
+// A hierarquia é avaliada em um palette de tamanho fixo (uma matriz por parte,
+// na ordem de g_PlayerBoneTypes) e o modelo inteiro é desenhado em uma chamada.
+void DrawPlayer(vec4 position, float angle_y, float angle_x, float scale) {
+    float x = position.x;
+    float y = position.y + 0.2f; // Shift vertical do player
+    float z = position.z;
+    glm::mat4 palette[PLAYER_BONE_COUNT];
+    int bone = 0;
+
+    glm::mat4 body = Matrix_Translate(x, y, z) * Matrix_Rotate_Y(angle_y);
+    body = body * Matrix_Translate(0.0f, -0.6f, 0.0f) * Matrix_Rotate_X(angle_x) * Matrix_Translate(0.0f, 0.6f, 0.0f);
+    palette[bone++] = body * Matrix_Scale(0.8f * scale, 1.1f * scale, 0.2f * scale); // Torso
+
+    // Braços: direito (side = -1) e esquerdo (side = 1)
+    for (int side = -1; side <= 1; side += 2) {
+        glm::mat4 arm = body * Matrix_Translate(side * 0.55f * scale, 0.05f * scale, 0.0f); // Translação do braço
+        palette[bone++] = arm * Matrix_Scale(0.2f * scale, 0.7f * scale, 0.2f * scale);
+        glm::mat4 forearm = arm * Matrix_Translate(0.0f, -0.75f * scale, 0.0f); // Translação do antebraço
+        palette[bone++] = forearm * Matrix_Scale(0.2f * scale, 0.7f * scale, 0.2f * scale);
+        palette[bone++] = forearm * Matrix_Translate(0.0f, -0.45f * scale, 0.0f) // Translação da mão
+                                  * Matrix_Scale(0.2f * scale, 0.1f * scale, 0.2f * scale);
+    }
+
+    // Pernas: direita (side = -1) e esquerda (side = 1)
+    for (int side = -1; side <= 1; side += 2) {
+        glm::mat4 thigh = body * Matrix_Translate(side * 0.2f * scale, -1.0f * scale, 0.0f); // Translação da perna
+        palette[bone++] = thigh * Matrix_Scale(0.3f * scale, 0.8f * scale, 0.3f * scale);
+        glm::mat4 shin = thigh * Matrix_Translate(0.0f, -0.85f * scale, 0.0f); // Translação da canela
+        palette[bone++] = shin * Matrix_Scale(0.25f * scale, 0.8f * scale, 0.25f * scale);
+        palette[bone++] = shin * Matrix_Translate(0.0f, -0.5f * scale, 0.1f * scale) // Translação do pé
+                               * Matrix_Scale(0.2f * scale, 0.1f * scale, 0.4f * scale);
+    }
+
+    // Cabeça
+    palette[bone++] = body * Matrix_Rotate_Z(3.14)
+                           * Matrix_Translate(0.0f, -0.75f * scale, 0.0f)
+                           * Matrix_Scale(0.35f * scale, 0.35f * scale, 0.35f * scale);
+
+    assert(bone == PLAYER_BONE_COUNT);
+    glUniformMatrix4fv(bone_matrices_uniform, PLAYER_BONE_COUNT, GL_FALSE, glm::value_ptr(palette[0]));
+    DrawVirtualObject("player", PLAYER, Matrix_Identity());
+}
+
+// Desenha um objeto cuja animação (giro, flutuação) é calculada no vertex
+// shader a partir do tempo g_AnimationTime; "model" é a matriz estática.
+void DrawAnimatedObject(const char* object_name, int object_id, glm::mat4 model, int anim_type, float anim_phase) {
+    glUniform1i(anim_type_uniform, anim_type);
+    glUniform1f(anim_phase_uniform, anim_phase);
+    DrawVirtualObject(object_name, object_id, model);
+    glUniform1i(anim_type_uniform, ANIM_NONE);
+}
+
+// Função que desenha um objeto armazenado em g_VirtualScene. Veja definição
+// dos objetos na função BuildTrianglesAndAddToVirtualScene().
+void DrawVirtualObject(const char* object_name, int object_id, glm::mat4 model) {
+    const SceneObject& object = g_VirtualScene[object_name];
+
+    glUniformMatrix4fv(model_uniform, 1 , GL_FALSE , glm::value_ptr(model));
+    glUniform1i(object_id_uniform, object_id);
+
+    // "Ligamos" o VAO.
+    glBindVertexArray(object.vertex_array_object_id);
+
+    // A bounding box é a da malha original em todos os LODs
+    vec3 bbox_min = object.bbox_min;
+    vec3 bbox_max = object.bbox_max;
+    glUniform4f(bbox_min_uniform, bbox_min.x, bbox_min.y, bbox_min.z, 1.0f);
+    glUniform4f(bbox_max_uniform, bbox_max.x, bbox_max.y, bbox_max.z, 1.0f);
+
+    // Caixa usada para decodificar as posições quantizadas dos vértices
+    glUniform3f(position_offset_uniform, object.position_offset.x, object.position_offset.y, object.position_offset.z);
+    glUniform3f(position_scale_uniform, object.position_scale.x, object.position_scale.y, object.position_scale.z);
+
+    // Pedimos para a GPU rasterizar os triângulos do LOD adequado ao
+    // tamanho do objeto na tela.
+    int lod = SelectMeshLod(object, model);
+    glDrawElements(
+        object.rendering_mode,
+        object.lod_num_indices[lod],
         GL_UNSIGNED_INT,
-        (void*)g_VirtualScene[object_name].first_index
+        object.lod_first_index[lod]
     );
 
     // "Desligamos" o VAO
     glBindVertexArray(0);
 }
 
-// Desenha a skybox
-void DrawSkyboxPlanes() {
-    float skybox_distance = 100.0f;
-
-    glm::mat4 model = Matrix_Translate(skybox_distance, 0.0f, 0.0f)
-                    * Matrix_Scale(1.0f, skybox_distance*2, skybox_distance*2)
-                    * Matrix_Rotate_Z(PI/2)
-                    * Matrix_Rotate_Y(-PI/2);
-    DrawVirtualObject("plane", SKYBOX_WEST, model);
-
-    model = Matrix_Translate(-skybox_distance, 0.0f, 0.0f)
-                    * Matrix_Scale(1.0f, skybox_distance*2, skybox_distance*2)
-                    * Matrix_Rotate_Z(-PI/2)
-                    * Matrix_Rotate_Y(PI/2);
-    DrawVirtualObject("plane", SKYBOX_EAST, model);
-
-    model = Matrix_Translate(0.0f, skybox_distance, 0.0f)
-                    * Matrix_Scale(skybox_distance*2, 1.0f, skybox_distance*2)
-                    * Matrix_Rotate_X(PI);
-    DrawVirtualObject("plane", SKYBOX_TOP, model);
+// Escolhe o nível de detalhe de um objeto a partir do diâmetro (em pixels)
+// da esfera envolvente da sua bounding box, projetada na tela.
+int SelectMeshLod(const SceneObject& object, const glm::mat4& model) {
+    if (object.num_lods <= 1 || g_LodProjectionScale <= 0.0f)
+        return 0;
+
+    vec3 extent = object.bbox_max - object.bbox_min;
+    vec4 center = model * VectorSetHomogeneous((object.bbox_min + object.bbox_max) / 2.0f, true);
+
+    // Maior fator de escala aplicado pela matriz de modelagem
+    float scale = std::max(glm::length(vec3(model[0])), std::max(glm::length(vec3(model[1])), glm::length(vec3(model[2]))));
+    float diameter = glm::length(extent) * scale;
+    float distance = norm(center - camera_position_c);
+    if (distance <= diameter)
+        return 0;
+
+    float pixels = diameter / distance * g_LodProjectionScale;
+    float threshold = LOD_PIXEL_THRESHOLD;
+    int lod = 0;
+    while (lod < object.num_lods - 1 && pixels < threshold) {
+        lod++;
+        threshold /= 2.0f;
+    }
+    return lod;
+}
 
-    model = Matrix_Translate(0.0f, -skybox_distance, 0.0f)
-                    * Matrix_Scale(skybox_distance*2, 1.0f, skybox_distance*2);
-    DrawVirtualObject("plane", SKYBOX_BOTTOM, model);
+// Desenha a skybox do tema dado em uma única chamada: um cubo centrado na
+// câmera, cuja profundidade é forçada para o far plane no vertex shader
+// (gl_Position.z = w). Como é desenhada depois de todo o resto da cena, com
+// GL_LEQUAL, só os fragmentos ainda vazios são coloridos (sem overdraw).
+void DrawSkybox(int theme) {
+    if (theme < 0 || theme > 4 || g_SkyboxCubemaps[theme] == 0)
+        return;
 
-    model = Matrix_Translate(0.0f, 0.0f, skybox_distance)
-                    * Matrix_Scale(skybox_distance*2, skybox_distance*2, 1.0f)
-                    * Matrix_Rotate_X(-PI/2)
-                    * Matrix_Rotate_Y(PI);
-    DrawVirtualObject("plane", SKYBOX_NORTH, model);
+    glActiveTexture(GL_TEXTURE0 + SKYBOX_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, g_SkyboxCubemaps[theme]);
 
-    model = Matrix_Translate(0.0f, 0.0f, -skybox_distance)
-                    * Matrix_Scale(skybox_distance*2, skybox_distance*2, 1.0f)
-                    * Matrix_Rotate_X(PI/2);
-    DrawVirtualObject("plane", SKYBOX_SOUTH, model);
+    // Estamos dentro do cubo, portanto suas faces "de trás" são as visíveis
+    glDepthFunc(GL_LEQUAL);
+    glDisable(GL_CULL_FACE);
+    DrawVirtualObject("cube", SKYBOX, Matrix_Identity());
+    glEnable(GL_CULL_FACE);
+    glDepthFunc(GL_LESS);
 }
 
 //////////////
@@ -1632,48 +3243,12 @@ void DrawSkyboxPlanes() {
 
 // Dado um objeto e seu tamanho, retorna as coordenadas onde ele "começa"
 // Necessário pois os objetos do jogo contém a posição central deles
-vec4 GetObjectTopBoundary(vec4 object_position, vec3 object_size) {
-    return object_position - VectorSetHomogeneous(object_size, false) / 2.0f;
-}
-
-// Dado um tipo de objeto, retorna o valor de tolerância
-// Usado para a função de colisão com o player
-float GetTileToleranceValue(int object_type) {
-	switch(object_type) {
-    	case WALL:
-        case WOOD:
-        case DARKROCK:
-        case CRYSTAL:
-        case SNOWBLOCK:
-    	case DIRTBLOCK:
-    	case DOOR_RED:
-    	case DOOR_GREEN:
-    	case DOOR_BLUE:
-    	case DOOR_YELLOW: {
-    		return 0.25f;
-    	}
-    	case KEY_RED:
-    	case KEY_BLUE:
-    	case KEY_GREEN:
-    	case KEY_YELLOW:
-    	case BABYCOW:
-    		return 0.4f;
-    	case COW:
-    		return 0.1f;
-    	case DIRT:
-    	case WATER:
-    	case FLOOR:
-        case GRASS:
-        case SNOW:
-        case DARKDIRT:
-    	default: {
-    		return -0.1f;
-    	}
-    }
+vec3 GetObjectTopBoundary(vec3 object_position, vec3 object_size) {
+    return object_position - object_size / 2.0f;
 }
 
 // Dado dois objetos e seus tamanhos, testa a colisão via bounding box
-bool BBoxCollision(vec4 obj1_pos, vec4 obj2_pos, vec3 obj1_size, vec3 obj2_size, float epsilon) {
+bool BBoxCollision(vec3 obj1_pos, vec3 obj2_pos, vec3 obj1_size, vec3 obj2_size, float epsilon) {
     // Recomputa a bounding box dos objetos
     // Isto porque a posição dos objetos está no centro, e não no canto, como deveria ser
     obj1_pos = GetObjectTopBoundary(obj1_pos, obj1_size);
@@ -1688,10 +3263,13 @@ bool BBoxCollision(vec4 obj1_pos, vec4 obj2_pos, vec3 obj1_size, vec3 obj2_size,
     else return false;
 }
 
-// Pega todos os objetos que colidem com outro objeto, dado o índice
-//  do objeto na lista de objetos do nível, e a posição à qual ele está indo
-vecInt GetObjectsCollidingWithObject(int target_obj_index, vec4 target_obj_pos) {
-    vecInt objects_in_position;
+// Pega todos os objetos que colidem com outro objeto, dado o índice do
+// objeto na lista de objetos do nível (-1: o jogador) e a posição à qual ele
+// está indo. O resultado é escrito em "query" e classificado na mesma
+// varredura (veja CollisionQuery); "candidates", se dado, limita os objetos
+// testados.
+void GetObjectsCollidingWithObject(int target_obj_index, vec4 target_obj_pos, CollisionQuery* query, const NearbyObjects* candidates) {
+    vec3 target_position = vec3(target_obj_pos);
     vec3 target_obj_size;
 
     // Testa se o objeto em questão é o jogador
@@ -1699,229 +3277,187 @@ vecInt GetObjectsCollidingWithObject(int target_obj_index, vec4 target_obj_pos)
         target_obj_size = vec3(0.01f, 0.6f, 0.01f); // Tamanho do jogador considerado nas colisões
     else target_obj_size = map_objects[target_obj_index].object_size;
 
-    // Varre todos os objetos do nível
-    unsigned int obj_index = 0;
-    while (obj_index < map_objects.size()) {
+    query->count = 0;
+    query->flags = 0;
+    query->types = 0;
+
+    // Varre todos os objetos do nível, ou só os candidatos dados
+    unsigned int count = candidates ? candidates->count : map_objects.size();
+    for (unsigned int k = 0; k < count; k++) {
+        unsigned int obj_index = candidates ? candidates->objects[k] : k;
+
     	// O próprio objeto está na lista e deve ser ignorado
         // (se for o player, o index é -1 e este teste sempre falha)
-    	if (obj_index == target_obj_index) {
-    		obj_index++;
+    	if (obj_index == (unsigned int)target_obj_index)
     		continue;
-    	}
 
-        vec4 obj_position = map_objects[obj_index].object_position;
-        vec3 obj_size = map_objects[obj_index].object_size;
+        const MapObject& object = map_objects[obj_index];
 
         // Computa valor de tolerância (quanto o objeto pode andar "dentro" do outro objeto, ou quanto ele deve ficar longe)
         float tol = 0.0f;
         if (target_obj_index == -1)
-            tol = GetTileToleranceValue(map_objects[obj_index].object_type);
-
-        if (BBoxCollision(target_obj_pos, obj_position, target_obj_size, obj_size, tol))
-        	objects_in_position.push_back(obj_index); // Acrescenta o objeto na lista
-
-        obj_index++;
+            tol = OBJECT_TRAITS[object.object_type].tolerance;
+
+        if (!BBoxCollision(target_position, object.object_position, target_obj_size, object.object_size, tol))
+            continue;
+
+        // Classificação: as flags e o primeiro objeto de cada tipo valem
+        // mesmo que a lista de objetos esteja cheia
+        uint64_t type_bit = (uint64_t)1 << object.object_type;
+        if (!(query->types & type_bit))
+            query->first_of_type[object.object_type] = obj_index;
+        query->types |= type_bit;
+        query->flags |= object.flags;
+
+#ifdef COWMAZE_CHECK_ALLOCATIONS
+        // COLLISION_QUERY_CAPACITY pequena demais para o mapa atual
+        assert(query->count < COLLISION_QUERY_CAPACITY);
+#endif
+        if (query->count < COLLISION_QUERY_CAPACITY)
+            query->objects[query->count++] = obj_index;
     }
-
-    return objects_in_position;
 }
 
 // Pega todos os objetos colidindo com o jogador, dado sua posição
-vecInt GetObjectsCollidingWithPlayer(vec4 player_position) {
-    return GetObjectsCollidingWithObject(-1, player_position);
-}
-
-// Dado um vetor de objetos, retorna o primeiro objeto de um dado tipo
-int GetVectorObjectType(vecInt vector_objects, int type) {
-    unsigned int curr_index = 0;
-
-    while(curr_index < vector_objects.size()) {
-        int current_obj_index = vector_objects[curr_index];
-
-        if (map_objects[current_obj_index].object_type == type)
-            return current_obj_index;
-        curr_index++;
-    }
-
-    return -1;
+void GetObjectsCollidingWithPlayer(vec4 player_position, CollisionQuery* query) {
+    GetObjectsCollidingWithObject(-1, player_position, query);
 }
 
-// Alternativa para procurar mais de um tipo de objeto
-int GetVectorObjectType(vecInt vector_objects, vecInt types) {
-    unsigned int curr_index = 0;
-
-    while(curr_index < vector_objects.size()) {
-        int current_obj_index = vector_objects[curr_index];
-
-        for(unsigned int i = 0; i < types.size(); i++)
-            if (map_objects[current_obj_index].object_type == types[i])
-                return current_obj_index;
-        curr_index++;
-    }
-
+// Retorna o primeiro objeto colidido de um dado tipo, ou -1 caso não haja
+int GetCollidedObjectType(const CollisionQuery& query, int type) {
+    if (query.types & ((uint64_t)1 << type))
+        return query.first_of_type[type];
     return -1;
 }
 
-// Dado um vetor, testa se existe um objeto que possa bloquear
+// Testa se existe, entre os objetos colididos, um objeto que possa bloquear
 //  o movimento de outro objeto (cubo de sujeira ou inimigos p. ex.)
-bool vectorHasObjectBlockingObject(vecInt vector_objects, bool is_volleyball) {
-    unsigned int curr_index = 0;
-	while (curr_index < vector_objects.size()) {
-		int curr_obj_index = vector_objects[curr_index];
-		int colliding_obj_type = map_objects[curr_obj_index].object_type;
-
-		// Adicione novos objetos bloqueantes aqui
-        if ((is_volleyball && isIn(colliding_obj_type, {FLOOR,GRASS,SNOW,DARKDIRT})) ||
-            isIn(colliding_obj_type, {WALL, DIRTBLOCK, DIRT, DOOR_RED, DOOR_GREEN, DOOR_YELLOW, DOOR_BLUE,
-                                        COW, JET, BEACHBALL, VOLLEYBALL, WOOD, SNOWBLOCK, DARKROCK,CRYSTAL}))
-			return true;
-
-        // Caso seja uma bola de volei (quicando), deve-se levar em conta o chão também.
-
-		curr_index++;
-	}
-
-	return false;
+bool HasObjectBlockingObject(const CollisionQuery& query, bool is_volleyball) {
+	// Objetos bloqueantes: OBJECT_BLOCKS_OBJECT em OBJECT_TYPE_TABLE.
+    // Caso seja uma bola de volei (quicando), deve-se levar em conta o chão também.
+    return (query.flags & OBJECT_BLOCKS_OBJECT) || (is_volleyball && (query.flags & OBJECT_STOPS_FALL));
 }
 
 // Função auxiliar, similar acima, mas para a bola de vôlei
-bool vectorHasVolleyballBlockingObject(vecInt vector_objects) {
-	return vectorHasObjectBlockingObject(vector_objects, true);
+bool HasVolleyballBlockingObject(const CollisionQuery& query) {
+	return HasObjectBlockingObject(query, true);
 }
 
-// Testa se um vetor de objetos possui algum objeto que possa bloquear
+// Testa se os objetos colididos possuem algum objeto que possa bloquear
 //  o movimento do jogador
-bool vectorHasPlayerBlockingObject(vecInt vector_objects) {
-    unsigned int curr_index = 0;
-
-    // Primeiro verificamos se existem paredes
-    while (curr_index < vector_objects.size()) {
-        int curr_obj_index = vector_objects[curr_index];
-        if (isIn(map_objects[curr_obj_index].object_type, {WALL, WOOD, SNOWBLOCK, DARKROCK, CRYSTAL})) {
-            if (map_objects[curr_obj_index].object_type == CRYSTAL)
-                g_DeathByEnemy = true;
-            return true;
+bool HasPlayerBlockingObject(const CollisionQuery& query) {
+    // Primeiro verificamos se existem paredes (que podem matar, como o cristal)
+    if (query.flags & OBJECT_BLOCKS_PLAYER) {
+        for (int i = 0; i < query.count; i++) {
+            int flags = map_objects[query.objects[i]].flags;
+            if (flags & OBJECT_BLOCKS_PLAYER) {
+                if (flags & OBJECT_HAZARD)
+                    g_DeathByEnemy = true;
+                return true;
+            }
         }
-        curr_index++;
     }
 
     // Depois verificamos portas
     // Só podemos destrancar portas que tiverem se o player não colidir com
     //   NENHUM outro sólido bloqueante
-    // Por isso, armazenamos todas as que ele pode trancar e, se não existir,
-    //   destranca posteriormente.
-    vecInt unlocked_red_doors;
-    vecInt unlocked_green_doors;
-    vecInt unlocked_blue_doors;
-    vecInt unlocked_yellow_doors;
-
-    curr_index = 0;
-    while (curr_index < vector_objects.size()) {
-        int curr_obj_index = vector_objects[curr_index];
-
-        if (map_objects[curr_obj_index].object_type == DOOR_RED) {
-            if (player_inventory.keys.red == 0)
-                return true;
-            else unlocked_red_doors.push_back(curr_obj_index);
-        }
-        else if (map_objects[curr_obj_index].object_type == DOOR_GREEN) {
-            if (player_inventory.keys.green == 0)
-                return true;
-            else unlocked_green_doors.push_back(curr_obj_index);
-        }
-        else if (map_objects[curr_obj_index].object_type == DOOR_BLUE) {
-            if (player_inventory.keys.blue == 0)
-                return true;
-            else unlocked_blue_doors.push_back(curr_obj_index);
-        }
-        else if (map_objects[curr_obj_index].object_type == DOOR_YELLOW) {
-            if (player_inventory.keys.yellow == 0)
-                return true;
-            else unlocked_yellow_doors.push_back(curr_obj_index);
-        }
-
-        curr_index++;
-    }
+    // Por isso, as portas só são destrancadas no final (veja UnlockDoors())
+    if ((GetCollidedObjectType(query, DOOR_RED) >= 0 && player_inventory.keys.red == 0) ||
+        (GetCollidedObjectType(query, DOOR_GREEN) >= 0 && player_inventory.keys.green == 0) ||
+        (GetCollidedObjectType(query, DOOR_BLUE) >= 0 && player_inventory.keys.blue == 0) ||
+        (GetCollidedObjectType(query, DOOR_YELLOW) >= 0 && player_inventory.keys.yellow == 0))
+        return true;
 
     // Depois verificamos se atingiu a vaca do final do jogo
-    curr_index = 0;
-    while (curr_index < vector_objects.size()) {
-        int curr_obj_index = vector_objects[curr_index];
-        if (map_objects[curr_obj_index].object_type == COW) {
-            if (player_inventory.cows == g_LevelCowAmount) {
-                PlaySound(&winsound);
-                g_MapEnded = true;
-                return false;
-            } else
-                return true;
-        }
-
-        curr_index++;
+    if (GetCollidedObjectType(query, COW) >= 0) {
+        if (player_inventory.cows == g_LevelCowAmount) {
+            PlaySound(&winsound);
+            g_MapEnded = true;
+            return false;
+        } else
+            return true;
     }
 
     // Depois verificamos se existem blocos que podem ser movimentados
-    bool found_dirtblocks = false;
-    curr_index = 0;
-    while (curr_index < vector_objects.size()) {
-        int curr_obj_index = vector_objects[curr_index];
-        if (map_objects[curr_obj_index].object_type == DIRTBLOCK) {
-            MoveBlock(curr_obj_index);
-            found_dirtblocks = true;
-        }
-        curr_index++;
-    }
+    if (GetCollidedObjectType(query, DIRTBLOCK) >= 0) {
+        for (int i = 0; i < query.count; i++)
+            if (map_objects[query.objects[i]].object_type == DIRTBLOCK)
+                MoveBlock(query.objects[i]);
 
-    // Se existem blocos, o player não pode ser movimentado (embora a chamada para mover os blocos tenha ocorrido)
-    if (found_dirtblocks)
+        // Se existem blocos, o player não pode ser movimentado (embora a chamada para mover os blocos tenha ocorrido)
         return true;
-    else {
-        // Se o player não foi bloqueado, destranca quaisquer portas existentes
-        UnlockDoors(unlocked_red_doors, unlocked_green_doors, unlocked_blue_doors, unlocked_yellow_doors);
-        return false;
     }
+
+    // Se o player não foi bloqueado, destranca quaisquer portas existentes
+    UnlockDoors(query);
+    return false;
 }
 
-// Testa se colidiu com inimigos
-bool CollidedWithEnemy(vecInt vector_objects) {
-    vecInt enemies = {JET, BEACHBALL, VOLLEYBALL};
-    return (GetVectorObjectType(vector_objects, enemies) >= 0);
+// Testa se colidiu com inimigos (ou outro objeto que mate ao ser tocado)
+bool CollidedWithEnemy(const CollisionQuery& query) {
+    return (query.flags & OBJECT_HAZARD) != 0;
 }
 
-// Destranca portas
-void UnlockDoors(vecInt red, vecInt green, vecInt blue, vecInt yellow) {
+// Destranca as portas colididas (cada uma gasta uma chave da sua cor, exceto
+// a amarela, que é permanente)
+void UnlockDoors(const CollisionQuery& query) {
+    uint64_t doors = ((uint64_t)1 << DOOR_RED) | ((uint64_t)1 << DOOR_GREEN) | ((uint64_t)1 << DOOR_BLUE) | ((uint64_t)1 << DOOR_YELLOW);
+
     // Se não existem portas, retorna
-    if(red.size() + green.size() + blue.size() + yellow.size() == 0)
+    if (!(query.types & doors))
         return;
 
     PlaySound(&doorsound);
 
-    // Remove os itens dos vetores do fim pro início, pra não ter problema de remover coisas erradas
-
-	for (unsigned int i = 0; i < yellow.size(); i++) {
-        // Chave amarela é permanente
-		map_objects.erase(map_objects.begin() + (yellow[yellow.size() - 1 - i]));
-	}
-
-	for (unsigned int i = 0; i < blue.size(); i++) {
-		player_inventory.keys.blue--;
-		map_objects.erase(map_objects.begin() + (blue[blue.size() - 1 - i]));
-	}
-
-	for (unsigned int i = 0; i < green.size(); i++) {
-		player_inventory.keys.green--;
-		map_objects.erase(map_objects.begin() + (green[green.size() - 1 - i]));
-	}
-
-	for (unsigned int i = 0; i < red.size(); i++) {
-		player_inventory.keys.red--;
-		map_objects.erase(map_objects.begin() + (red[red.size() - 1 - i]));
-	}
+    // Remove os objetos do fim pro início, pra não ter problema de remover coisas erradas
+    for (int i = query.count - 1; i >= 0; i--) {
+        int obj_index = query.objects[i];
+        switch (map_objects[obj_index].object_type) {
+            case DOOR_RED:
+                player_inventory.keys.red--;
+                break;
+            case DOOR_GREEN:
+                player_inventory.keys.green--;
+                break;
+            case DOOR_BLUE:
+                player_inventory.keys.blue--;
+                break;
+            case DOOR_YELLOW:
+                break;
+            default:
+                continue;
+        }
+        map_objects.erase(obj_index);
+    }
 }
 
 /////////////////////////////
 // MOVIMENTAÇÃO DE OBJETOS //
 /////////////////////////////
 
+// Início e fim de um passo da simulação (movimentação do jogador ou dos
+// inimigos). As colisões usam buffers de tamanho fixo (veja CollisionQuery), e
+// com COWMAZE_CHECK_ALLOCATIONS EndSimulationStep() verifica que o passo não
+// alocou memória. Os sons pedidos durante o passo são tocados ao final dele.
+void BeginSimulationStep() {
+    g_InSimulationStep = true;
+    g_NumDeferredSounds = 0;
+#ifdef COWMAZE_CHECK_ALLOCATIONS
+    g_SimulationStepAllocations = g_ThreadHeapAllocations;
+#endif
+}
+
+void EndSimulationStep() {
+#ifdef COWMAZE_CHECK_ALLOCATIONS
+    // Alguma colisão ou movimentação passou a alocar memória a cada quadro
+    assert(g_ThreadHeapAllocations == g_SimulationStepAllocations);
+#endif
+    g_InSimulationStep = false;
+    for (int i = 0; i < g_NumDeferredSounds; ++i)
+        PlaySound(g_DeferredSounds[i]);
+    g_NumDeferredSounds = 0;
+}
+
 // Função que calcula a posição nova do jogador (ao se movimentar)
 void MovePlayer(int theme) {
 
@@ -1962,20 +3498,21 @@ void MovePlayer(int theme) {
 
     	// Primeiro testamos se existe uma colisão com sólidos na direção direta do player.
 	    vec4 target_pos = player_position + MOVEMENT_AMOUNT * player_direction;
-	    vecInt collided_objects = GetObjectsCollidingWithPlayer(target_pos);
-	    bool position_blocked = vectorHasPlayerBlockingObject(collided_objects);
+	    CollisionQuery collided_objects;
+	    GetObjectsCollidingWithPlayer(target_pos, &collided_objects);
+	    bool position_blocked = HasPlayerBlockingObject(collided_objects);
 
 	    if (position_blocked) {
 	    	// Caso exista, vamos testar na posição reta.
 	    	target_pos = player_position + MOVEMENT_AMOUNT * vec4(player_direction.x, 0.0f, 0.0f, 0.0f);
-	    	collided_objects = GetObjectsCollidingWithPlayer(target_pos);
-	    	position_blocked = vectorHasPlayerBlockingObject(collided_objects);
+	    	GetObjectsCollidingWithPlayer(target_pos, &collided_objects);
+	    	position_blocked = HasPlayerBlockingObject(collided_objects);
 
 	    	if (position_blocked) {
 	    		// Caso exista, finalmente, testamos a posição lateral.
 	    		target_pos = player_position + MOVEMENT_AMOUNT * vec4(0.0f, 0.0f, player_direction.z, 0.0f);
-	    		collided_objects = GetObjectsCollidingWithPlayer(target_pos);
-	    		position_blocked = vectorHasPlayerBlockingObject(collided_objects);
+	    		GetObjectsCollidingWithPlayer(target_pos, &collided_objects);
+	    		position_blocked = HasPlayerBlockingObject(collided_objects);
 	    	}
 	    }
 
@@ -1983,62 +3520,57 @@ void MovePlayer(int theme) {
 	    if (!position_blocked) {
 		    player_position = target_pos;
 
-		    int collided_dirt_index = GetVectorObjectType(collided_objects, DIRT);
-		    int collided_redkey_index = GetVectorObjectType(collided_objects, KEY_RED);
-		    int collided_greenkey_index = GetVectorObjectType(collided_objects, KEY_GREEN);
-		    int collided_bluekey_index = GetVectorObjectType(collided_objects, KEY_BLUE);
-		    int collided_yellowkey_index = GetVectorObjectType(collided_objects, KEY_YELLOW);
-		    int collided_baby_index = GetVectorObjectType(collided_objects, BABYCOW);
+		    int collided_dirt_index = GetCollidedObjectType(collided_objects, DIRT);
+		    int collided_redkey_index = GetCollidedObjectType(collided_objects, KEY_RED);
+		    int collided_greenkey_index = GetCollidedObjectType(collided_objects, KEY_GREEN);
+		    int collided_bluekey_index = GetCollidedObjectType(collided_objects, KEY_BLUE);
+		    int collided_yellowkey_index = GetCollidedObjectType(collided_objects, KEY_YELLOW);
+		    int collided_baby_index = GetCollidedObjectType(collided_objects, BABYCOW);
 
 		    if (CollidedWithEnemy(collided_objects)) {
 		    	g_DeathByEnemy = true;
 		    }
-		    else if (GetVectorObjectType(collided_objects, WATER) >= 0) {
+		    else if (GetCollidedObjectType(collided_objects, WATER) >= 0) {
 		        g_DeathByWater = true;
 		    } else if (collided_dirt_index >= 0) {
                 switch(theme){
                     case 0:
-                        map_objects[collided_dirt_index].object_type = FLOOR;
+                        SetMapObjectType(&map_objects[collided_dirt_index], FLOOR);
                         break;
                     case 1:
-                        map_objects[collided_dirt_index].object_type = GRASS;
+                        SetMapObjectType(&map_objects[collided_dirt_index], GRASS);
                         break;
                     case 2:
-                        map_objects[collided_dirt_index].object_type = DARKFLOOR;
+                        SetMapObjectType(&map_objects[collided_dirt_index], DARKFLOOR);
                         break;
                     case 3:
-                        map_objects[collided_dirt_index].object_type = SNOW;
+                        SetMapObjectType(&map_objects[collided_dirt_index], SNOW);
                         break;
                     case 4:
-                        map_objects[collided_dirt_index].object_type = DARKDIRT;
+                        SetMapObjectType(&map_objects[collided_dirt_index], DARKDIRT);
                         break;
                     default:
-                        map_objects[collided_dirt_index].object_type = FLOOR;
+                        SetMapObjectType(&map_objects[collided_dirt_index], FLOOR);
                 }
 		    } else if (collided_redkey_index >= 0) {
-		        sound.setBuffer(keysound);
-                sound.play();
-		    	map_objects.erase(map_objects.begin() + collided_redkey_index);
+		        PlaySound(&keysound);
+		    	map_objects.erase(collided_redkey_index);
 		    	player_inventory.keys.red++;
 		    } else if (collided_greenkey_index >= 0) {
-		        sound.setBuffer(keysound);
-                sound.play();
-		    	map_objects.erase(map_objects.begin() + collided_greenkey_index);
+		        PlaySound(&keysound);
+		    	map_objects.erase(collided_greenkey_index);
 		    	player_inventory.keys.green++;
 		    } else if (collided_bluekey_index >= 0) {
-		        sound.setBuffer(keysound);
-                sound.play();
-		    	map_objects.erase(map_objects.begin() + collided_bluekey_index);
+		        PlaySound(&keysound);
+		    	map_objects.erase(collided_bluekey_index);
 		    	player_inventory.keys.blue++;
 		    } else if (collided_yellowkey_index >= 0) {
-		        sound.setBuffer(keysound);
-                sound.play();
-		    	map_objects.erase(map_objects.begin() + collided_yellowkey_index);
+		        PlaySound(&keysound);
+		    	map_objects.erase(collided_yellowkey_index);
 		    	player_inventory.keys.yellow++;
 		    } else if (collided_baby_index >= 0) {
-		        sound.setBuffer(cowsound);
-                sound.play();
-		    	map_objects.erase(map_objects.begin() + collided_baby_index);
+		        PlaySound(&cowsound);
+		    	map_objects.erase(collided_baby_index);
 		    	player_inventory.cows++;
 		    }
 		}
@@ -2048,10 +3580,10 @@ void MovePlayer(int theme) {
 // Função que move um bloco
 // Ao mover o bloco, testa-se colisão também.
 void MoveBlock(int block_index) {
-    vec4 direction = map_objects[block_index].object_position - player_position;
+    vec4 direction = vec4(map_objects[block_index].object_position, 1.0f) - player_position;
     direction.y = 0.0f;
 
-    vec4 target_pos = map_objects[block_index].object_position;
+    vec4 target_pos = vec4(map_objects[block_index].object_position, 1.0f);
 
     // Computa a direção para onde se movimentar o bloco
     float angle = acos(dotproduct(direction, vec4(1.0f,0.0f,0.0f,0.0f))/norm(direction));
@@ -2069,43 +3601,120 @@ void MoveBlock(int block_index) {
         target_pos.x -= MOVEMENT_AMOUNT;
     }
 
-    vecInt collided_objects = GetObjectsCollidingWithObject(block_index, target_pos);
+    CollisionQuery collided_objects;
+    GetObjectsCollidingWithObject(block_index, target_pos, &collided_objects);
 
-    if (!vectorHasObjectBlockingObject(collided_objects)) {
-        map_objects[block_index].object_position = target_pos;
+    if (!HasObjectBlockingObject(collided_objects)) {
+        map_objects[block_index].object_position = vec3(target_pos);
 
         // Testa se atingiu água. Se atingiu, transforma-a em sujeira.
-        int water_index = GetVectorObjectType(collided_objects, WATER);
+        int water_index = GetCollidedObjectType(collided_objects, WATER);
         if (water_index >= 0) {
             PlaySound(&splashsound);
             map_objects[block_index].object_position = map_objects[water_index].object_position;
-            map_objects[water_index].object_type = DIRT;
-            map_objects.erase(map_objects.begin() + block_index);
+            SetMapObjectType(&map_objects[water_index], DIRT);
+            map_objects.erase(block_index);
         }
     }
 }
 
-// Movimenta todos os inimigos em um nível
+// Movimenta os inimigos do nível, cada um o número de quadros dado pelo seu
+// chunk (veja GetChunkSimulationSteps()). A simulação só depende do número
+// do quadro, e não do relógio, e portanto é determinística. Os chunks sem
+// inimigos dormem e acordam quando um inimigo entra neles.
 void MoveEnemies() {
-    // Varre o vetor de objetos, movimentando inimigos existentes
-    for (unsigned int i = 0; i < map_objects.size(); i++) {
-        if (map_objects[i].object_type == JET)
-            MoveJet(i);
-        else if (map_objects[i].object_type == BEACHBALL)
-            MoveBeachBall(i);
-        else if (map_objects[i].object_type == VOLLEYBALL)
-            MoveVolleyBall(i);
+    int frame = g_EnemyFrame++;
+
+    // Nenhum chunk acordado neste quadro: não há o que varrer
+    int center_line = g_LevelChunkCenter / g_LevelChunkColumns;
+    int center_col = g_LevelChunkCenter % g_LevelChunkColumns;
+    bool awake = false;
+    for (int line = std::max(0, center_line - CHUNK_COARSE_RADIUS); line <= std::min(g_LevelChunkRows - 1, center_line + CHUNK_COARSE_RADIUS); line++)
+        for (int col = std::max(0, center_col - CHUNK_COARSE_RADIUS); col <= std::min(g_LevelChunkColumns - 1, center_col + CHUNK_COARSE_RADIUS); col++)
+            awake = awake || GetChunkSimulationSteps(line * g_LevelChunkColumns + col, frame) > 0;
+    if (!awake)
+        return;
+
+    unsigned int i = 0;
+    while (i < map_objects.size()) {
+        if (!(map_objects[i].flags & OBJECT_ENEMY)) {
+            i++;
+            continue;
+        }
+
+        int chunk = GetChunkIndex(map_objects[i].object_position);
+        int steps = GetChunkSimulationSteps(chunk, frame);
+        if (steps == 0) {
+            i++;
+            continue;
+        }
+
+        // Inimigo morto: o próximo objeto passou a ocupar a posição i
+        if (!MoveEnemy(i, steps)) {
+            g_LevelChunks[chunk].enemies--;
+            continue;
+        }
+
+        int new_chunk = GetChunkIndex(map_objects[i].object_position);
+        if (new_chunk != chunk) {
+            g_LevelChunks[chunk].enemies--;
+            g_LevelChunks[new_chunk].enemies++;
+        }
+        i++;
     }
 }
 
-// Função de movimentação do jato
-void MoveJet(int jet_index) {
-    // Calcula para onde o jet deve andar
-    vec4 target_pos = map_objects[jet_index].object_position;
-    switch(map_objects[jet_index].direction) {
-        case 0: {
-            target_pos.z += MOVEMENT_AMOUNT + ENEMY_SPEED;
-            break;
+// Movimenta um inimigo "steps" quadros seguidos. Com mais de um quadro, os
+// objetos que ele pode tocar no caminho (os que colidem com a sua caixa
+// aumentada pelo maior deslocamento possível) são encontrados com uma única
+// varredura do mapa, e cada quadro só testa colisões com eles (ou com o mapa
+// todo, caso não caibam em NearbyObjects). Retorna false caso o inimigo tenha
+// morrido (e sido removido de map_objects).
+bool MoveEnemy(int enemy_index, int steps) {
+    NearbyObjects nearby;
+    const NearbyObjects* candidates = NULL;
+    if (steps > 1) {
+        // Jatos e bolas de praia andam no plano; bolas de vôlei caem com
+        // velocidade limitada a 0.2 (mais o incremento da gravidade)
+        const MapObject& enemy = map_objects[enemy_index];
+        float reach = steps * MaxFloat2(MOVEMENT_AMOUNT + ENEMY_SPEED, MaxFloat2(fabs(enemy.gravity), 0.2f) + 0.005f);
+        vec3 path_size = enemy.object_size + vec3(2.0f * reach, 2.0f * reach, 2.0f * reach);
+        nearby.count = 0;
+        candidates = &nearby;
+        for (unsigned int i = 0; i < map_objects.size() && candidates != NULL; i++) {
+            if (i == (unsigned int)enemy_index || !BBoxCollision(enemy.object_position, map_objects[i].object_position, path_size, map_objects[i].object_size, 0.0f))
+                continue;
+            if (nearby.count == NEARBY_OBJECTS_CAPACITY)
+                candidates = NULL;
+            else nearby.objects[nearby.count++] = i;
+        }
+    }
+
+    size_t num_objects = map_objects.size();
+    int type = map_objects[enemy_index].object_type;
+    for (int step = 0; step < steps; step++) {
+        if (type == JET)
+            MoveJet(enemy_index, candidates);
+        else if (type == BEACHBALL)
+            MoveBeachBall(enemy_index, candidates);
+        else if (type == VOLLEYBALL)
+            MoveVolleyBall(enemy_index, candidates);
+
+        if (map_objects.size() != num_objects)
+            return false;
+    }
+    return true;
+}
+
+// Função de movimentação do jato. "nearby", se dado, limita os objetos
+// testados nas colisões (veja MoveEnemy()).
+void MoveJet(int jet_index, const NearbyObjects* nearby) {
+    // Calcula para onde o jet deve andar
+    vec4 target_pos = vec4(map_objects[jet_index].object_position, 1.0f);
+    switch(map_objects[jet_index].direction) {
+        case 0: {
+            target_pos.z += MOVEMENT_AMOUNT + ENEMY_SPEED;
+            break;
         }
         case 1: {
             target_pos.x += MOVEMENT_AMOUNT + ENEMY_SPEED;
@@ -2122,19 +3731,20 @@ void MoveJet(int jet_index) {
     }
 
     // Testa colisões
-    vecInt collided_objects = GetObjectsCollidingWithObject(jet_index, target_pos);
-    if (!vectorHasObjectBlockingObject(collided_objects)) {
-        map_objects[jet_index].object_position = target_pos;
+    CollisionQuery collided_objects;
+    GetObjectsCollidingWithObject(jet_index, target_pos, &collided_objects, nearby);
+    if (!HasObjectBlockingObject(collided_objects)) {
+        map_objects[jet_index].object_position = vec3(target_pos);
 
         // Se colidiu com o player, mata ele
         vec3 player_size = vec3(0.0f, 0.6f, 0.0f);
-        if (BBoxCollision(player_position, target_pos, player_size, map_objects[jet_index].object_size, 0.0f))
+        if (BBoxCollision(vec3(player_position), vec3(target_pos), player_size, map_objects[jet_index].object_size, 0.0f))
             g_DeathByEnemy = true;
 
         // Testa se atingiu fogo. Se atingiu, morre
-        int fire_index = GetVectorObjectType(collided_objects, FIRE);
+        int fire_index = GetCollidedObjectType(collided_objects, FIRE);
         if (fire_index >= 0) {
-            map_objects.erase(map_objects.begin() + jet_index);
+            map_objects.erase(jet_index);
         }
     }
     // Se colidiu, recomputa direção
@@ -2146,8 +3756,8 @@ void MoveJet(int jet_index) {
 // Função de movimentação da bola de praia
 // Muito similar acima, mas possui algumas modificações e por isso
 //  não foi refatorada (direção, morte em água)
-void MoveBeachBall(int ball_index) {
-    vec4 target_pos = map_objects[ball_index].object_position;
+void MoveBeachBall(int ball_index, const NearbyObjects* nearby) {
+    vec4 target_pos = vec4(map_objects[ball_index].object_position, 1.0f);
 
     switch(map_objects[ball_index].direction) {
         case 0: {
@@ -2168,48 +3778,48 @@ void MoveBeachBall(int ball_index) {
         }
     }
 
-    vecInt collided_objects = GetObjectsCollidingWithObject(ball_index, target_pos);
+    CollisionQuery collided_objects;
+    GetObjectsCollidingWithObject(ball_index, target_pos, &collided_objects, nearby);
 
-    if (!vectorHasObjectBlockingObject(collided_objects)) {
-        map_objects[ball_index].object_position = target_pos;
+    if (!HasObjectBlockingObject(collided_objects)) {
+        map_objects[ball_index].object_position = vec3(target_pos);
 
         // Se colidiu com o player, mata ele
         vec3 player_size = vec3(0.0f, 0.6f, 0.0f);
-        if (BBoxCollision(player_position, target_pos, player_size, map_objects[ball_index].object_size, 0.0f))
+        if (BBoxCollision(vec3(player_position), vec3(target_pos), player_size, map_objects[ball_index].object_size, 0.0f))
             g_DeathByEnemy = true;
 
         // Testa se atingiu fogo ou água. Se atingiu, morre.
-        int hazard_index = GetVectorObjectType(collided_objects, vecInt(FIRE,WATER));
-        if (hazard_index >= 0) {
-            map_objects.erase(map_objects.begin() + ball_index);
+        if (GetCollidedObjectType(collided_objects, FIRE) >= 0 || GetCollidedObjectType(collided_objects, WATER) >= 0) {
+            map_objects.erase(ball_index);
         }
     }
     else map_objects[ball_index].direction = (map_objects[ball_index].direction + 2) % 4;
 }
 
 // Função de movimentação da bola de vôlei
-void MoveVolleyBall(int ball_index) {
-    vec4 target_pos = map_objects[ball_index].object_position;
+void MoveVolleyBall(int ball_index, const NearbyObjects* nearby) {
+    vec4 target_pos = vec4(map_objects[ball_index].object_position, 1.0f);
 
     // Ajuste da aceleração de gravidade para a bola
     target_pos.y -= map_objects[ball_index].gravity;
     if (map_objects[ball_index].gravity < 0.2f)
         map_objects[ball_index].gravity += 0.005f;
 
-    vecInt collided_objects = GetObjectsCollidingWithObject(ball_index, target_pos);
+    CollisionQuery collided_objects;
+    GetObjectsCollidingWithObject(ball_index, target_pos, &collided_objects, nearby);
 
-    if (!vectorHasVolleyballBlockingObject(collided_objects)) {
-        map_objects[ball_index].object_position = target_pos;
+    if (!HasVolleyballBlockingObject(collided_objects)) {
+        map_objects[ball_index].object_position = vec3(target_pos);
 
         // Se colidiu com o player, mata ele
         vec3 player_size = vec3(0.0f, 0.6f, 0.0f);
-        if (BBoxCollision(player_position, target_pos, player_size, map_objects[ball_index].object_size, 0.0f))
+        if (BBoxCollision(vec3(player_position), vec3(target_pos), player_size, map_objects[ball_index].object_size, 0.0f))
             g_DeathByEnemy = true;
 
         // Testa se atingiu fogo ou água. Se atingiu, morre.
-        int hazard_index = GetVectorObjectType(collided_objects, vecInt(FIRE,WATER));
-        if (hazard_index >= 0) {
-            map_objects.erase(map_objects.begin() + ball_index);
+        if (GetCollidedObjectType(collided_objects, FIRE) >= 0 || GetCollidedObjectType(collided_objects, WATER) >= 0) {
+            map_objects.erase(ball_index);
         }
     }
     else {
@@ -2223,24 +3833,6 @@ void MoveVolleyBall(int ball_index) {
 // AUXILIARES PARA DESENHO //
 /////////////////////////////
 
-// Função que pega a matriz M e guarda a mesma no topo da pilha
-void PushMatrix(glm::mat4 M) {
-    g_MatrixStack.push(M);
-}
-
-// Função que remove a matriz atualmente no topo da pilha e armazena a mesma na variável M
-void PopMatrix(glm::mat4& M) {
-    if ( g_MatrixStack.empty() )
-    {
-        M = Matrix_Identity();
-    }
-    else
-    {
-        M = g_MatrixStack.top();
-        g_MatrixStack.pop();
-    }
-}
-
 // Função que computa as normais de um ObjModel, caso elas não tenham sido
 // especificadas dentro do arquivo ".obj"
 void ComputeNormals(ObjModel* model) {
@@ -2305,18 +3897,21 @@ void ComputeNormals(ObjModel* model) {
 
 // Constrói triângulos para futura renderização a partir de um ObjModel.
 void BuildTrianglesAndAddToVirtualScene(ObjModel* model) {
-    GLuint vertex_array_object_id;
-    glGenVertexArrays(1, &vertex_array_object_id);
-    glBindVertexArray(vertex_array_object_id);
+    MeshData mesh;
+    BuildTriangles(model, &mesh);
+    UploadMeshAndAddToVirtualScene(&mesh);
+}
 
-    std::vector<GLuint> indices;
-    std::vector<float>  model_coefficients;
-    std::vector<float>  normal_coefficients;
-    std::vector<float>  texture_coefficients;
+// Gera os vértices, índices e LODs de um ObjModel. Não faz chamadas OpenGL,
+// podendo rodar em uma thread auxiliar.
+void BuildTriangles(ObjModel* model, MeshData* mesh) {
+    std::vector<GLuint>& indices = mesh->indices;
+    std::vector<float>&  vertices = mesh->vertices;
 
     for (size_t shape = 0; shape < model->shapes.size(); ++shape)
     {
         size_t first_index = indices.size();
+        size_t first_vertex = vertices.size() / MESH_VERTEX_FLOATS;
         size_t num_triangles = model->shapes[shape].mesh.num_face_vertices.size();
 
         const float minval = std::numeric_limits<float>::min();
@@ -2333,16 +3928,16 @@ void BuildTrianglesAndAddToVirtualScene(ObjModel* model) {
             {
                 tinyobj::index_t idx = model->shapes[shape].mesh.indices[3*triangle + vertex];
 
-                indices.push_back(first_index + 3*triangle + vertex);
+                indices.push_back(first_vertex + 3*triangle + vertex);
 
                 const float vx = model->attrib.vertices[3*idx.vertex_index + 0];
                 const float vy = model->attrib.vertices[3*idx.vertex_index + 1];
                 const float vz = model->attrib.vertices[3*idx.vertex_index + 2];
                 //printf("tri %d vert %d = (%.2f, %.2f, %.2f)\n", (int)triangle, (int)vertex, vx, vy, vz);
-                model_coefficients.push_back( vx ); // X
-                model_coefficients.push_back( vy ); // Y
-                model_coefficients.push_back( vz ); // Z
-                model_coefficients.push_back( 1.0f ); // W
+                vertices.push_back( vx ); // X
+                vertices.push_back( vy ); // Y
+                vertices.push_back( vz ); // Z
+                vertices.push_back( 1.0f ); // W
 
                 bbox_min.x = std::min(bbox_min.x, vx);
                 bbox_min.y = std::min(bbox_min.y, vy);
@@ -2351,91 +3946,519 @@ void BuildTrianglesAndAddToVirtualScene(ObjModel* model) {
                 bbox_max.y = std::max(bbox_max.y, vy);
                 bbox_max.z = std::max(bbox_max.z, vz);
 
-                if ( model->attrib.normals.size() >= (size_t)3*idx.normal_index )
+                // Todos os vértices têm normal e coordenadas de textura
+                // (zeradas, caso o modelo não as defina)
+                float nx = 0.0f, ny = 0.0f, nz = 0.0f;
+                if ( idx.normal_index >= 0 && model->attrib.normals.size() >= (size_t)3*idx.normal_index + 3 )
                 {
-                    const float nx = model->attrib.normals[3*idx.normal_index + 0];
-                    const float ny = model->attrib.normals[3*idx.normal_index + 1];
-                    const float nz = model->attrib.normals[3*idx.normal_index + 2];
-                    normal_coefficients.push_back( nx ); // X
-                    normal_coefficients.push_back( ny ); // Y
-                    normal_coefficients.push_back( nz ); // Z
-                    normal_coefficients.push_back( 0.0f ); // W
+                    nx = model->attrib.normals[3*idx.normal_index + 0];
+                    ny = model->attrib.normals[3*idx.normal_index + 1];
+                    nz = model->attrib.normals[3*idx.normal_index + 2];
                 }
+                vertices.push_back( nx ); // X
+                vertices.push_back( ny ); // Y
+                vertices.push_back( nz ); // Z
+                vertices.push_back( 0.0f ); // W
 
-                if ( model->attrib.texcoords.size() >= (size_t)2*idx.texcoord_index )
+                float u = 0.0f, v = 0.0f;
+                if ( idx.texcoord_index >= 0 && model->attrib.texcoords.size() >= (size_t)2*idx.texcoord_index + 2 )
                 {
-                    const float u = model->attrib.texcoords[2*idx.texcoord_index + 0];
-                    const float v = model->attrib.texcoords[2*idx.texcoord_index + 1];
-                    texture_coefficients.push_back( u );
-                    texture_coefficients.push_back( v );
+                    u = model->attrib.texcoords[2*idx.texcoord_index + 0];
+                    v = model->attrib.texcoords[2*idx.texcoord_index + 1];
                 }
+                vertices.push_back( u );
+                vertices.push_back( v );
             }
         }
 
+        // O OBJ repete os vértices em cada triângulo: unificamos os que têm
+        // a mesma posição, normal e coordenadas de textura
+        size_t num_corners = indices.size() - first_index;
+        size_t num_vertices = WeldVertices(vertices, MESH_VERTEX_FLOATS, first_vertex, indices, first_index) - first_vertex;
+
         size_t last_index = indices.size() - 1;
 
         SceneObject theobject;
         theobject.name           = model->shapes[shape].name;
-        theobject.first_index    = (void*)first_index; // Primeiro índice
+        theobject.first_index    = (void*)(first_index * sizeof(GLuint)); // Deslocamento do primeiro índice
         theobject.num_indices    = last_index - first_index + 1; // Número de indices
         theobject.rendering_mode = GL_TRIANGLES;       // Índices correspondem ao tipo de rasterização GL_TRIANGLES.
-        theobject.vertex_array_object_id = vertex_array_object_id;
+        theobject.vertex_array_object_id = 0;
 
         theobject.bbox_min = bbox_min;
         theobject.bbox_max = bbox_max;
 
-        g_VirtualScene[model->shapes[shape].name] = theobject;
+        // Níveis de detalhe: cada LOD tem cerca de metade dos triângulos do
+        // anterior e reaproveita os vértices já gerados acima.
+        theobject.num_lods = 1;
+        theobject.lod_first_index[0] = theobject.first_index;
+        theobject.lod_num_indices[0] = theobject.num_indices;
+
+        if (num_triangles >= LOD_MIN_TRIANGLES)
+        {
+            std::vector<GLuint> lod_indices(indices.begin() + first_index, indices.end());
+            while (theobject.num_lods < MAX_MESH_LODS)
+            {
+                std::vector<GLuint> simplified = SimplifyMesh(vertices.data(), MESH_VERTEX_FLOATS, lod_indices, lod_indices.size() / 2);
+                if (simplified.empty() || simplified.size() > lod_indices.size() * 3 / 4)
+                    break; // A malha não simplifica mais de forma útil
+
+                theobject.lod_first_index[theobject.num_lods] = (void*)(indices.size() * sizeof(GLuint));
+                theobject.lod_num_indices[theobject.num_lods] = simplified.size();
+                theobject.num_lods++;
+                indices.insert(indices.end(), simplified.begin(), simplified.end());
+                lod_indices.swap(simplified);
+            }
+            printf("  \"%s\": %d LODs (%d -> %d triângulos), %d -> %d vértices\n", theobject.name.c_str(), theobject.num_lods,
+                   theobject.lod_num_indices[0] / 3, theobject.lod_num_indices[theobject.num_lods - 1] / 3,
+                   (int)num_corners, (int)num_vertices);
+        }
+
+        mesh->objects.push_back(theobject);
     }
 
-    GLuint VBO_model_coefficients_id;
-    glGenBuffers(1, &VBO_model_coefficients_id);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO_model_coefficients_id);
-    glBufferData(GL_ARRAY_BUFFER, model_coefficients.size() * sizeof(float), NULL, GL_STATIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, model_coefficients.size() * sizeof(float), model_coefficients.data());
-    GLuint location = 0; // "(location = 0)" em "shader_vertex.glsl"
-    GLint  number_of_dimensions = 4; // vec4 em "shader_vertex.glsl"
-    glVertexAttribPointer(location, number_of_dimensions, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(location);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // Ordem dos triângulos de cada LOD favorável ao cache de vértices da GPU
+    for (size_t i = 0; i < mesh->objects.size(); ++i)
+    {
+        const SceneObject& theobject = mesh->objects[i];
+        for (int lod = 0; lod < theobject.num_lods; ++lod)
+        {
+            size_t first = (size_t)theobject.lod_first_index[lod] / sizeof(GLuint);
+            OptimizeVertexCache(&indices[first], theobject.lod_num_indices[lod], vertices.size() / MESH_VERTEX_FLOATS, VERTEX_CACHE_SIZE);
+        }
+    }
+
+    // Vértices na ordem em que o LOD 0 os usa, para leituras sequenciais do VBO
+    OptimizeVertexFetch(vertices, MESH_VERTEX_FLOATS, indices);
+
+    PackMeshVertices(mesh);
+
+    mesh->vertex_data = mesh->packed_vertices.data();
+    mesh->num_vertices = mesh->packed_vertices.size();
+    mesh->index_data = indices.data();
+    mesh->num_indices = indices.size();
+}
+
+// Converte um float para half float (IEEE 754 binário de 16 bits), com
+// arredondamento para o mais próximo. Valores fora do intervalo viram infinito.
+uint16_t FloatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (((bits >> 23) & 0xff) == 0xff) // Infinito ou NaN
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    if (exponent >= 31)
+        return sign | 0x7c00;
+    if (exponent <= 0) {
+        // Subnormal (ou zero) em half float
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1)
+            half++;
+        return sign | half;
+    }
+
+    uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000)
+        half++; // O carry pode passar para o expoente, o que também é correto
+    return half;
+}
+
+// Codifica uma normal unitária em dois inteiros de 16 bits com sinal,
+// projetando-a no octaedro |x|+|y|+|z| = 1 e desdobrando o hemisfério
+// inferior sobre o quadrado [-1,1]^2. Decodificada em "shader_vertex.glsl".
+void OctahedronEncode(float x, float y, float z, int16_t* out) {
+    float length = fabsf(x) + fabsf(y) + fabsf(z);
+    float u = 0.0f, v = 0.0f; // Normais nulas viram (0,0,1)
+    if (length > 0.0f) {
+        u = x / length;
+        v = y / length;
+        if (z < 0.0f) {
+            float fu = (1.0f - fabsf(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+            float fv = (1.0f - fabsf(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+            u = fu;
+            v = fv;
+        }
+    }
+    out[0] = (int16_t)lrintf(std::max(-1.0f, std::min(1.0f, u)) * 32767.0f);
+    out[1] = (int16_t)lrintf(std::max(-1.0f, std::min(1.0f, v)) * 32767.0f);
+}
+
+// Quantiza os vértices em ponto flutuante gerados por BuildTriangles() para
+// o formato PackedVertex. As posições são relativas à caixa envolvente de
+// todos os vértices da malha, que é registrada em cada objeto para o shader.
+void PackMeshVertices(MeshData* mesh) {
+    const std::vector<float>& vertices = mesh->vertices;
+    size_t num_vertices = vertices.size() / MESH_VERTEX_FLOATS;
+
+    vec3 position_min(0.0f, 0.0f, 0.0f);
+    vec3 position_max(0.0f, 0.0f, 0.0f);
+    for (size_t i = 0; i < num_vertices; ++i)
+    {
+        vec3 p = glm::make_vec3(&vertices[MESH_VERTEX_FLOATS * i]);
+        position_min = (i == 0) ? p : glm::min(position_min, p);
+        position_max = (i == 0) ? p : glm::max(position_max, p);
+    }
+    vec3 position_scale = position_max - position_min;
+
+    mesh->packed_vertices.resize(num_vertices);
+    for (size_t i = 0; i < num_vertices; ++i)
+    {
+        const float* vertex = &vertices[MESH_VERTEX_FLOATS * i];
+        PackedVertex& packed = mesh->packed_vertices[i];
 
-    if ( !normal_coefficients.empty() )
+        for (int k = 0; k < 3; ++k)
+        {
+            float t = position_scale[k] > 0.0f ? (vertex[k] - position_min[k]) / position_scale[k] : 0.0f;
+            packed.position[k] = (uint16_t)lrintf(std::max(0.0f, std::min(1.0f, t)) * 65535.0f);
+        }
+        packed.position[3] = 0;
+        OctahedronEncode(vertex[4], vertex[5], vertex[6], packed.normal);
+        packed.texcoords[0] = FloatToHalf(vertex[8]);
+        packed.texcoords[1] = FloatToHalf(vertex[9]);
+    }
+
+    for (size_t i = 0; i < mesh->objects.size(); ++i)
     {
-        GLuint VBO_normal_coefficients_id;
-        glGenBuffers(1, &VBO_normal_coefficients_id);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO_normal_coefficients_id);
-        glBufferData(GL_ARRAY_BUFFER, normal_coefficients.size() * sizeof(float), NULL, GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, normal_coefficients.size() * sizeof(float), normal_coefficients.data());
-        location = 1; // "(location = 1)" em "shader_vertex.glsl"
-        number_of_dimensions = 4; // vec4 em "shader_vertex.glsl"
-        glVertexAttribPointer(location, number_of_dimensions, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(location);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-    }
-
-    if ( !texture_coefficients.empty() )
+        mesh->objects[i].position_offset = position_min;
+        mesh->objects[i].position_scale = position_scale;
+    }
+
+    // Os vértices em ponto flutuante não são mais necessários
+    std::vector<float>().swap(mesh->vertices);
+}
+
+// Envia para a GPU uma malha gerada por BuildTriangles() e registra seus
+// objetos em g_VirtualScene. Deve ser chamada na thread do OpenGL.
+void UploadMeshAndAddToVirtualScene(MeshData* mesh) {
+    GLuint vertex_array_object_id;
+    glGenVertexArrays(1, &vertex_array_object_id);
+    glBindVertexArray(vertex_array_object_id);
+
+    for (size_t i = 0; i < mesh->objects.size(); ++i)
     {
-        GLuint VBO_texture_coefficients_id;
-        glGenBuffers(1, &VBO_texture_coefficients_id);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO_texture_coefficients_id);
-        glBufferData(GL_ARRAY_BUFFER, texture_coefficients.size() * sizeof(float), NULL, GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, texture_coefficients.size() * sizeof(float), texture_coefficients.data());
-        location = 2; // "(location = 2)" em "shader_vertex.glsl"
-        number_of_dimensions = 2; // vec2 em "shader_vertex.glsl"
-        glVertexAttribPointer(location, number_of_dimensions, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(location);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        SceneObject theobject = mesh->objects[i];
+        theobject.vertex_array_object_id = vertex_array_object_id;
+        g_VirtualScene[theobject.name] = theobject;
     }
 
+    GLuint VBO_vertices_id;
+    glGenBuffers(1, &VBO_vertices_id);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO_vertices_id);
+    glBufferData(GL_ARRAY_BUFFER, mesh->num_vertices * sizeof(PackedVertex), mesh->vertex_data, GL_STATIC_DRAW);
+    SetupMeshVertexAttributes();
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
     GLuint indices_id;
     glGenBuffers(1, &indices_id);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_id);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), NULL, GL_STATIC_DRAW);
-    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indices.size() * sizeof(GLuint), indices.data());
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->num_indices * sizeof(GLuint), mesh->index_data, GL_STATIC_DRAW);
     // glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0); // XXX Errado!
 
     glBindVertexArray(0);
 }
 
+// Define os atributos de vértice "(location = 0)", "(location = 1)" e
+// "(location = 2)" de "shader_vertex.glsl" a partir do GL_ARRAY_BUFFER atual,
+// que deve conter vértices no formato PackedVertex.
+void SetupMeshVertexAttributes() {
+    GLsizei stride = sizeof(PackedVertex);
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(PackedVertex, position));  // Posição quantizada (vec3 em [0,1])
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(PackedVertex, normal));             // Normal octaédrica (vec2 em [-1,1])
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(PackedVertex, texcoords));    // Coordenadas de textura (vec2)
+    glEnableVertexAttribArray(2);
+}
+
+// Carrega um modelo ".obj" a partir do seu cache binário, caso ele exista e
+// esteja atualizado. Caso contrário, lê o ".obj" e gera o cache para as
+// próximas execuções. Não faz chamadas OpenGL.
+std::shared_ptr<MeshData> LoadMesh(const string& filename) {
+    std::shared_ptr<MeshData> mesh = std::make_shared<MeshData>();
+    if (LoadMeshCache(filename, mesh.get()))
+        return mesh;
+
+    ObjModel model(filename.c_str());
+    ComputeNormals(&model);
+    BuildTriangles(&model, mesh.get());
+    SaveMeshCache(filename, *mesh);
+    return mesh;
+}
+
+// Mapeia em memória o cache binário de um modelo. Os vértices e índices não
+// são copiados: vertex_data e index_data apontam para dentro do arquivo (ou
+// do pacote de recursos). Retorna false caso o cache não exista, seja
+// inválido ou esteja desatualizado.
+bool LoadMeshCache(const string& filename, MeshData* mesh) {
+    string cachepath = filename + ".meshcache";
+    long long source_size = 0;
+    long long source_time = 0;
+    bool has_source = GetFileStamp(filename.c_str(), &source_size, &source_time);
+
+    // O ".obj" não é distribuído junto com o pacote. Se ele existir (durante
+    // o desenvolvimento), o cache do pacote só é usado se estiver atualizado.
+    const unsigned char* data;
+    size_t size;
+    if (FindPackedAsset(cachepath, &data, &size)) {
+        const MeshCacheHeader* header = (const MeshCacheHeader*)data;
+        if (IsMeshCacheValid(data, size)
+            && (!has_source || (header->source_size == source_size && header->source_time == source_time))) {
+            ReadMeshCache(data, mesh);
+            printf("Carregando modelo \"%s\"... OK (pacote).\n", filename.c_str());
+            return true;
+        }
+        fprintf(stderr, "WARNING: packed mesh cache \"%s\" is invalid or outdated; ignoring it.\n", cachepath.c_str());
+    }
+
+    if (!has_source)
+        return false;
+
+    if (!MapFile(cachepath.c_str(), &mesh->mapped))
+        return false;
+
+    const MeshCacheHeader* header = (const MeshCacheHeader*)mesh->mapped.data;
+    if (!IsMeshCacheValid(mesh->mapped.data, mesh->mapped.size)
+        || header->source_size != source_size
+        || header->source_time != source_time) {
+        UnmapFile(&mesh->mapped);
+        return false;
+    }
+
+    ReadMeshCache(mesh->mapped.data, mesh);
+    printf("Carregando modelo \"%s\"... OK (cache).\n", filename.c_str());
+    return true;
+}
+
+// Verifica a versão e os tamanhos de um cache binário de modelo, os trechos
+// do index buffer de cada LOD e os valores dos índices: um cache truncado ou
+// corrompido não pode levar a leituras fora dos buffers na GPU.
+bool IsMeshCacheValid(const unsigned char* data, size_t size) {
+    const MeshCacheHeader* header = (const MeshCacheHeader*)data;
+    if (size < sizeof(MeshCacheHeader)
+        || memcmp(header->magic, "CMSH", 4) != 0
+        || header->version != MESH_CACHE_VERSION
+        || header->vertex_size != sizeof(PackedVertex))
+        return false;
+
+    // Tamanhos comparados com o do arquivo antes das multiplicações, para
+    // que valores inválidos não causem overflow
+    size_t body_size = size - sizeof(MeshCacheHeader);
+    if (header->num_objects > body_size / sizeof(MeshCacheObject))
+        return false;
+    body_size -= header->num_objects * sizeof(MeshCacheObject);
+    if (header->num_vertices > body_size / sizeof(PackedVertex))
+        return false;
+    body_size -= (size_t)header->num_vertices * sizeof(PackedVertex);
+    if (header->num_indices > body_size / sizeof(GLuint) || body_size != (size_t)header->num_indices * sizeof(GLuint))
+        return false;
+
+    const MeshCacheObject* objects = (const MeshCacheObject*)(data + sizeof(MeshCacheHeader));
+    for (uint32_t i = 0; i < header->num_objects; ++i)
+    {
+        if (objects[i].num_lods < 1 || objects[i].num_lods > MAX_MESH_LODS)
+            return false;
+        for (uint32_t lod = 0; lod < objects[i].num_lods; ++lod)
+        {
+            uint32_t first = objects[i].lod_first_index[lod];
+            uint32_t count = objects[i].lod_num_indices[lod];
+            if (first > header->num_indices || count > header->num_indices - first || count % 3 != 0)
+                return false;
+        }
+    }
+
+    const GLuint* indices = (const GLuint*)(data + size - (size_t)header->num_indices * sizeof(GLuint));
+    GLuint max_index = 0;
+    for (uint32_t i = 0; i < header->num_indices; ++i)
+        max_index = std::max(max_index, indices[i]);
+    return header->num_indices == 0 || max_index < header->num_vertices;
+}
+
+// Preenche "mesh" a partir de um cache binário já verificado por
+// IsMeshCacheValid(). Os dados não são copiados.
+void ReadMeshCache(const unsigned char* data, MeshData* mesh) {
+    const MeshCacheHeader* header = (const MeshCacheHeader*)data;
+    size_t objects_offset = sizeof(MeshCacheHeader);
+    size_t vertices_offset = objects_offset + header->num_objects * sizeof(MeshCacheObject);
+    size_t indices_offset = vertices_offset + (size_t)header->num_vertices * sizeof(PackedVertex);
+
+    const MeshCacheObject* objects = (const MeshCacheObject*)(data + objects_offset);
+    for (uint32_t i = 0; i < header->num_objects; ++i)
+    {
+        const MeshCacheObject& cached = objects[i];
+
+        SceneObject theobject;
+        theobject.name           = string(cached.name, strnlen(cached.name, MESH_CACHE_NAME_SIZE));
+        theobject.rendering_mode = GL_TRIANGLES;
+        theobject.vertex_array_object_id = 0;
+        theobject.bbox_min = vec3(cached.bbox_min[0], cached.bbox_min[1], cached.bbox_min[2]);
+        theobject.bbox_max = vec3(cached.bbox_max[0], cached.bbox_max[1], cached.bbox_max[2]);
+        theobject.position_offset = glm::make_vec3(cached.position_offset);
+        theobject.position_scale = glm::make_vec3(cached.position_scale);
+        theobject.num_lods = std::min<uint32_t>(cached.num_lods, MAX_MESH_LODS);
+        for (int lod = 0; lod < theobject.num_lods; ++lod)
+        {
+            theobject.lod_first_index[lod] = (void*)(cached.lod_first_index[lod] * sizeof(GLuint));
+            theobject.lod_num_indices[lod] = cached.lod_num_indices[lod];
+        }
+        theobject.first_index = theobject.lod_first_index[0];
+        theobject.num_indices = theobject.lod_num_indices[0];
+        mesh->objects.push_back(theobject);
+    }
+
+    mesh->vertex_data = (const PackedVertex*)(data + vertices_offset);
+    mesh->num_vertices = header->num_vertices;
+    mesh->index_data = (const GLuint*)(data + indices_offset);
+    mesh->num_indices = header->num_indices;
+}
+
+// Grava o cache binário de um modelo gerado por BuildTriangles(). O arquivo
+// é escrito com outro nome e renomeado no final, para que uma execução
+// interrompida nunca deixe um cache incompleto.
+bool SaveMeshCache(const string& filename, const MeshData& mesh) {
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "CMSH", 4);
+    header.version = MESH_CACHE_VERSION;
+    header.vertex_size = sizeof(PackedVertex);
+    header.num_vertices = mesh.num_vertices;
+    header.num_indices = mesh.num_indices;
+    header.num_objects = mesh.objects.size();
+
+    long long source_size;
+    long long source_time;
+    if (!GetFileStamp(filename.c_str(), &source_size, &source_time))
+        return false;
+    header.source_size = source_size;
+    header.source_time = source_time;
+
+    std::vector<MeshCacheObject> objects(mesh.objects.size());
+    for (size_t i = 0; i < mesh.objects.size(); ++i)
+    {
+        const SceneObject& theobject = mesh.objects[i];
+        if (theobject.name.size() >= MESH_CACHE_NAME_SIZE)
+        {
+            fprintf(stderr, "WARNING: object name \"%s\" too long for the mesh cache.\n", theobject.name.c_str());
+            return false;
+        }
+
+        MeshCacheObject& cached = objects[i];
+        memset(&cached, 0, sizeof(cached));
+        memcpy(cached.name, theobject.name.c_str(), theobject.name.size());
+        for (int k = 0; k < 3; ++k)
+        {
+            cached.bbox_min[k] = theobject.bbox_min[k];
+            cached.bbox_max[k] = theobject.bbox_max[k];
+            cached.position_offset[k] = theobject.position_offset[k];
+            cached.position_scale[k] = theobject.position_scale[k];
+        }
+        cached.num_lods = theobject.num_lods;
+        for (int lod = 0; lod < theobject.num_lods; ++lod)
+        {
+            cached.lod_first_index[lod] = (size_t)theobject.lod_first_index[lod] / sizeof(GLuint);
+            cached.lod_num_indices[lod] = theobject.lod_num_indices[lod];
+        }
+    }
+
+    string cachepath = filename + ".meshcache";
+    string temppath = cachepath + ".tmp";
+    FILE* file = fopen(temppath.c_str(), "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "WARNING: cannot write mesh cache \"%s\".\n", cachepath.c_str());
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (!objects.empty())
+        ok = ok && fwrite(objects.data(), sizeof(MeshCacheObject), objects.size(), file) == objects.size();
+    ok = ok && fwrite(mesh.vertex_data, sizeof(PackedVertex), mesh.num_vertices, file) == mesh.num_vertices;
+    ok = ok && fwrite(mesh.index_data, sizeof(GLuint), mesh.num_indices, file) == mesh.num_indices;
+    ok = (fclose(file) == 0) && ok;
+
+    remove(cachepath.c_str());
+    if (!ok || rename(temppath.c_str(), cachepath.c_str()) != 0)
+    {
+        fprintf(stderr, "WARNING: cannot write mesh cache \"%s\".\n", cachepath.c_str());
+        remove(temppath.c_str());
+        return false;
+    }
+
+    printf("Cache do modelo \"%s\" gravado em \"%s\".\n", filename.c_str(), cachepath.c_str());
+    return true;
+}
+
+// Constrói o modelo do jogador: PLAYER_BONE_COUNT cópias do cubo em um único
+// VAO, onde cada vértice carrega o índice da sua parte no palette de matrizes
+// e o tipo da parte (PLAYER_HEAD, PLAYER_ARM, ...), usado para colorir.
+void BuildPlayerModelAndAddToVirtualScene(const MeshData* cubemesh) {
+    GLuint vertex_array_object_id;
+    glGenVertexArrays(1, &vertex_array_object_id);
+    glBindVertexArray(vertex_array_object_id);
+
+    std::vector<GLuint> indices;
+    std::vector<PackedVertex> vertices;
+    std::vector<GLint>  bone_coefficients;
+
+    const SceneObject& cube = cubemesh->objects[0];
+    size_t first_index = (size_t)cube.lod_first_index[0] / sizeof(GLuint);
+
+    for (int bone = 0; bone < PLAYER_BONE_COUNT; ++bone)
+    {
+        for (int i = 0; i < cube.lod_num_indices[0]; ++i)
+        {
+            indices.push_back(indices.size());
+            vertices.push_back(cubemesh->vertex_data[cubemesh->index_data[first_index + i]]);
+
+            bone_coefficients.push_back( bone );
+            bone_coefficients.push_back( g_PlayerBoneTypes[bone] );
+        }
+    }
+
+    SceneObject theobject;
+    theobject.name           = "player";
+    theobject.first_index    = (void*)0;
+    theobject.num_indices    = indices.size();
+    theobject.rendering_mode = GL_TRIANGLES;
+    theobject.vertex_array_object_id = vertex_array_object_id;
+    theobject.bbox_min = cube.bbox_min;
+    theobject.bbox_max = cube.bbox_max;
+    theobject.position_offset = cube.position_offset;
+    theobject.position_scale = cube.position_scale;
+    theobject.num_lods = 1;
+    theobject.lod_first_index[0] = theobject.first_index;
+    theobject.lod_num_indices[0] = theobject.num_indices;
+    g_VirtualScene["player"] = theobject;
+
+    GLuint VBO_vertices_id;
+    glGenBuffers(1, &VBO_vertices_id);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO_vertices_id);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(PackedVertex), vertices.data(), GL_STATIC_DRAW);
+    SetupMeshVertexAttributes();
+
+    GLuint VBO_bone_coefficients_id;
+    glGenBuffers(1, &VBO_bone_coefficients_id);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO_bone_coefficients_id);
+    glBufferData(GL_ARRAY_BUFFER, bone_coefficients.size() * sizeof(GLint), bone_coefficients.data(), GL_STATIC_DRAW);
+    glVertexAttribIPointer(3, 2, GL_INT, 0, 0); // "(location = 3)" em "shader_vertex.glsl"
+    glEnableVertexAttribArray(3);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    GLuint indices_id;
+    glGenBuffers(1, &indices_id);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_id);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+    glBindVertexArray(0);
+}
+
 ///////////////////////////
 // SISTEMA DE PARTÍCULAS //
 ///////////////////////////
@@ -2495,97 +4518,440 @@ void DrawParticles() {
 // CARREGAMENTOS //
 ///////////////////
 
-// Função que carrega um nível a partir de um arquivo (parser)
-Level LoadLevelFromFile(string filepath) {
+// Função que carrega um nível a partir de um arquivo (no formato texto ou
+// binário), do pacote de recursos (caso "use_pack") ou do disco (mapeado em
+// memória)
+Level LoadLevelFromFile(const string& filepath, bool use_pack) {
+    printf("Carregando nivel \"%s\"... ", filepath.c_str());
+
+    const unsigned char* data;
+    size_t size;
+    MappedFile mapped = {NULL, 0};
+    if (!use_pack || !FindPackedAsset(filepath, &data, &size)) {
+        if (!MapFile(filepath.c_str(), &mapped))
+            throw std::runtime_error("Erro ao abrir arquivo.");
+        data = mapped.data;
+        size = mapped.size;
+    }
+
     Level loaded_level;
+    try {
+        if (IsBinaryLevel(data, size))
+            loaded_level = ReadBinaryLevel(data, size, filepath);
+        else
+            loaded_level = ParseLevel((const char*)data, size, filepath);
+    }
+    catch (...) {
+        UnmapFile(&mapped);
+        throw;
+    }
+    UnmapFile(&mapped);
 
-    printf("Carregando nivel \"%s\"... ", filepath.c_str());
+    printf("OK!\n");
+    return loaded_level;
+}
+
+// Posição de leitura do parser de níveis
+struct LevelReader {
+    const char* cursor;
+    const char* end;
+    const char* line_start; // Início da linha atual, para o cálculo da coluna
+    int line;               // Linha atual (a partir de 1)
+    const string* filepath;
+};
+
+// Erro de leitura de um nível, com a linha e a coluna do caractere inválido
+void ThrowLevelError(const LevelReader& reader, const char* position, const string& message) {
+    throw std::runtime_error(*reader.filepath + ":" + std::to_string(reader.line) + ":"
+                             + std::to_string(position - reader.line_start + 1) + ": " + message);
+}
+
+void SkipLevelSpaces(LevelReader& reader) {
+    while (reader.cursor < reader.end && (*reader.cursor == ' ' || *reader.cursor == '\t'))
+        reader.cursor++;
+}
 
-    std::ifstream level_file;
-    level_file.open(filepath);
-    if (!level_file.is_open()) {
-        throw std::runtime_error("Erro ao abrir arquivo.");
+// Termina a linha atual: aceita apenas espaços até o fim da linha ("\n" ou
+// "\r\n") ou do arquivo
+void EndLevelLine(LevelReader& reader, const char* message) {
+    SkipLevelSpaces(reader);
+    if (reader.cursor < reader.end && *reader.cursor == '\r')
+        reader.cursor++;
+    if (reader.cursor < reader.end) {
+        if (*reader.cursor != '\n')
+            ThrowLevelError(reader, reader.cursor, message);
+        reader.cursor++;
     }
-    else {
-        try {
-            // Salva largura e altura na estrutura do nível.
-            string width, height, cow_no, time, theme;
-            getline(level_file, cow_no);
-            getline(level_file, time);
-            getline(level_file, theme);
-            getline(level_file, width);
-            getline(level_file, height);
-            loaded_level.cow_no = atoi(cow_no.c_str());
-            loaded_level.time = atoi(time.c_str());
-            loaded_level.theme = atoi(theme.c_str());
-            loaded_level.width = atoi(width.c_str());
-            loaded_level.height = atoi(height.c_str());
-
-            if (loaded_level.width < 0 || loaded_level.height < 0) {
-                throw std::runtime_error("arquivo inválido.");
-            }
+    reader.line++;
+    reader.line_start = reader.cursor;
+}
 
-            // Salva a planta do nível
-            int line=0, col=0;
-            while (line < loaded_level.height) {
-                string file_line;
-                getline(level_file, file_line);
-                std::vector<string> map_line;
-
-                while (col < loaded_level.width) {
-                    string tile;
-                    for(int tilesize = 0; tilesize < 2; tilesize++) {
-                        tile += file_line[col * 3 + tilesize];
-                    }
-                    map_line.push_back(tile);
-                    col++;
-                }
+// Lê uma linha do cabeçalho com um número inteiro não negativo
+int ReadLevelHeaderValue(LevelReader& reader, const char* name) {
+    SkipLevelSpaces(reader);
+    const char* start = reader.cursor;
+    long long value = 0;
+    while (reader.cursor < reader.end && *reader.cursor >= '0' && *reader.cursor <= '9') {
+        value = value * 10 + (*reader.cursor - '0');
+        if (value > std::numeric_limits<int>::max())
+            ThrowLevelError(reader, start, string("valor de ") + name + " muito grande.");
+        reader.cursor++;
+    }
+    if (reader.cursor == start)
+        ThrowLevelError(reader, start, string("esperado um número (") + name + ").");
+    EndLevelLine(reader, (string("caractere inválido após ") + name + ".").c_str());
+    return (int)value;
+}
 
-                loaded_level.plant.push_back(map_line);
+// Lê uma linha da planta: "width" códigos de dois caracteres separados por
+// espaços
+void ReadLevelTileLine(LevelReader& reader, int width, uint8_t* tiles) {
+    for (int col = 0; col < width; col++) {
+        const char* separator = reader.cursor;
+        SkipLevelSpaces(reader);
+
+        const char* tile = reader.cursor;
+        bool line_ended = reader.end - tile < 2 || tile[0] == '\r' || tile[0] == '\n' || tile[1] == '\r' || tile[1] == '\n';
+        if (line_ended)
+            ThrowLevelError(reader, tile, "linha com " + std::to_string(col) + " tiles, esperados "
+                                          + std::to_string(width) + ".");
+        if (col > 0 && tile == separator)
+            ThrowLevelError(reader, tile, "esperado espaço entre os tiles.");
+
+        tiles[col] = TileCodeFromChars(tile[0], tile[1]);
+        if (tiles[col] == TILE_UNKNOWN)
+            ThrowLevelError(reader, tile, "tile desconhecido \"" + string(tile, 2) + "\".");
+        reader.cursor += 2;
+    }
+    EndLevelLine(reader, ("linha com mais de " + std::to_string(width) + " tiles.").c_str());
+}
 
-                // Reseta variáveis para a próxima iteração
-                col = 0;
-                map_line.clear();
+// Lê um nível em memória. Formato: cinco linhas de cabeçalho (vacas, tempo,
+// tema, largura e altura), seguidas de "altura" linhas da planta. Entradas
+// inválidas geram um erro com a linha e a coluna do problema.
+Level ParseLevel(const char* text, size_t size, const string& filepath) {
+    LevelReader reader = {text, text + size, text, 1, &filepath};
+
+    Level level;
+    level.cow_no = ReadLevelHeaderValue(reader, "vacas");
+    level.time = ReadLevelHeaderValue(reader, "tempo");
+    level.theme = ReadLevelHeaderValue(reader, "tema");
+    level.width = ReadLevelHeaderValue(reader, "largura");
+    level.height = ReadLevelHeaderValue(reader, "altura");
+
+    // Cada tile ocupa ao menos dois caracteres: tamanhos maiores que o
+    // arquivo são rejeitados antes de alocar a planta
+    size_t tile_count = (size_t)level.width * level.height;
+    if (level.width == 0 || level.height == 0 || tile_count > (size_t)(reader.end - reader.cursor) / 2)
+        ThrowLevelError(reader, reader.cursor, "tamanho " + std::to_string(level.width) + "x"
+                                                + std::to_string(level.height) + " inválido.");
+
+    level.tiles.resize(tile_count);
+    for (int line = 0; line < level.height; line++) {
+        if (reader.cursor == reader.end)
+            ThrowLevelError(reader, reader.cursor, "arquivo com " + std::to_string(line) + " linhas de tiles, esperadas "
+                                                    + std::to_string(level.height) + ".");
+        ReadLevelTileLine(reader, level.width, &level.tiles[(size_t)line * level.width]);
+    }
 
-                line++;
-            }
+    // Depois da planta, são aceitas apenas linhas em branco
+    while (reader.cursor < reader.end)
+        EndLevelLine(reader, "conteúdo após a última linha da planta.");
 
-            printf("OK!\n");
-            level_file.close();
-            return loaded_level;
-        }
-        catch (...) {
-            throw std::runtime_error("arquivo inválido.");
+    return level;
+}
+
+uint32_t ReadLittleEndian32(const unsigned char* data) {
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+void WriteLittleEndian32(unsigned char* data, uint32_t value) {
+    for (int i = 0; i < 4; i++)
+        data[i] = (value >> (8 * i)) & 0xff;
+}
+
+// FNV-1a (32 bits) de um nível binário, sem o campo do checksum (os últimos
+// 4 bytes do cabeçalho)
+uint32_t ChecksumBinaryLevel(const unsigned char* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        if (i == BINARY_LEVEL_HEADER_SIZE - 4)
+            i = BINARY_LEVEL_HEADER_SIZE;
+        if (i < size)
+            hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+bool IsBinaryLevel(const unsigned char* data, size_t size) {
+    return size >= 4 && memcmp(data, "CLVL", 4) == 0;
+}
+
+// Lê um nível binário em memória, verificando o checksum e os valores
+Level ReadBinaryLevel(const unsigned char* data, size_t size, const string& filepath) {
+    if (size < BINARY_LEVEL_HEADER_SIZE)
+        throw std::runtime_error(filepath + ": nível binário truncado.");
+    if (ReadLittleEndian32(data + 4) != LEVEL_FORMAT_VERSION)
+        throw std::runtime_error(filepath + ": versão " + std::to_string(ReadLittleEndian32(data + 4))
+                                 + " do nível binário não suportada.");
+
+    uint32_t header[7];
+    for (int i = 0; i < 7; i++)
+        header[i] = ReadLittleEndian32(data + 8 + 4 * i);
+    uint32_t width = header[3], height = header[4], num_entities = header[5];
+    uint32_t checksum = header[6];
+
+    // Tamanhos comparados com o do arquivo antes das multiplicações, para
+    // que valores inválidos não causem overflow
+    size_t body_size = size - BINARY_LEVEL_HEADER_SIZE;
+    bool valid_size = width >= 1 && height >= 1 && width <= (uint32_t)std::numeric_limits<int>::max()
+                   && height <= body_size / width && num_entities <= body_size / BINARY_LEVEL_ENTITY_SIZE
+                   && body_size == (size_t)width * height + (size_t)num_entities * BINARY_LEVEL_ENTITY_SIZE;
+    if (!valid_size)
+        throw std::runtime_error(filepath + ": tamanho do nível binário inválido.");
+    if (ChecksumBinaryLevel(data, size) != checksum)
+        throw std::runtime_error(filepath + ": checksum do nível binário inválido.");
+
+    Level level;
+    level.cow_no = header[0];
+    level.time = header[1];
+    level.theme = header[2];
+    level.width = width;
+    level.height = height;
+
+    const unsigned char* tiles = data + BINARY_LEVEL_HEADER_SIZE;
+    level.tiles.assign(tiles, tiles + (size_t)width * height);
+    for (size_t i = 0; i < level.tiles.size(); i++) {
+        if (level.tiles[i] == TILE_UNKNOWN || level.tiles[i] >= TILE_COUNT)
+            throw std::runtime_error(filepath + ": código de tile " + std::to_string(level.tiles[i])
+                                     + " inválido na linha " + std::to_string(i / width + 1)
+                                     + ", coluna " + std::to_string(i % width + 1) + ".");
+    }
+
+    const unsigned char* entities = tiles + level.tiles.size();
+    level.entities.resize(num_entities);
+    for (uint32_t i = 0; i < num_entities; i++) {
+        const unsigned char* entry = entities + (size_t)i * BINARY_LEVEL_ENTITY_SIZE;
+        LevelEntity& entity = level.entities[i];
+        uint32_t tile = ReadLittleEndian32(entry);
+        uint32_t direction = ReadLittleEndian32(entry + 4);
+        uint32_t gravity = ReadLittleEndian32(entry + 8);
+        memcpy(&entity.gravity, &gravity, sizeof(float));
+        if (tile >= level.tiles.size() || direction > 3 || (i > 0 && (int)tile <= level.entities[i - 1].tile))
+            throw std::runtime_error(filepath + ": entidade " + std::to_string(i) + " inválida.");
+        entity.tile = tile;
+        entity.direction = direction;
+    }
+
+    return level;
+}
+
+// Grava um nível no formato binário. O arquivo é escrito com outro nome e
+// renomeado no final.
+bool SaveBinaryLevel(const string& filename, const Level& level) {
+    size_t tiles_size = level.tiles.size();
+    std::vector<unsigned char> data(BINARY_LEVEL_HEADER_SIZE + tiles_size + level.entities.size() * BINARY_LEVEL_ENTITY_SIZE);
+
+    memcpy(&data[0], "CLVL", 4);
+    uint32_t header[8] = {LEVEL_FORMAT_VERSION, (uint32_t)level.cow_no, (uint32_t)level.time, (uint32_t)level.theme,
+                          (uint32_t)level.width, (uint32_t)level.height, (uint32_t)level.entities.size(), 0};
+    for (int i = 0; i < 8; i++)
+        WriteLittleEndian32(&data[4 + 4 * i], header[i]);
+
+    memcpy(&data[BINARY_LEVEL_HEADER_SIZE], level.tiles.data(), tiles_size);
+    for (size_t i = 0; i < level.entities.size(); i++) {
+        unsigned char* entry = &data[BINARY_LEVEL_HEADER_SIZE + tiles_size + i * BINARY_LEVEL_ENTITY_SIZE];
+        uint32_t gravity;
+        memcpy(&gravity, &level.entities[i].gravity, sizeof(float));
+        WriteLittleEndian32(entry, level.entities[i].tile);
+        WriteLittleEndian32(entry + 4, level.entities[i].direction);
+        WriteLittleEndian32(entry + 8, gravity);
+    }
+    WriteLittleEndian32(&data[BINARY_LEVEL_HEADER_SIZE - 4], ChecksumBinaryLevel(data.data(), data.size()));
+
+    string temppath = filename + ".tmp";
+    FILE* file = fopen(temppath.c_str(), "wb");
+    bool ok = file != NULL && fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = file != NULL && fclose(file) == 0 && ok;
+
+    remove(filename.c_str());
+    if (!ok || rename(temppath.c_str(), filename.c_str()) != 0) {
+        fprintf(stderr, "ERROR: cannot write level \"%s\".\n", filename.c_str());
+        remove(temppath.c_str());
+        return false;
+    }
+
+    printf("Nível binário \"%s\" gravado (%dx%d, %lu entidades).\n", filename.c_str(), level.width, level.height, (unsigned long)level.entities.size());
+    return true;
+}
+
+// Grava um nível no formato texto. As entidades, que só existem no formato
+// binário, são descartadas.
+bool SaveTextLevel(const string& filename, const Level& level) {
+    string text = std::to_string(level.cow_no) + "\n" + std::to_string(level.time) + "\n" + std::to_string(level.theme) + "\n"
+                + std::to_string(level.width) + "\n" + std::to_string(level.height) + "\n";
+    text.reserve(text.size() + level.tiles.size() * 3);
+    for (int line = 0; line < level.height; line++) {
+        for (int col = 0; col < level.width; col++) {
+            if (col > 0)
+                text += ' ';
+            text += TILE_NAMES[level.tiles[(size_t)line * level.width + col]];
         }
+        text += '\n';
+    }
+
+    string temppath = filename + ".tmp";
+    FILE* file = fopen(temppath.c_str(), "wb");
+    bool ok = file != NULL && fwrite(text.data(), 1, text.size(), file) == text.size();
+    ok = file != NULL && fclose(file) == 0 && ok;
+
+    remove(filename.c_str());
+    if (!ok || rename(temppath.c_str(), filename.c_str()) != 0) {
+        fprintf(stderr, "ERROR: cannot write level \"%s\".\n", filename.c_str());
+        remove(temppath.c_str());
+        return false;
     }
+
+    printf("Nível \"%s\" gravado (%dx%d).\n", filename.c_str(), level.width, level.height);
+    return true;
 }
 
-// Função que carrega uma imagem para ser utilizada como textura
-void LoadTextureImage(const char* filename) {
-    printf("Carregando imagem \"%s\"... ", filename);
+// Lê (do pacote de recursos ou do disco) e decodifica uma imagem, sem
+// chamadas OpenGL. A inversão
+// vertical é feita aqui, e não pelo stb_image, porque a opção
+// stbi_set_flip_vertically_on_load() é global e as imagens são decodificadas
+// em paralelo.
+DecodedImage DecodeImage(const char* filename, bool flip_vertically) {
+    DecodedImage image;
+    image.filename = filename;
 
-    // Primeiro fazemos a leitura da imagem do disco
-    stbi_set_flip_vertically_on_load(true);
-    int width;
-    int height;
     int channels;
-    unsigned char *data = stbi_load(filename, &width, &height, &channels, 3);
+    const unsigned char* packed;
+    size_t packed_size;
+    if (FindPackedAsset(filename, &packed, &packed_size))
+        image.data = stbi_load_from_memory(packed, packed_size, &image.width, &image.height, &channels, 3);
+    else
+        image.data = stbi_load(filename, &image.width, &image.height, &channels, 3);
 
-    if ( data == NULL )
+    if ( image.data == NULL )
     {
         fprintf(stderr, "ERROR: Cannot open image file \"%s\".\n", filename);
-        std::exit(EXIT_FAILURE);
+        throw std::runtime_error("Erro ao carregar imagem.");
+    }
+
+    if (flip_vertically) {
+        size_t row_size = 3 * image.width;
+        std::vector<unsigned char> row(row_size);
+        for (int y = 0; y < image.height / 2; y++) {
+            unsigned char* top = image.data + y * row_size;
+            unsigned char* bottom = image.data + (image.height - 1 - y) * row_size;
+            std::copy(top, top + row_size, row.begin());
+            std::copy(bottom, bottom + row_size, top);
+            std::copy(row.begin(), row.end(), bottom);
+        }
+    }
+
+    printf("Carregando imagem \"%s\"... OK (%dx%d).\n", filename, image.width, image.height);
+    return image;
+}
+
+// Imagens dos materiais dos tiles: "textures.png" dividida em
+// TILE_ATLAS_COLUMNS x TILE_ATLAS_ROWS camadas (veja TILE_LAYER() e o
+// material de cada tipo em OBJECT_TYPE_TABLE)
+TextureArraySource TileTextureSource() {
+    TextureArraySource source;
+    source.name = "../../data/textures/textures.png";
+    source.files.push_back(source.name);
+    source.columns = TILE_ATLAS_COLUMNS;
+    source.rows = TILE_ATLAS_ROWS;
+    return source;
+}
+
+// Quadros da animação da água, um arquivo por camada
+TextureArraySource WaterTextureSource() {
+    TextureArraySource source;
+    source.name = "../../data/textures/animated/water";
+    for (int frame = 1; frame <= WATER_FRAMES; frame++)
+        source.files.push_back(source.name + std::to_string(frame) + ".png");
+    source.columns = 1;
+    source.rows = 1;
+    return source;
+}
+
+// Soma dos tamanhos e data de modificação mais recente dos arquivos de uma
+// TextureArraySource. Retorna false caso algum deles não exista.
+bool GetTextureArrayStamp(const TextureArraySource& source, long long* size, long long* time) {
+    *size = 0;
+    *time = 0;
+    for (size_t i = 0; i < source.files.size(); ++i)
+    {
+        long long file_size, file_time;
+        if (!GetFileStamp(source.files[i].c_str(), &file_size, &file_time))
+            return false;
+        *size += file_size;
+        *time = std::max(*time, file_time);
     }
+    return true;
+}
 
-    printf("OK (%dx%d).\n", width, height);
+// Decodifica as imagens de uma TextureArraySource e separa as suas células
+// em camadas (sem chamadas OpenGL). Todas as camadas devem ter o mesmo
+// tamanho.
+DecodedLayers DecodeTextureArray(const TextureArraySource& source) {
+    DecodedLayers layers;
+    layers.name = source.name;
+    layers.width = 0;
+    layers.height = 0;
+    layers.count = source.files.size() * source.columns * source.rows;
+    GetTextureArrayStamp(source, &layers.source_size, &layers.source_time);
+
+    for (size_t i = 0; i < source.files.size(); ++i)
+    {
+        DecodedImage image = DecodeImage(source.files[i].c_str(), true);
+        int width = image.width / source.columns;
+        int height = image.height / source.rows;
+        if (i == 0) {
+            layers.width = width;
+            layers.height = height;
+            layers.pixels.resize((size_t)width * height * 3 * layers.count);
+        }
+        if (width != layers.width || height != layers.height || width == 0 || height == 0) {
+            stbi_image_free(image.data);
+            fprintf(stderr, "ERROR: layer size mismatch in \"%s\".\n", image.filename.c_str());
+            throw std::runtime_error("Erro ao carregar imagem.");
+        }
+
+        size_t layer_size = (size_t)width * height * 3;
+        for (int row = 0; row < source.rows; row++)
+        {
+            for (int column = 0; column < source.columns; column++)
+            {
+                size_t layer = (i * source.rows + row) * source.columns + column;
+                unsigned char* destination = &layers.pixels[layer * layer_size];
+                for (int y = 0; y < height; y++)
+                {
+                    const unsigned char* line = image.data + 3 * ((size_t)(row * height + y) * image.width + column * width);
+                    memcpy(destination + 3 * (size_t)y * width, line, 3 * width);
+                }
+            }
+        }
+        stbi_image_free(image.data);
+    }
+    return layers;
+}
 
+// Função que envia camadas decodificadas para a GPU, sem compressão, como
+// um GL_TEXTURE_2D_ARRAY na unidade "textureunit".
+GpuTexture UploadTextureArray(const DecodedLayers& layers, GLuint textureunit) {
     // Agora criamos objetos na GPU com OpenGL para armazenar a textura
     GLuint texture_id;
     GLuint sampler_id;
     glGenTextures(1, &texture_id);
     glGenSamplers(1, &sampler_id);
 
-    // Veja slide 160 do documento "Aula_20_e_21_Mapeamento_de_Texturas.pdf"
+    // Veja slide 160 do documento "Aula_20_e_21_Mapeamento_de_Texturas.pdf".
+    // Como cada material é uma camada separada, os mipmaps não misturam
+    // materiais vizinhos.
     glSamplerParameteri(sampler_id, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glSamplerParameteri(sampler_id, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
@@ -2593,36 +4959,541 @@ void LoadTextureImage(const char* filename) {
     glSamplerParameteri(sampler_id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glSamplerParameteri(sampler_id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    // Agora enviamos a imagem lida do disco para a GPU
+    // Agora enviamos as camadas para a GPU
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
     glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
     glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
 
-    GLuint textureunit = g_NumLoadedTextures;
     glActiveTexture(GL_TEXTURE0 + textureunit);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_SRGB8, layers.width, layers.height, layers.count, 0, GL_RGB, GL_UNSIGNED_BYTE, layers.pixels.data());
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
     glBindSampler(textureunit, sampler_id);
 
-    stbi_image_free(data);
-
-    g_NumLoadedTextures += 1;
+    GpuTexture texture = {texture_id, sampler_id, (size_t)layers.width * layers.height * layers.count * 4 * 4 / 3};
+    return texture;
 }
 
-// Função que carrega os shaders de vértices e de fragmentos que serão
-// utilizados para renderização.
-void LoadShadersFromFiles() {
-    vertex_shader_id = LoadShader_Vertex("../../src/shader_vertex.glsl");
-    fragment_shader_id = LoadShader_Fragment("../../src/shader_fragment.glsl");
-
-    // Deletamos o programa de GPU anterior, caso ele exista.
-    if ( program_id != 0 )
-        glDeleteProgram(program_id);
-
-    // Criamos um programa de GPU utilizando os shaders carregados acima.
-    program_id = CreateGpuProgram(vertex_shader_id, fragment_shader_id);
+// Função que envia as seis faces de uma skybox para a GPU como um
+// GL_TEXTURE_CUBE_MAP. Libera as imagens da memória.
+GpuTexture UploadCubemapTexture(const DecodedImage faces[6]) {
+    GLuint texture_id;
+    GLuint sampler_id;
+    glGenTextures(1, &texture_id);
+    glGenSamplers(1, &sampler_id);
+
+    glSamplerParameteri(sampler_id, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(sampler_id, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(sampler_id, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(sampler_id, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glSamplerParameteri(sampler_id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glActiveTexture(GL_TEXTURE0 + SKYBOX_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture_id);
+
+    size_t bytes = 0;
+    for (int face = 0; face < 6; face++) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_SRGB8, faces[face].width, faces[face].height, 0, GL_RGB, GL_UNSIGNED_BYTE, faces[face].data);
+        stbi_image_free(faces[face].data);
+        bytes += (size_t)faces[face].width * faces[face].height * 4;
+    }
+
+    glBindSampler(SKYBOX_TEXTURE_UNIT, sampler_id);
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+    GpuTexture texture = {texture_id, sampler_id, bytes};
+    return texture;
+}
+
+// Lê a textura comprimida de uma TextureArraySource a partir do seu cache,
+// caso ele exista e esteja atualizado. Caso contrário, decodifica as
+// imagens, gera e comprime os mipmaps e grava o cache para as próximas
+// execuções. Não faz chamadas OpenGL.
+std::shared_ptr<TextureData> LoadCompressedTexture(const TextureArraySource& source) {
+    std::shared_ptr<TextureData> texture = std::make_shared<TextureData>();
+    if (LoadTextureCache(source, texture.get()))
+        return texture;
+
+    BuildCompressedTexture(DecodeTextureArray(source), texture.get());
+    SaveTextureCache(*texture);
+    return texture;
+}
+
+// Mapeia em memória o cache de uma textura comprimida (ou o encontra no
+// pacote de recursos). Retorna false caso o cache não exista, seja inválido
+// ou esteja desatualizado.
+bool LoadTextureCache(const TextureArraySource& source, TextureData* texture) {
+    string cachepath = source.name + ".texcache";
+    long long source_size = 0;
+    long long source_time = 0;
+    bool has_source = GetTextureArrayStamp(source, &source_size, &source_time);
+
+    // As imagens de origem não são distribuídas junto com o pacote. Se elas
+    // existirem, o cache do pacote só é usado se estiver atualizado.
+    const unsigned char* data;
+    size_t size;
+    bool packed = FindPackedAsset(cachepath, &data, &size);
+    if (packed) {
+        const TextureCacheHeader* header = (const TextureCacheHeader*)data;
+        if (!IsTextureCacheValid(data, size, source)
+            || (has_source && (header->source_size != source_size || header->source_time != source_time))) {
+            fprintf(stderr, "WARNING: packed texture cache \"%s\" is invalid or outdated; ignoring it.\n", cachepath.c_str());
+            packed = false;
+        }
+    }
+    if (!packed) {
+        if (!has_source)
+            return false;
+
+        if (!MapFile(cachepath.c_str(), &texture->mapped))
+            return false;
+
+        data = texture->mapped.data;
+        size = texture->mapped.size;
+        const TextureCacheHeader* header = (const TextureCacheHeader*)data;
+        if (!IsTextureCacheValid(data, size, source)
+            || header->source_size != source_size
+            || header->source_time != source_time) {
+            UnmapFile(&texture->mapped);
+            return false;
+        }
+    }
+
+    texture->filename = source.name;
+    texture->data = data;
+    texture->size = size;
+
+    const TextureCacheHeader* header = (const TextureCacheHeader*)data;
+    printf("Carregando imagem \"%s\"... OK (cache, %u camadas de %ux%u).\n", source.name.c_str(), header->num_layers, header->width, header->height);
+    return true;
+}
+
+// Verifica a versão, o formato, o número de camadas e os tamanhos dos níveis
+// de um cache de textura comprimida. As dimensões de cada nível devem seguir
+// as do nível 0, e os tamanhos são comparados com o do arquivo antes das
+// multiplicações, para que valores inválidos não causem overflow.
+bool IsTextureCacheValid(const unsigned char* data, size_t size, const TextureArraySource& source) {
+    const TextureCacheHeader* header = (const TextureCacheHeader*)data;
+    if (size < sizeof(TextureCacheHeader)
+        || memcmp(header->magic, "CTEX", 4) != 0
+        || header->version != TEXTURE_CACHE_VERSION
+        || header->format != GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+        || header->num_layers < 1
+        || header->num_layers != source.files.size() * source.columns * source.rows
+        || header->width < 1 || header->height < 1
+        || header->num_levels < 1 || header->num_levels > MAX_TEXTURE_LEVELS
+        || size < sizeof(TextureCacheHeader) + header->num_levels * sizeof(TextureCacheLevel))
+        return false;
+
+    size_t data_offset = sizeof(TextureCacheHeader) + header->num_levels * sizeof(TextureCacheLevel);
+    const TextureCacheLevel* levels = (const TextureCacheLevel*)(data + sizeof(TextureCacheHeader));
+    for (uint32_t level = 0; level < header->num_levels; ++level)
+    {
+        uint32_t width = std::max(1u, header->width >> level);
+        uint32_t height = std::max(1u, header->height >> level);
+        if (levels[level].width != width || levels[level].height != height)
+            return false;
+
+        // Blocos 4x4 de 8 bytes (BC1) por camada
+        size_t blocks_x = ((size_t)width + 3) / 4;
+        size_t blocks_y = ((size_t)height + 3) / 4;
+        if (blocks_x > size / 8 / blocks_y / header->num_layers)
+            return false;
+        size_t level_size = blocks_x * blocks_y * 8 * header->num_layers;
+        if (levels[level].size != level_size
+            || levels[level].offset < data_offset
+            || levels[level].offset > size
+            || level_size > size - levels[level].offset)
+            return false;
+    }
+    return true;
+}
+
+// Gera os níveis de mipmap de cada camada decodificada, comprime cada um em
+// BC1 e monta em memória o conteúdo do arquivo de cache.
+void BuildCompressedTexture(const DecodedLayers& layers, TextureData* texture) {
+    int num_levels = 1;
+    while (num_levels < MAX_TEXTURE_LEVELS && ((layers.width >> num_levels) > 0 || (layers.height >> num_levels) > 0))
+        num_levels++;
+
+    TextureCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "CTEX", 4);
+    header.version = TEXTURE_CACHE_VERSION;
+    header.source_size = layers.source_size;
+    header.source_time = layers.source_time;
+    header.format = GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+    header.width = layers.width;
+    header.height = layers.height;
+    header.num_levels = num_levels;
+    header.num_layers = layers.count;
+
+    std::vector<TextureCacheLevel> levels(num_levels);
+    size_t offset = sizeof(TextureCacheHeader) + num_levels * sizeof(TextureCacheLevel);
+    for (int level = 0; level < num_levels; ++level)
+    {
+        levels[level].width = std::max(1, layers.width >> level);
+        levels[level].height = std::max(1, layers.height >> level);
+        levels[level].offset = offset;
+        levels[level].size = layers.count * CompressedSizeBC1(levels[level].width, levels[level].height);
+        offset += levels[level].size;
+    }
+
+    std::vector<unsigned char>& buffer = texture->buffer;
+    buffer.resize(offset);
+    memcpy(&buffer[0], &header, sizeof(header));
+    memcpy(&buffer[sizeof(header)], levels.data(), num_levels * sizeof(TextureCacheLevel));
+
+    // Cada nível de uma camada é reduzido a partir do anterior, já
+    // descomprimido
+    size_t layer_size = (size_t)layers.width * layers.height * 3;
+    std::vector<unsigned char> pixels;
+    std::vector<unsigned char> next;
+    for (int layer = 0; layer < layers.count; ++layer)
+    {
+        pixels.assign(layers.pixels.begin() + layer * layer_size, layers.pixels.begin() + (layer + 1) * layer_size);
+        for (int level = 0; level < num_levels; ++level)
+        {
+            int width = levels[level].width;
+            int height = levels[level].height;
+            CompressImageBC1(pixels.data(), width, height, &buffer[levels[level].offset + layer * CompressedSizeBC1(width, height)]);
+
+            if (level + 1 < num_levels)
+            {
+                next.resize((size_t)levels[level + 1].width * levels[level + 1].height * 3);
+                DownsampleImageSrgb(pixels.data(), width, height, next.data());
+                pixels.swap(next);
+            }
+        }
+    }
+
+    texture->filename = layers.name;
+    texture->data = buffer.data();
+    texture->size = buffer.size();
+}
+
+// Grava o cache de uma textura comprimida, com a mesma estratégia de
+// SaveMeshCache() (arquivo temporário renomeado no final).
+bool SaveTextureCache(const TextureData& texture) {
+    string cachepath = texture.filename + ".texcache";
+    string temppath = cachepath + ".tmp";
+    FILE* file = fopen(temppath.c_str(), "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "WARNING: cannot write texture cache \"%s\".\n", cachepath.c_str());
+        return false;
+    }
+
+    bool ok = fwrite(texture.data, 1, texture.size, file) == texture.size;
+    ok = (fclose(file) == 0) && ok;
+
+    remove(cachepath.c_str());
+    if (!ok || rename(temppath.c_str(), cachepath.c_str()) != 0)
+    {
+        fprintf(stderr, "WARNING: cannot write texture cache \"%s\".\n", cachepath.c_str());
+        remove(temppath.c_str());
+        return false;
+    }
+
+    printf("Cache da imagem \"%s\" gravado em \"%s\".\n", texture.filename.c_str(), cachepath.c_str());
+    return true;
+}
+
+// Envia uma textura comprimida para a GPU como um GL_TEXTURE_2D_ARRAY, nível
+// de mipmap por nível (todas as camadas de uma vez), para ser utilizada na
+// unidade "textureunit".
+GpuTexture UploadCompressedTexture(const TextureData& texture, GLuint textureunit) {
+    const TextureCacheHeader* header = (const TextureCacheHeader*)texture.data;
+    const TextureCacheLevel* levels = (const TextureCacheLevel*)(texture.data + sizeof(TextureCacheHeader));
+
+    GLuint texture_id;
+    GLuint sampler_id;
+    glGenTextures(1, &texture_id);
+    glGenSamplers(1, &sampler_id);
+
+    // Mesmos parâmetros de amostragem de UploadTextureArray()
+    glSamplerParameteri(sampler_id, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(sampler_id, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(sampler_id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glSamplerParameteri(sampler_id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glActiveTexture(GL_TEXTURE0 + textureunit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, header->num_levels - 1);
+
+    size_t bytes = 0;
+    for (uint32_t level = 0; level < header->num_levels; ++level)
+    {
+        glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, header->format, levels[level].width, levels[level].height,
+                               header->num_layers, 0, levels[level].size, texture.data + levels[level].offset);
+        bytes += levels[level].size;
+    }
+    glBindSampler(textureunit, sampler_id);
+
+    GpuTexture gputexture = {texture_id, sampler_id, bytes};
+    return gputexture;
+}
+
+// Verifica se o contexto OpenGL atual suporta a extensão dada
+bool IsExtensionSupported(const char* name) {
+    GLint num_extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+    for (GLint i = 0; i < num_extensions; ++i)
+    {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (extension != NULL && strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Tarefa que carrega as imagens de uma TextureArraySource e registra a
+// textura em g_ResidentTextures (com o nome da fonte). Caso a GPU suporte, a
+// textura é enviada comprimida, com os mipmaps gerados offline.
+AssetLoadTask TextureArrayLoadTask(const TextureArraySource& source, GLuint textureunit, bool pinned) {
+    return [source, textureunit, pinned]() -> AssetUpload {
+        if (g_SupportsS3TC)
+        {
+            std::shared_ptr<TextureData> texture = LoadCompressedTexture(source);
+            return [texture, textureunit, pinned]() {
+                ResidentTexture resident = {UploadCompressedTexture(*texture, textureunit), g_AssetUseStamp, pinned};
+                g_ResidentTextures[texture->filename] = resident;
+            };
+        }
+
+        std::shared_ptr<DecodedLayers> layers = std::make_shared<DecodedLayers>(DecodeTextureArray(source));
+        return [layers, textureunit, pinned]() {
+            ResidentTexture resident = {UploadTextureArray(*layers, textureunit), g_AssetUseStamp, pinned};
+            g_ResidentTextures[layers->name] = resident;
+        };
+    };
+}
+
+// Tarefa que carrega as seis faces de uma skybox e registra o cubemap em
+// g_ResidentTextures (com o nome "basepath"). As imagens devem se chamar
+// "<basepath>_{t,b,n,s,e,w}.jpg".
+AssetLoadTask CubemapLoadTask(const char* basepath) {
+    return [basepath]() -> AssetUpload {
+        // Ordem das faces de GL_TEXTURE_CUBE_MAP_POSITIVE_X em diante:
+        // +X (oeste), -X (leste), +Y (topo), -Y (base), +Z (norte), -Z (sul)
+        const char* suffixes[6] = {"w", "e", "t", "b", "n", "s"};
+
+        // Faces de cubemap seguem a convenção de origem no canto superior esquerdo
+        std::shared_ptr<std::vector<DecodedImage>> faces = std::make_shared<std::vector<DecodedImage>>();
+        for (int face = 0; face < 6; face++) {
+            string filename = string(basepath) + "_" + suffixes[face] + ".jpg";
+            faces->push_back(DecodeImage(filename.c_str(), false));
+        }
+        return [faces, basepath]() {
+            ResidentTexture resident = {UploadCubemapTexture(faces->data()), g_AssetUseStamp, false};
+            g_ResidentTextures[basepath] = resident;
+        };
+    };
+}
+
+// Tarefa que carrega um modelo ".obj" (ou o seu cache) e o adiciona em
+// g_VirtualScene. A leitura, o cálculo das normais e a geração dos LODs
+// ocorrem fora da thread do OpenGL.
+AssetLoadTask MeshLoadTask(const string& filename) {
+    return [filename]() -> AssetUpload {
+        std::shared_ptr<MeshData> mesh = LoadMesh(filename);
+        return [mesh]() { UploadMeshAndAddToVirtualScene(mesh.get()); };
+    };
+}
+
+// Tarefas de carregamento de áudio: não há nada a enviar para a GPU
+AssetLoadTask SoundLoadTask(const char* path, sf::SoundBuffer * buffer) {
+    return [path, buffer]() -> AssetUpload {
+        LoadSoundFromFile(path, buffer);
+        return AssetUpload();
+    };
+}
+
+// Tarefas que carregam os recursos dos objetos dados e do tema que ainda não
+// estão na GPU. Os nomes de todas as texturas usadas são colocados em
+// "textures". Só lê g_VirtualScene e g_ResidentTextures, podendo rodar em
+// uma thread auxiliar enquanto a principal não carrega recursos.
+std::vector<AssetLoadTask> GetLevelAssetTasks(const MapObjectList& objects, int theme, std::vector<string>* textures) {
+    std::vector<AssetLoadTask> tasks;
+
+    // Modelos: um arquivo ".obj" com o mesmo nome de cada objeto do nível
+    std::set<string> meshes;
+    bool has_water = false;
+    for (unsigned int i = 0; i < objects.size(); i++) {
+        // O fogo não tem modelo ("fire.obj" não existe): é desenhado com partículas
+        if (objects[i].object_type == FIRE)
+            meshes.insert("sphere");
+        else
+            meshes.insert(objects.details[i].obj_file_name);
+        if (objects[i].object_type == WATER)
+            has_water = true;
+    }
+    for (std::set<string>::iterator it = meshes.begin(); it != meshes.end(); ++it) {
+        if (g_VirtualScene.count(*it) == 0)
+            tasks.push_back(MeshLoadTask("../../data/objects/" + *it + ".obj"));
+    }
+
+    // Texturas
+    TextureArraySource water = WaterTextureSource();
+    if (has_water) {
+        textures->push_back(water.name);
+        if (g_ResidentTextures.count(water.name) == 0)
+            tasks.push_back(TextureArrayLoadTask(water, WATER_TEXTURE_UNIT));
+    }
+
+    const char* skybox = (theme >= 0 && theme <= 4) ? g_ThemeSkyboxes[theme] : NULL;
+    if (skybox != NULL) {
+        textures->push_back(skybox);
+        if (g_ResidentTextures.count(skybox) == 0)
+            tasks.push_back(CubemapLoadTask(skybox));
+    }
+
+    return tasks;
+}
+
+// Garante que os recursos dos objetos de um nível (em geral, um de cada tipo
+// de tile, veja RegisterTileSamples()) e do seu tema estejam na GPU,
+// carregando (em paralelo) o que ainda não foi usado. Em seguida, descarrega
+// as texturas que não são usadas há mais tempo caso o orçamento
+// TEXTURE_MEMORY_BUDGET tenha sido excedido.
+void PrepareLevelAssets(const MapObjectList& objects, int theme) {
+    g_AssetUseStamp++;
+    std::vector<string> textures;
+    std::vector<AssetLoadTask> tasks = GetLevelAssetTasks(objects, theme, &textures);
+    if (!tasks.empty())
+        LoadAssetsInParallel(tasks);
+    for (size_t i = 0; i < textures.size(); i++)
+        TouchResidentTexture(textures[i]);
+
+    const char* skybox = (theme >= 0 && theme <= 4) ? g_ThemeSkyboxes[theme] : NULL;
+    if (skybox != NULL)
+        g_SkyboxCubemaps[theme] = g_ResidentTextures[skybox].texture.texture_id;
+
+    EvictTextures();
+}
+
+// Marca uma textura como usada pelo nível atual. Retorna false caso ela não
+// esteja residente.
+bool TouchResidentTexture(const string& name) {
+    std::map<string, ResidentTexture>::iterator it = g_ResidentTextures.find(name);
+    if (it == g_ResidentTextures.end())
+        return false;
+    it->second.last_used = g_AssetUseStamp;
+    return true;
+}
+
+// Descarrega as texturas usadas há mais tempo até que as texturas residentes
+// caibam em TEXTURE_MEMORY_BUDGET. As do nível atual e as fixas nunca saem.
+void EvictTextures() {
+    size_t resident_bytes = 0;
+    std::map<string, ResidentTexture>::iterator it;
+    for (it = g_ResidentTextures.begin(); it != g_ResidentTextures.end(); ++it)
+        resident_bytes += it->second.texture.bytes;
+
+    while (resident_bytes > TEXTURE_MEMORY_BUDGET) {
+        std::map<string, ResidentTexture>::iterator oldest = g_ResidentTextures.end();
+        for (it = g_ResidentTextures.begin(); it != g_ResidentTextures.end(); ++it) {
+            if (it->second.pinned || it->second.last_used == g_AssetUseStamp)
+                continue;
+            if (oldest == g_ResidentTextures.end() || it->second.last_used < oldest->second.last_used)
+                oldest = it;
+        }
+        if (oldest == g_ResidentTextures.end())
+            break; // Tudo o que resta está em uso
+
+        printf("Descarregando textura \"%s\".\n", oldest->first.c_str());
+        GpuTexture texture = oldest->second.texture;
+        for (int theme = 0; theme < 5; theme++) {
+            if (g_SkyboxCubemaps[theme] == texture.texture_id)
+                g_SkyboxCubemaps[theme] = 0;
+        }
+        glDeleteTextures(1, &texture.texture_id);
+        glDeleteSamplers(1, &texture.sampler_id);
+        resident_bytes -= texture.bytes;
+        g_ResidentTextures.erase(oldest);
+    }
+}
+
+// Executa as tarefas de carregamento em um conjunto de threads auxiliares.
+// Os envios para a GPU devolvidos por elas são colocados em uma fila e
+// executados aqui, na thread que possui o contexto OpenGL, assim que ficam
+// prontos. Retorna quando todas as tarefas terminam.
+void LoadAssetsInParallel(const std::vector<AssetLoadTask>& tasks) {
+    std::mutex queue_mutex;
+    std::condition_variable queue_condition;
+    std::queue<AssetUpload> upload_queue;
+    std::atomic<size_t> next_task(0);
+    std::exception_ptr error;
+
+    // stb_image não deve inverter as imagens (veja DecodeImage())
+    stbi_set_flip_vertically_on_load(false);
+
+    unsigned int num_workers = std::max(1u, std::thread::hardware_concurrency());
+    num_workers = std::min(num_workers, (unsigned int)tasks.size());
+
+    std::vector<std::thread> workers;
+    for (unsigned int w = 0; w < num_workers; w++) {
+        workers.push_back(std::thread([&]() {
+            for (size_t i = next_task++; i < tasks.size(); i = next_task++) {
+                AssetUpload upload;
+                std::exception_ptr task_error;
+                try {
+                    upload = tasks[i]();
+                } catch (...) {
+                    task_error = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                if (task_error && !error)
+                    error = task_error;
+                upload_queue.push(upload);
+                queue_condition.notify_one();
+            }
+        }));
+    }
+
+    for (size_t done = 0; done < tasks.size(); done++) {
+        AssetUpload upload;
+        bool failed;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_condition.wait(lock, [&]() { return !upload_queue.empty(); });
+            upload = upload_queue.front();
+            upload_queue.pop();
+            failed = (bool)error;
+        }
+        if (upload && !failed)
+            upload();
+    }
+
+    for (size_t w = 0; w < workers.size(); w++)
+        workers[w].join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// Dispara a compilação dos shaders de vértices e de fragmentos que serão
+// utilizados para renderização. O programa só pode ser usado depois de
+// LoadShadersFromFiles().
+void CompileShadersFromFiles() {
+    // Deletamos o programa de GPU anterior, caso ele exista.
+    if ( program_id != 0 )
+        glDeleteProgram(program_id);
+
+    // Criamos um programa de GPU utilizando os shaders lidos abaixo.
+    program_id = BeginGpuProgram("scene",
+                                 "../../src/shader_vertex.glsl", AddShaderDefines(ReadShaderFile("../../src/shader_vertex.glsl")),
+                                 "../../src/shader_fragment.glsl", AddShaderDefines(ReadShaderFile("../../src/shader_fragment.glsl")));
+}
+
+// Função que conclui o programa de GPU disparado por CompileShadersFromFiles()
+// e busca o endereço das suas variáveis.
+void LoadShadersFromFiles() {
+    FinishGpuProgram(program_id);
 
     // Buscamos o endereço das variáveis definidas dentro do Vertex Shader.
     // Utilizaremos estas variáveis para enviar dados para a placa de vídeo
@@ -2633,53 +5504,36 @@ void LoadShadersFromFiles() {
     object_id_uniform       = glGetUniformLocation(program_id, "object_id"); // Variável "object_id" em shader_fragment.glsl
     bbox_min_uniform        = glGetUniformLocation(program_id, "bbox_min");
     bbox_max_uniform        = glGetUniformLocation(program_id, "bbox_max");
+    position_offset_uniform = glGetUniformLocation(program_id, "position_offset");
+    position_scale_uniform  = glGetUniformLocation(program_id, "position_scale");
     anim_timer_uniform      = glGetUniformLocation(program_id, "anim_timer");
-    skytheme_uniform        = glGetUniformLocation(program_id, "skytheme");
     yellow_particle_color_uniform = glGetUniformLocation(program_id, "yellow_particle_color");
+    bone_matrices_uniform   = glGetUniformLocation(program_id, "bone_matrices");
+    impostor_cell_uniform   = glGetUniformLocation(program_id, "impostor_cell");
+    dither_range_uniform    = glGetUniformLocation(program_id, "dither_range");
+    anim_time_uniform       = glGetUniformLocation(program_id, "anim_time");
+    anim_type_uniform       = glGetUniformLocation(program_id, "anim_type");
+    anim_phase_uniform      = glGetUniformLocation(program_id, "anim_phase");
 
     // Variáveis em "shader_fragment.glsl" para acesso das imagens de textura
     glUseProgram(program_id);
-    glUniform1i(glGetUniformLocation(program_id, "TextureImage0"), 0);
-    glUniform1i(glGetUniformLocation(program_id, "TextureImage1"), 1);
-    glUniform1i(glGetUniformLocation(program_id, "TextureImage2"), 2);
-    glUniform1i(glGetUniformLocation(program_id, "TextureImage3"), 3);
-    glUniform1i(glGetUniformLocation(program_id, "TextureImage4"), 4);
+    glUniform1i(glGetUniformLocation(program_id, "TileTextures"), TILE_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(program_id, "WaterTextures"), WATER_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(program_id, "SkyboxTexture"), SKYBOX_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(program_id, "ImpostorAtlas"), IMPOSTOR_TEXTURE_UNIT);
+    SetDitherRange(0.0f, 1.0f);
 
     glUseProgram(0);
 }
 
-// Carrega um Vertex Shader de um arquivo GLSL. Veja definição de LoadShader() abaixo.
-GLuint LoadShader_Vertex(const char* filename) {
-    // Criamos um identificador (ID) para este shader, informando que o mesmo
-    // será aplicado nos vértices.
-    GLuint vertex_shader_id = glCreateShader(GL_VERTEX_SHADER);
-
-    // Carregamos e compilamos o shader
-    LoadShader(filename, vertex_shader_id);
-
-    // Retorna o ID gerado acima
-    return vertex_shader_id;
-}
-
-// Carrega um Fragment Shader de um arquivo GLSL . Veja definição de LoadShader() abaixo.
-GLuint LoadShader_Fragment(const char* filename) {
-    // Criamos um identificador (ID) para este shader, informando que o mesmo
-    // será aplicado nos fragmentos.
-    GLuint fragment_shader_id = glCreateShader(GL_FRAGMENT_SHADER);
+// Lê o código de um shader GLSL, do pacote de recursos (caso ele esteja lá)
+// ou do disco.
+string ReadShaderFile(const char* filename) {
+    const unsigned char* packed;
+    size_t packed_size;
+    if (FindPackedAsset(filename, &packed, &packed_size))
+        return string((const char*)packed, packed_size);
 
-    // Carregamos e compilamos o shader
-    LoadShader(filename, fragment_shader_id);
-
-    // Retorna o ID gerado acima
-    return fragment_shader_id;
-}
-
-// Função auxilar, utilizada pelas duas funções acima. Carrega código de GPU de
-// um arquivo GLSL e faz sua compilação.
-void LoadShader(const char* filename, GLuint shader_id) {
-    // Lemos o arquivo de texto indicado pela variável "filename"
-    // e colocamos seu conteúdo em memória, apontado pela variável
-    // "shader_string".
     std::ifstream file;
     try {
         file.exceptions(std::ifstream::failbit);
@@ -2690,16 +5544,61 @@ void LoadShader(const char* filename, GLuint shader_id) {
     }
     std::stringstream shader;
     shader << file.rdbuf();
-    string str = shader.str();
-    const GLchar* shader_string = str.c_str();
-    const GLint   shader_string_length = static_cast<GLint>( str.length() );
+    return shader.str();
+}
+
+// Constantes do C++ usadas pelos shaders: os #define dos tipos de objetos
+// (OBJECT_TYPE_TABLE) e das demais constantes (SHADER_CONSTANTS), e a tabela
+// TILE_LAYERS, com o material de cada tipo de objeto
+string GetShaderDefines() {
+    string defines;
+#define SHADER_OBJECT_TYPE(type, flags, tolerance, material) \
+    defines += "#define " #type " " + std::to_string(type) + "\n";
+    OBJECT_TYPE_TABLE(SHADER_OBJECT_TYPE)
+#undef SHADER_OBJECT_TYPE
+#define SHADER_CONSTANT(name) \
+    defines += "#define " #name " " + std::to_string(name) + "\n";
+    SHADER_CONSTANTS(SHADER_CONSTANT)
+#undef SHADER_CONSTANT
+
+    defines += "#define TILE_MATERIALS " + std::to_string(OBJECT_TYPE_LIMIT) + "\n";
+    defines += "const int TILE_LAYERS[TILE_MATERIALS] = int[TILE_MATERIALS](";
+    for (int type = 0; type < OBJECT_TYPE_LIMIT; type++)
+        defines += (type > 0 ? ", " : "") + std::to_string(OBJECT_TRAITS[type].material);
+    defines += ");\n";
+    return defines;
+}
+
+// Insere GetShaderDefines() no código de um shader, logo após a linha
+// "#version". A numeração das linhas seguintes, usada nas mensagens de erro,
+// continua a mesma do arquivo.
+string AddShaderDefines(const string& source) {
+    size_t version_end = source.find('\n');
+    if (version_end == string::npos)
+        return source;
+    return source.substr(0, version_end + 1) + GetShaderDefines() + "#line 2\n" + source.substr(version_end + 1);
+}
+
+// Cria um shader e dispara a sua compilação. Com KHR_parallel_shader_compile
+// a chamada retorna imediatamente; o resultado é verificado depois, por
+// PrintShaderCompileLog().
+GLuint CompileShader(GLenum type, const string& source) {
+    GLuint shader_id = glCreateShader(type);
 
     // Define o código do shader GLSL, contido na string "shader_string"
+    const GLchar* shader_string = source.c_str();
+    const GLint   shader_string_length = static_cast<GLint>( source.length() );
     glShaderSource(shader_id, 1, &shader_string, &shader_string_length);
 
     // Compila o código do shader GLSL (em tempo de execução)
     glCompileShader(shader_id);
+    return shader_id;
+}
 
+// Imprime no terminal os erros e "warnings" da compilação de um shader
+// (esperando a compilação terminar). "filename" identifica o shader nas
+// mensagens.
+void PrintShaderCompileLog(const char* filename, GLuint shader_id) {
     // Verificamos se ocorreu algum erro ou "warning" durante a compilação
     GLint compiled_ok;
     glGetShaderiv(shader_id, GL_COMPILE_STATUS, &compiled_ok);
@@ -2743,63 +5642,388 @@ void LoadShader(const char* filename, GLuint shader_id) {
     delete [] log;
 }
 
-// Carrega um arquivo de som
+// Carrega um arquivo de som (do pacote de recursos ou do disco)
 void LoadSoundFromFile(const char* path, sf::SoundBuffer * buffer) {
-    printf("Carregando som \"%s\"... ", path);
-    if (!buffer->loadFromFile(path)) {
-        printf("Falha ao carregar som!\n");
-        std::exit(EXIT_FAILURE);
+    const unsigned char* packed;
+    size_t packed_size;
+    bool ok = FindPackedAsset(path, &packed, &packed_size) ? buffer->loadFromMemory(packed, packed_size)
+                                                           : buffer->loadFromFile(path);
+    if (!ok) {
+        printf("Carregando som \"%s\"... Falha ao carregar som!\n", path);
+        throw std::runtime_error("Erro ao carregar som.");
     }
-    else printf(" OK!\n");
+    else printf("Carregando som \"%s\"... OK!\n", path);
 }
 
-// Carrega um arquivo de música
+// Carrega um arquivo de música. Do pacote de recursos, a música é lida
+// diretamente do arquivo mapeado enquanto toca.
 void LoadMusicFromFile(const char* path, sf::Music * buffer) {
-    printf("Carregando música \"%s\"... ", path);
-    if (!buffer->openFromFile(path)) {
-        printf("Falha ao carregar música!\n");
-        std::exit(EXIT_FAILURE);
+    const unsigned char* packed;
+    size_t packed_size;
+    bool ok = FindPackedAsset(path, &packed, &packed_size) ? buffer->openFromMemory(packed, packed_size)
+                                                           : buffer->openFromFile(path);
+    if (!ok) {
+        printf("Carregando música \"%s\"... Falha ao carregar música!\n", path);
+        throw std::runtime_error("Erro ao carregar música.");
     }
     else {
-        printf(" OK!\n");
+        printf("Carregando música \"%s\"... OK!\n", path);
         buffer->setLoop(true);
     }
 }
 
+///////////////////////
+// GERAÇÃO DE NÍVEIS //
+///////////////////////
+
+// Lê uma opção "--nome=valor" (ou "--binary") do gerador de níveis. Retorna
+// false caso a opção não exista ou o valor seja inválido.
+bool ParseLevelGeneratorOption(const string& argument, LevelGeneratorOptions* options) {
+    if (argument == "--binary") {
+        options->binary = true;
+        return true;
+    }
+
+    size_t equals = argument.find('=');
+    if (argument.compare(0, 2, "--") != 0 || equals == string::npos)
+        return false;
+    string name = argument.substr(2, equals - 2);
+    const char* value = argument.c_str() + equals + 1;
+    char* end;
+
+    if (name == "walls") {
+        options->wall_density = strtof(value, &end);
+        return *value && !*end && options->wall_density >= 0.0f && options->wall_density <= 1.0f;
+    }
+
+    long number = strtol(value, &end, 10);
+    if (!*value || *end || number < 0 || number > std::numeric_limits<int>::max())
+        return false;
+
+    if (name == "seed") {
+        options->seed = (unsigned int)number;
+        return true;
+    }
+
+    struct { const char* name; int* value; } integers[] = {
+        {"size", &options->size}, {"theme", &options->theme}, {"time", &options->time},
+        {"fires", &options->fires}, {"jets", &options->jets}, {"balls", &options->balls},
+        {"volleyballs", &options->volleyballs}, {"keys", &options->keys}, {"cows", &options->cows},
+    };
+    for (auto& option : integers) {
+        if (name == option.name) {
+            *option.value = (int)number;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Gera um labirinto aleatório, o mesmo para a mesma semente e parâmetros.
+// O nível sempre tem solução, desconsiderando o movimento dos inimigos:
+//  - o labirinto é perfeito (busca em profundidade nas coordenadas ímpares)
+//    e, com wall_density < 1, parte das paredes internas é removida;
+//  - o fogo vai em folhas da árvore geradora dos pisos a partir do spawn,
+//    de forma que os pisos restantes continuam conectados;
+//  - a vaca mãe fica no piso mais distante do spawn, e as portas, em ordem,
+//    no caminho até ela. A chave da porta i fica na região alcançável
+//    abrindo apenas as portas anteriores;
+//  - as vacas ficam em qualquer piso, e os inimigos longe do spawn e fora
+//    dos caminhos até os itens.
+Level GenerateLevel(const LevelGeneratorOptions& options) {
+    static const char* walls[5]  = {"BL", "WO", "BR", "SB", "BR"};
+    static const char* floors[5] = {"FF", "GR", "FF", "SN", "DD"};
+    static const char* doors[4]  = {"DR", "DG", "DB", "DY"};
+    static const char* keys[4]   = {"kr", "kg", "kb", "ky"};
+    const int dx[4] = {0, 1, 0, -1};
+    const int dz[4] = {1, 0, -1, 0};
+
+    // mt19937 e "% n" (em vez das distribuições da biblioteca padrão) geram
+    // os mesmos níveis em qualquer compilador
+    std::mt19937 random(options.seed);
+    int size = options.size;
+    const uint8_t wall = TileCode(walls[options.theme]);
+    const uint8_t floor = TileCode(floors[options.theme]);
+
+    Level level;
+    level.theme = options.theme;
+    level.width = size;
+    level.height = size;
+    level.tiles.assign((size_t)size * size, wall);
+    std::vector<uint8_t>& tiles = level.tiles;
+
+    // Labirinto perfeito: células nas coordenadas ímpares, ligadas pela busca
+    // em profundidade
+    int last_cell = 2 * ((size - 1) / 2) - 1;
+    int spawn = size + 1;
+    std::vector<int> stack(1, spawn);
+    tiles[spawn] = floor;
+    while (!stack.empty()) {
+        int x = stack.back() % size;
+        int z = stack.back() / size;
+        int neighbors[4], count = 0;
+        for (int d = 0; d < 4; d++) {
+            int nx = x + 2 * dx[d], nz = z + 2 * dz[d];
+            if (nx >= 1 && nz >= 1 && nx <= last_cell && nz <= last_cell && tiles[nz * size + nx] == wall)
+                neighbors[count++] = d;
+        }
+        if (count == 0) {
+            stack.pop_back();
+            continue;
+        }
+        int d = neighbors[random() % count];
+        tiles[(z + dz[d]) * size + x + dx[d]] = floor;
+        tiles[(z + 2 * dz[d]) * size + x + 2 * dx[d]] = floor;
+        stack.push_back((z + 2 * dz[d]) * size + x + 2 * dx[d]);
+    }
+
+    // Ciclos: remove paredes entre duas células vizinhas
+    double kept_walls = options.wall_density * 4294967296.0;
+    for (int z = 1; z <= last_cell; z++)
+        for (int x = 1; x <= last_cell; x++)
+            if ((x + z) % 2 == 1 && tiles[z * size + x] == wall && random() >= kept_walls)
+                tiles[z * size + x] = floor;
+
+    // Árvore geradora dos pisos, por busca em largura a partir do spawn
+    std::vector<int> parent(tiles.size(), -1), depth(tiles.size(), -1), children(tiles.size(), 0);
+    std::vector<int> order(1, spawn);
+    depth[spawn] = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        for (int d = 0; d < 4; d++) {
+            int next = order[i] + dz[d] * size + dx[d];
+            if (tiles[next] == floor && depth[next] < 0) {
+                depth[next] = depth[order[i]] + 1;
+                parent[next] = order[i];
+                children[order[i]]++;
+                order.push_back(next);
+            }
+        }
+    }
+
+    // Fogo: remover folhas da árvore nunca desconecta os pisos restantes.
+    // Pisos suficientes para os demais itens são reservados.
+    int reserved = 2 + 2 * options.keys + options.cows + options.jets + options.balls + options.volleyballs;
+    int fires = std::min(options.fires, std::max(0, (int)order.size() - reserved));
+    std::vector<int> leaves;
+    for (int tile : order)
+        if (children[tile] == 0 && tile != spawn)
+            leaves.push_back(tile);
+    int placed_fires = 0;
+    while (placed_fires < fires && !leaves.empty()) {
+        size_t pick = random() % leaves.size();
+        int tile = leaves[pick];
+        leaves[pick] = leaves.back();
+        leaves.pop_back();
+        tiles[tile] = TileCode("FI");
+        placed_fires++;
+        if (--children[parent[tile]] == 0 && parent[tile] != spawn)
+            leaves.push_back(parent[tile]);
+    }
+
+    // Vaca mãe no piso mais profundo da árvore (uma folha)
+    int goal = spawn;
+    for (int tile : order)
+        if (tiles[tile] == floor && depth[tile] > depth[goal])
+            goal = tile;
+    tiles[goal] = TileCode("CW");
+
+    // Portas no caminho do spawn até a vaca mãe, igualmente espaçadas
+    std::vector<int> path;
+    for (int tile = parent[goal]; tile != spawn && tile >= 0; tile = parent[tile])
+        path.push_back(tile);
+    std::reverse(path.begin(), path.end());
+    int num_doors = std::min(options.keys, (int)path.size());
+    std::vector<int> door_tiles(num_doors);
+    for (int i = 0; i < num_doors; i++) {
+        door_tiles[i] = path[(size_t)(i + 1) * path.size() / (num_doors + 1)];
+        tiles[door_tiles[i]] = TileCode(doors[i % 4]);
+    }
+
+    // Regiões alcançáveis: a região i (abrindo as portas 0 a i-1) são os
+    // region_end[i] primeiros pisos visitados pela busca, que só passa por
+    // cada porta depois de esgotar a região anterior
+    std::fill(parent.begin(), parent.end(), -1);
+    std::fill(depth.begin(), depth.end(), -1);
+    std::vector<int> visited(1, spawn);
+    std::vector<size_t> region_end(num_doors + 1);
+    depth[spawn] = 0;
+    size_t next_visit = 0;
+    for (int i = 0; i <= num_doors; i++) {
+        if (i > 0) {
+            // O vizinho já alcançado pode ser a porta anterior, quando as
+            // duas ficam lado a lado no caminho
+            int door = door_tiles[i - 1];
+            for (int d = 0; d < 4 && parent[door] < 0; d++) {
+                int neighbor = door + dz[d] * size + dx[d];
+                if (depth[neighbor] >= 0) {
+                    parent[door] = neighbor;
+                    depth[door] = depth[neighbor] + 1;
+                }
+            }
+            visited.push_back(door);
+        }
+        for (; next_visit < visited.size(); next_visit++) {
+            int tile = visited[next_visit];
+            for (int d = 0; d < 4; d++) {
+                int next = tile + dz[d] * size + dx[d];
+                if (tiles[next] == floor && depth[next] < 0) {
+                    depth[next] = depth[tile] + 1;
+                    parent[next] = tile;
+                    visited.push_back(next);
+                }
+            }
+        }
+        region_end[i] = visited.size();
+    }
+
+    // Sorteia um piso livre entre os end primeiros visitados. Caso o sorteio
+    // falhe várias vezes, procura sequencialmente a partir de uma posição
+    // sorteada. Retorna -1 se não houver nenhum.
+    std::vector<bool> on_route(tiles.size(), false);
+    auto pick_tile = [&](size_t end, bool off_route) -> int {
+        auto usable = [&](int tile) {
+            return tiles[tile] == floor && tile != spawn && (!off_route || (!on_route[tile] && depth[tile] >= 4));
+        };
+        for (int attempt = 0; attempt < 64; attempt++) {
+            int tile = visited[random() % end];
+            if (usable(tile))
+                return tile;
+        }
+        size_t start = random() % end;
+        for (size_t i = 0; i < end; i++) {
+            int tile = visited[(start + i) % end];
+            if (usable(tile))
+                return tile;
+        }
+        return -1;
+    };
+    auto warn_if_missing = [](int placed, int requested, const char* what) {
+        if (placed < requested)
+            fprintf(stderr, "WARNING: only %d of %d %s fit in the level.\n", placed, requested, what);
+    };
+
+    // Itens: chaves (cada uma na região da sua porta; portas sem chave viram
+    // piso) e vacas bebês
+    std::vector<int> items;
+    for (int i = 0; i < num_doors; i++) {
+        int tile = pick_tile(region_end[i], false);
+        if (tile < 0) {
+            for (int j = i; j < num_doors; j++)
+                tiles[door_tiles[j]] = floor;
+            door_tiles.resize(i);
+            num_doors = i;
+            break;
+        }
+        tiles[tile] = TileCode(keys[i % 4]);
+        items.push_back(tile);
+    }
+    items.insert(items.end(), door_tiles.begin(), door_tiles.end());
+    level.cow_no = 0;
+    while (level.cow_no < options.cows) {
+        int tile = pick_tile(visited.size(), false);
+        if (tile < 0)
+            break;
+        tiles[tile] = TileCode("co");
+        items.push_back(tile);
+        level.cow_no++;
+    }
+
+    // Caminhos até os itens e até a vaca mãe, evitados pelos inimigos
+    for (int d = 0; d < 4; d++)
+        if (depth[goal + dz[d] * size + dx[d]] >= 0)
+            items.push_back(goal + dz[d] * size + dx[d]);
+    for (int tile : items)
+        for (; tile >= 0 && !on_route[tile]; tile = parent[tile])
+            on_route[tile] = true;
+
+    // Inimigos, com direção aleatória. A fase do quique das bolas de vôlei é
+    // sorteada sempre, para que os dois formatos gerem a mesma planta.
+    static const char* jets[4]  = {"J0", "J1", "J2", "J3"};
+    static const char* balls[4] = {"B0", "B1", "B2", "B3"};
+    int placed_enemies[3] = {0, 0, 0};
+    const int requested_enemies[3] = {options.jets, options.balls, options.volleyballs};
+    for (int type = 0; type < 3; type++) {
+        while (placed_enemies[type] < requested_enemies[type]) {
+            int tile = pick_tile(visited.size(), true);
+            if (tile < 0)
+                break;
+            int direction = random() % 4;
+            float gravity = -0.2f + 0.4f * (random() % 1000) / 1000.0f;
+            tiles[tile] = TileCode(type == 0 ? jets[direction] : type == 1 ? balls[direction] : "V0");
+            if (type == 2 && options.binary)
+                level.entities.push_back({tile, 0, gravity});
+            placed_enemies[type]++;
+        }
+    }
+    std::sort(level.entities.begin(), level.entities.end(), [](const LevelEntity& a, const LevelEntity& b) {
+        return a.tile < b.tile;
+    });
+
+    warn_if_missing(placed_fires, options.fires, "fires");
+    warn_if_missing(num_doors, options.keys, "keys and doors");
+    warn_if_missing(level.cow_no, options.cows, "cows");
+    warn_if_missing(placed_enemies[0], options.jets, "jets");
+    warn_if_missing(placed_enemies[1], options.balls, "balls");
+    warn_if_missing(placed_enemies[2], options.volleyballs, "volleyballs");
+
+    tiles[spawn] = TileCode("PS");
+    level.time = options.time > 0 ? options.time : std::max(300, 20 * size);
+    return level;
+}
+
 ///////////
 // AUDIO //
 ///////////
 
-// Toca a música de um nível
-void PlayLevelMusic(int level_number) {
-    if (!g_MusicOn)
-        return;
-
-    if(menumusic.getStatus() == 2)
-        menumusic.stop();
+// Música de um nível e o seu arquivo (NULL caso o nível não tenha música)
+sf::Music* GetLevelMusic(int level_number, const char** path) {
     switch(level_number){
         case 1:
         case 2:{
-            if(techmusic.getStatus() != 2)
-                techmusic.play();
-            break;
+            *path = "../../data/music/landingbase.ogg";
+            return &techmusic;
         }
         case 3:{
-            if(naturemusic.getStatus() != 2)
-                naturemusic.play();
-            break;
+            *path = "../../data/music/rock1.ogg";
+            return &naturemusic;
         }
         case 4:{
-            if(watermusic.getStatus() != 2)
-                watermusic.play();
-            break;
+            *path = "../../data/music/highway.ogg";
+            return &watermusic;
         }
         case 5:{
-            if(crystalmusic.getStatus() != 2)
-                crystalmusic.play();
-            break;
+            *path = "../../data/music/lax_here.ogg";
+            return &crystalmusic;
         }
     }
+    return NULL;
+}
+
+// Toca a música de um nível
+void PlayLevelMusic(int level_number) {
+    if (!g_MusicOn)
+        return;
+
+    if(menumusic.getStatus() == 2)
+        menumusic.stop();
+    const char* path;
+    sf::Music* music = GetLevelMusic(level_number, &path);
+    if (music != NULL)
+        PlayMusicStream(music, path);
+}
+
+// Toca uma música, abrindo o arquivo na primeira vez que ela é tocada
+void PlayMusicStream(sf::Music * music, const char* path) {
+    if (g_OpenedMusic.count(music) == 0) {
+        // A thread auxiliar pode estar abrindo esta mesma música
+        FinishLevelPreload();
+    }
+    if (g_OpenedMusic.count(music) == 0) {
+        LoadMusicFromFile(path, music);
+        g_OpenedMusic.insert(music);
+    }
+    if (music->getStatus() != 2)
+        music->play();
 }
 
 // Toca a música do menu
@@ -2807,6 +6031,8 @@ void PlayMenuMusic() {
     if (!g_MusicOn)
         return;
 
+    // A thread auxiliar pode estar abrindo a música de um nível
+    FinishLevelPreload();
     if (techmusic.getStatus() == 2)
         techmusic.stop();
     if (naturemusic.getStatus() == 2)
@@ -2815,11 +6041,13 @@ void PlayMenuMusic() {
         watermusic.stop();
     if (crystalmusic.getStatus() == 2)
         crystalmusic.stop();
-    menumusic.play();
+    PlayMusicStream(&menumusic, "../../data/music/velapax.ogg");
 }
 
 // Para todas as músicas
 void StopAllMusic() {
+    // A thread auxiliar pode estar abrindo a música de um nível
+    FinishLevelPreload();
     if (techmusic.getStatus() == 2)
         techmusic.stop();
     if (naturemusic.getStatus() == 2)
@@ -2832,32 +6060,47 @@ void StopAllMusic() {
         menumusic.stop();
 }
 
-// Toca um som
+// Toca um som em uma das SOUND_VOICES vozes, de preferência uma que esteja
+// livre; se todas estiverem tocando, interrompe a mais antiga
 void PlaySound(sf::SoundBuffer * buffer) {
     if (!g_SoundsOn)
         return;
 
-    sound.setBuffer(*buffer);
-    sound.play();
+    // Trocar o som aloca memória dentro da SFML: durante a simulação, os sons
+    // vão para uma fila de tamanho fixo e são tocados ao final do passo. Um
+    // mesmo som pedido várias vezes no passo toca uma vez só.
+    if (g_InSimulationStep) {
+        for (int i = 0; i < g_NumDeferredSounds; ++i)
+            if (g_DeferredSounds[i] == buffer)
+                return;
+        if (g_NumDeferredSounds < DEFERRED_SOUND_CAPACITY)
+            g_DeferredSounds[g_NumDeferredSounds++] = buffer;
+        return;
+    }
+
+    int voice = g_NextSoundVoice;
+    for (int i = 0; i < SOUND_VOICES; ++i)
+    {
+        int candidate = (g_NextSoundVoice + i) % SOUND_VOICES;
+        if (sounds[candidate].getStatus() != sf::Sound::Playing)
+        {
+            voice = candidate;
+            break;
+        }
+    }
+    g_NextSoundVoice = (voice + 1) % SOUND_VOICES;
+
+    sounds[voice].setBuffer(*buffer);
+    sounds[voice].play();
 }
 
 //////////////////
 // CONTROLE GPU //
 //////////////////
 
-// Esta função cria um programa de GPU, o qual contém obrigatoriamente um
-// Vertex Shader e um Fragment Shader.
-GLuint CreateGpuProgram(GLuint vertex_shader_id, GLuint fragment_shader_id) {
-    // Criamos um identificador (ID) para este programa de GPU
-    GLuint program_id = glCreateProgram();
-
-    // Definição dos dois shaders GLSL que devem ser executados pelo programa
-    glAttachShader(program_id, vertex_shader_id);
-    glAttachShader(program_id, fragment_shader_id);
-
-    // Linkagem dos shaders acima ao programa
-    glLinkProgram(program_id);
-
+// Imprime no terminal os erros da linkagem de um programa de GPU (esperando
+// a linkagem terminar). Retorna true caso o programa tenha sido linkado.
+bool PrintProgramLinkLog(GLuint program_id) {
     // Verificamos se ocorreu algum erro durante a linkagem
     GLint linked_ok = GL_FALSE;
     glGetProgramiv(program_id, GL_LINK_STATUS, &linked_ok);
@@ -2887,18 +6130,198 @@ GLuint CreateGpuProgram(GLuint vertex_shader_id, GLuint fragment_shader_id) {
         fprintf(stderr, "%s", output.c_str());
     }
 
-    // Os "Shader Objects" podem ser marcados para deleção após serem linkados
-    glDeleteShader(vertex_shader_id);
-    glDeleteShader(fragment_shader_id);
+    return linked_ok == GL_TRUE;
+}
+
+// Carrega as funções de GL_ARB_get_program_binary e de
+// KHR_parallel_shader_compile, que não fazem parte do glad (OpenGL 3.3), e
+// pede ao driver que compile os shaders com quantas threads quiser.
+void LoadGpuProgramExtensions() {
+    GLint num_binary_formats = 0;
+    if (IsExtensionSupported("GL_ARB_get_program_binary")) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_binary_formats);
+        g_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)glfwGetProcAddress("glGetProgramBinary");
+        g_glProgramBinary = (PFNGLPROGRAMBINARYPROC)glfwGetProcAddress("glProgramBinary");
+        g_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)glfwGetProcAddress("glProgramParameteri");
+    }
+
+    // Sem nenhum formato binário, não há o que guardar em cache
+    if (num_binary_formats <= 0 || !g_glGetProgramBinary || !g_glProgramBinary || !g_glProgramParameteri) {
+        g_glGetProgramBinary = NULL;
+        g_glProgramBinary = NULL;
+        g_glProgramParameteri = NULL;
+    }
+
+    PFNGLMAXSHADERCOMPILERTHREADSKHRPROC max_shader_compiler_threads = NULL;
+    if (IsExtensionSupported("GL_KHR_parallel_shader_compile"))
+        max_shader_compiler_threads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    else if (IsExtensionSupported("GL_ARB_parallel_shader_compile"))
+        max_shader_compiler_threads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+    if (max_shader_compiler_threads != NULL)
+        max_shader_compiler_threads(0xFFFFFFFF); // Número de threads escolhido pelo driver
+
+    printf("Cache de programas de GPU: %s. Compilação paralela: %s.\n",
+           g_glProgramBinary ? "sim" : "não", max_shader_compiler_threads ? "sim" : "não");
+}
+
+// Identificação de um programa de GPU no cache: hash FNV-1a (64 bits) do
+// código dos shaders e da identificação do driver, já que o binário só é
+// válido para o mesmo driver
+uint64_t HashGpuProgramSources(const string& vertex_source, const string& fragment_source) {
+    const char* driver[3] = {(const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION)};
+    uint64_t hash = 14695981039346656037ull;
+    const string* sources[2] = {&vertex_source, &fragment_source};
+    for (int i = 0; i < 5; i++) {
+        const char* text = i < 2 ? sources[i]->c_str() : driver[i - 2];
+        size_t length = i < 2 ? sources[i]->size() : (text ? strlen(text) : 0);
+        for (size_t k = 0; k < length; k++)
+            hash = (hash ^ (unsigned char)text[k]) * 1099511628211ull;
+        hash = (hash ^ 0xff) * 1099511628211ull; // Separador
+    }
+    return hash;
+}
+
+// Cria um programa de GPU a partir do código dos seus shaders. Caso haja um
+// binário em cache para o mesmo código e driver, ele é usado diretamente;
+// caso contrário, a compilação e a linkagem são disparadas, e o resultado
+// só é verificado (e guardado em cache) por FinishGpuProgram(), de forma que
+// vários programas possam ser compilados ao mesmo tempo.
+GLuint BeginGpuProgram(const char* name, const char* vertex_filename, const string& vertex_source, const char* fragment_filename, const string& fragment_source) {
+    PendingGpuProgram pending;
+    pending.name = name;
+    pending.key = HashGpuProgramSources(vertex_source, fragment_source);
+    pending.vertex_filename = vertex_filename;
+    pending.fragment_filename = fragment_filename;
+    pending.vertex_shader_id = 0;
+    pending.fragment_shader_id = 0;
+
+    // Criamos um identificador (ID) para este programa de GPU
+    GLuint program_id = glCreateProgram();
+
+    if (!LoadProgramCache(pending, program_id)) {
+        pending.vertex_shader_id = CompileShader(GL_VERTEX_SHADER, vertex_source);
+        pending.fragment_shader_id = CompileShader(GL_FRAGMENT_SHADER, fragment_source);
+
+        // Definição dos dois shaders GLSL que devem ser executados pelo programa
+        glAttachShader(program_id, pending.vertex_shader_id);
+        glAttachShader(program_id, pending.fragment_shader_id);
 
-    // Retornamos o ID gerado acima
+        // Linkagem dos shaders acima ao programa, pedindo que o binário
+        // resultante possa ser lido para o cache
+        if (g_glProgramParameteri)
+            g_glProgramParameteri(program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(program_id);
+    }
+
+    g_PendingGpuPrograms[program_id] = pending;
     return program_id;
 }
 
+// Espera a compilação de um programa disparada por BeginGpuProgram(),
+// imprime os erros e grava o binário no cache.
+void FinishGpuProgram(GLuint program_id) {
+    std::map<GLuint, PendingGpuProgram>::iterator it = g_PendingGpuPrograms.find(program_id);
+    if (it == g_PendingGpuPrograms.end())
+        return;
+    PendingGpuProgram pending = it->second;
+    g_PendingGpuPrograms.erase(it);
+
+    if (pending.vertex_shader_id == 0) {
+        printf("Programa de GPU \"%s\" carregado do cache.\n", pending.name.c_str());
+        return;
+    }
+
+    PrintShaderCompileLog(pending.vertex_filename.c_str(), pending.vertex_shader_id);
+    PrintShaderCompileLog(pending.fragment_filename.c_str(), pending.fragment_shader_id);
+    if (PrintProgramLinkLog(program_id))
+        SaveProgramCache(pending, program_id);
+
+    // Os "Shader Objects" podem ser marcados para deleção após serem linkados
+    glDeleteShader(pending.vertex_shader_id);
+    glDeleteShader(pending.fragment_shader_id);
+}
+
+// Carrega no programa o binário guardado em cache, caso ele exista e
+// corresponda ao mesmo código e driver. Retorna false caso contrário (o
+// driver também pode recusar um binário antigo).
+bool LoadProgramCache(const PendingGpuProgram& pending, GLuint program_id) {
+    if (!g_glProgramBinary)
+        return false;
+
+    string cachepath = g_ExecutableDirectory + pending.name + ".progcache";
+    MappedFile file;
+    if (!MapFile(cachepath.c_str(), &file))
+        return false;
+
+    const ProgramCacheHeader* header = (const ProgramCacheHeader*)file.data;
+    bool valid = file.size >= sizeof(ProgramCacheHeader)
+              && memcmp(header->magic, "CPRG", 4) == 0
+              && header->version == PROGRAM_CACHE_VERSION
+              && header->key == pending.key
+              && header->size == file.size - sizeof(ProgramCacheHeader);
+    if (valid)
+        g_glProgramBinary(program_id, header->format, file.data + sizeof(ProgramCacheHeader), header->size);
+    UnmapFile(&file);
+    if (!valid)
+        return false;
+
+    GLint linked_ok = GL_FALSE;
+    glGetProgramiv(program_id, GL_LINK_STATUS, &linked_ok);
+    return linked_ok == GL_TRUE;
+}
+
+// Grava o binário de um programa recém-linkado no cache, com a mesma
+// estratégia de SaveMeshCache() (arquivo temporário renomeado no final).
+bool SaveProgramCache(const PendingGpuProgram& pending, GLuint program_id) {
+    if (!g_glGetProgramBinary)
+        return false;
+
+    GLint length = 0;
+    glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+
+    std::vector<unsigned char> binary(length);
+    GLenum format = 0;
+    g_glGetProgramBinary(program_id, length, &length, &format, binary.data());
+
+    ProgramCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "CPRG", 4);
+    header.version = PROGRAM_CACHE_VERSION;
+    header.format = format;
+    header.key = pending.key;
+    header.size = length;
+
+    string cachepath = g_ExecutableDirectory + pending.name + ".progcache";
+    string temppath = cachepath + ".tmp";
+    FILE* file = fopen(temppath.c_str(), "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "WARNING: cannot write program cache \"%s\".\n", cachepath.c_str());
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(binary.data(), 1, length, file) == (size_t)length;
+    ok = (fclose(file) == 0) && ok;
+
+    remove(cachepath.c_str());
+    if (!ok || rename(temppath.c_str(), cachepath.c_str()) != 0)
+    {
+        fprintf(stderr, "WARNING: cannot write program cache \"%s\".\n", cachepath.c_str());
+        remove(temppath.c_str());
+        return false;
+    }
+    return true;
+}
+
 // Callback de resizing
 void FramebufferSizeCallback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height);
     g_ScreenRatio = (float)width / height;
+    g_WindowWidth = width;
+    g_WindowHeight = height;
 }
 
 // Callback do mouse
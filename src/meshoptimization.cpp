@@ -0,0 +1,211 @@
+// Otimizações aplicadas às malhas na importação (veja BuildTriangles() em
+// "main.cpp"):
+//  - WeldVertices():        unifica vértices idênticos, que o formato OBJ
+//                           repete em cada triângulo;
+//  - OptimizeVertexCache(): reordena os triângulos para aproveitar o cache de
+//                           vértices já transformados da GPU (algoritmo
+//                           "Tipsify", de Sander, Nehab e Barczak, "Fast
+//                           Triangle Reordering for Vertex Locality and
+//                           Reduced Overdraw", 2007);
+//  - OptimizeVertexFetch(): reordena os vértices na ordem em que são usados,
+//                           para que a leitura do VBO seja sequencial.
+#include <cstring>
+#include <vector>
+#include <unordered_map>
+
+#include <glad/glad.h>
+
+namespace {
+
+// Chave do mapa de unificação: os floats de um vértice comparados bit a bit
+struct VertexKey {
+    const float* data;
+    size_t stride;
+};
+
+struct VertexKeyHash {
+    size_t operator()(const VertexKey& k) const {
+        // FNV-1a sobre os bytes do vértice
+        const unsigned char* bytes = (const unsigned char*)k.data;
+        size_t h = 2166136261u;
+        for (size_t i = 0; i < k.stride * sizeof(float); ++i)
+            h = (h ^ bytes[i]) * 16777619u;
+        return h;
+    }
+};
+
+struct VertexKeyEqual {
+    bool operator()(const VertexKey& a, const VertexKey& b) const {
+        return std::memcmp(a.data, b.data, a.stride * sizeof(float)) == 0;
+    }
+};
+
+// Próximo vértice a partir do qual emitir triângulos quando o atual não tem
+// mais triângulos pendentes: o mais recente da pilha de "becos sem saída" que
+// ainda tenha triângulos ou, em último caso, o próximo na ordem da entrada.
+int SkipDeadEnd(std::vector<GLuint>& dead_end, const std::vector<int>& live_triangles, size_t& cursor)
+{
+    while (!dead_end.empty())
+    {
+        GLuint d = dead_end.back();
+        dead_end.pop_back();
+        if (live_triangles[d] > 0)
+            return d;
+    }
+    while (cursor < live_triangles.size())
+    {
+        if (live_triangles[cursor] > 0)
+            return cursor;
+        ++cursor;
+    }
+    return -1;
+}
+
+} // namespace
+
+// Unifica os vértices de índice >= first_vertex que tenham exatamente os
+// mesmos atributos ("stride" floats cada). Os vértices restantes são
+// compactados no próprio vetor e os índices a partir de first_index são
+// renumerados. Retorna o novo número de vértices.
+size_t WeldVertices(std::vector<float>& vertices, size_t stride, size_t first_vertex, std::vector<GLuint>& indices, size_t first_index)
+{
+    size_t num_vertices = vertices.size() / stride;
+    std::vector<GLuint> remap(num_vertices - first_vertex);
+    std::vector<float> welded;
+    welded.reserve(vertices.size() - first_vertex * stride);
+
+    // As chaves apontam para os vértices originais, que não mudam durante a busca
+    std::unordered_map<VertexKey, GLuint, VertexKeyHash, VertexKeyEqual> unique;
+    unique.reserve(num_vertices - first_vertex);
+
+    for (size_t v = first_vertex; v < num_vertices; ++v)
+    {
+        VertexKey key = {&vertices[v * stride], stride};
+        GLuint id = first_vertex + welded.size() / stride;
+        auto inserted = unique.insert(std::make_pair(key, id));
+        if (inserted.second)
+            welded.insert(welded.end(), key.data, key.data + stride);
+        remap[v - first_vertex] = inserted.first->second;
+    }
+
+    for (size_t i = first_index; i < indices.size(); ++i)
+    {
+        if (indices[i] >= first_vertex)
+            indices[i] = remap[indices[i] - first_vertex];
+    }
+
+    vertices.resize(first_vertex * stride);
+    vertices.insert(vertices.end(), welded.begin(), welded.end());
+    return vertices.size() / stride;
+}
+
+// Reordena os triângulos de indices[0..num_indices) para um cache de
+// vértices de "cache_size" entradas, usando o algoritmo Tipsify: os
+// triângulos são emitidos em leques ao redor de um vértice, e o próximo
+// vértice é escolhido entre os recém-usados que ainda estarão no cache.
+void OptimizeVertexCache(GLuint* indices, size_t num_indices, size_t num_vertices, int cache_size)
+{
+    size_t num_triangles = num_indices / 3;
+    if (num_triangles == 0)
+        return;
+
+    // Triângulos adjacentes a cada vértice (formato CSR)
+    std::vector<int> live_triangles(num_vertices, 0);
+    for (size_t i = 0; i < num_indices; ++i)
+        live_triangles[indices[i]]++;
+
+    std::vector<size_t> adjacency_offset(num_vertices + 1, 0);
+    for (size_t v = 0; v < num_vertices; ++v)
+        adjacency_offset[v + 1] = adjacency_offset[v] + live_triangles[v];
+    std::vector<GLuint> adjacency(num_indices);
+    std::vector<size_t> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+    for (size_t i = 0; i < num_indices; ++i)
+        adjacency[fill[indices[i]]++] = i / 3;
+
+    std::vector<int> cache_time(num_vertices, 0); // Instante em que o vértice entrou no cache
+    std::vector<char> emitted(num_triangles, 0);
+    std::vector<GLuint> dead_end;
+    std::vector<GLuint> candidates;
+    std::vector<GLuint> output;
+    output.reserve(num_indices);
+
+    int time = cache_size + 1;
+    size_t cursor = 0;
+    int fanning = indices[0];
+
+    while (fanning >= 0)
+    {
+        candidates.clear();
+
+        // Emite todos os triângulos pendentes ao redor do vértice atual
+        for (size_t a = adjacency_offset[fanning]; a < adjacency_offset[fanning + 1]; ++a)
+        {
+            GLuint t = adjacency[a];
+            if (emitted[t])
+                continue;
+            emitted[t] = 1;
+
+            for (int k = 0; k < 3; ++k)
+            {
+                GLuint v = indices[3*t + k];
+                output.push_back(v);
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                live_triangles[v]--;
+                if (time - cache_time[v] > cache_size)
+                    cache_time[v] = time++;
+            }
+        }
+
+        // Próximo vértice: o candidato que ainda estará no cache após emitir
+        // os seus triângulos restantes e que entrou nele há mais tempo
+        int best = -1;
+        int best_priority = -1;
+        for (size_t c = 0; c < candidates.size(); ++c)
+        {
+            GLuint v = candidates[c];
+            if (live_triangles[v] <= 0)
+                continue;
+            int priority = 0;
+            if (time - cache_time[v] + 2 * live_triangles[v] <= cache_size)
+                priority = time - cache_time[v];
+            if (priority > best_priority)
+            {
+                best_priority = priority;
+                best = v;
+            }
+        }
+
+        if (best == -1)
+            best = SkipDeadEnd(dead_end, live_triangles, cursor);
+        fanning = best;
+    }
+
+    std::memcpy(indices, output.data(), num_indices * sizeof(GLuint));
+}
+
+// Reordena os vértices na ordem em que aparecem no index buffer e renumera
+// os índices. Vértices não referenciados são descartados. Retorna o novo
+// número de vértices.
+size_t OptimizeVertexFetch(std::vector<float>& vertices, size_t stride, std::vector<GLuint>& indices)
+{
+    const GLuint unused = ~0u;
+    size_t num_vertices = vertices.size() / stride;
+    std::vector<GLuint> remap(num_vertices, unused);
+    std::vector<float> reordered;
+    reordered.reserve(vertices.size());
+
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        GLuint v = indices[i];
+        if (remap[v] == unused)
+        {
+            remap[v] = reordered.size() / stride;
+            reordered.insert(reordered.end(), vertices.begin() + v * stride, vertices.begin() + (v + 1) * stride);
+        }
+        indices[i] = remap[v];
+    }
+
+    vertices.swap(reordered);
+    return vertices.size() / stride;
+}
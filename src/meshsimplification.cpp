@@ -0,0 +1,285 @@
+// Simplificação de malhas por colapso de arestas guiado por quádricas de erro
+// (Garland & Heckbert, "Surface Simplification Using Quadric Error Metrics").
+// Usada em BuildTrianglesAndAddToVirtualScene() para gerar os níveis de
+// detalhe (LODs) dos modelos carregados.
+//
+// É feito o colapso de "meia-aresta": um vértice u é movido para cima de um
+// vizinho v já existente. Assim, os índices gerados continuam apontando para
+// vértices do VBO original, e cada LOD é apenas um novo trecho do index buffer.
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include <glad/glad.h>
+
+namespace {
+
+// Quádrica simétrica 4x4, armazenada pela sua metade superior:
+// a00 a01 a02 a03 a11 a12 a13 a22 a23 a33
+struct Quadric {
+    double a[10];
+};
+
+void QuadricAddPlane(Quadric& q, double a, double b, double c, double d, double weight)
+{
+    q.a[0] += weight*a*a; q.a[1] += weight*a*b; q.a[2] += weight*a*c; q.a[3] += weight*a*d;
+    q.a[4] += weight*b*b; q.a[5] += weight*b*c; q.a[6] += weight*b*d;
+    q.a[7] += weight*c*c; q.a[8] += weight*c*d;
+    q.a[9] += weight*d*d;
+}
+
+void QuadricAdd(Quadric& q, const Quadric& r)
+{
+    for (int i = 0; i < 10; i++)
+        q.a[i] += r.a[i];
+}
+
+// Calcula v^T Q v, com v = (x,y,z,1)
+double QuadricError(const Quadric& q, const double* p)
+{
+    double x = p[0], y = p[1], z = p[2];
+    double e = q.a[0]*x*x + 2*q.a[1]*x*y + 2*q.a[2]*x*z + 2*q.a[3]*x
+             + q.a[4]*y*y + 2*q.a[5]*y*z + 2*q.a[6]*y
+             + q.a[7]*z*z + 2*q.a[8]*z
+             + q.a[9];
+    return std::fabs(e);
+}
+
+void TriangleNormal(const double* a, const double* b, const double* c, double* n)
+{
+    double e1[3] = {b[0]-a[0], b[1]-a[1], b[2]-a[2]};
+    double e2[3] = {c[0]-a[0], c[1]-a[1], c[2]-a[2]};
+    n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+    n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+    n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+}
+
+struct PositionKey {
+    float x, y, z;
+    bool operator==(const PositionKey& o) const { return x == o.x && y == o.y && z == o.z; }
+};
+
+struct PositionKeyHash {
+    size_t operator()(const PositionKey& k) const {
+        unsigned int h[3];
+        std::memcpy(h, &k, sizeof(h));
+        return (h[0] * 73856093u) ^ (h[1] * 19349663u) ^ (h[2] * 83492791u);
+    }
+};
+
+struct Collapse {
+    double cost;
+    GLuint from;
+    GLuint to;
+    bool operator<(const Collapse& o) const { return cost < o.cost; }
+};
+
+} // namespace
+
+// Gera uma versão simplificada da malha dada, com aproximadamente
+// target_index_count índices (3 por triângulo).
+//  - positions: coordenadas dos vértices, "stride" floats por vértice (x,y,z nos três primeiros)
+//  - indices:   triângulos da malha original (índices em positions)
+// Os índices retornados referenciam vértices de positions. Vértices na borda
+// de malhas abertas nunca são movidos, para não abrir buracos na silhueta.
+// Vértices de costura (a mesma posição em mais de um vértice do VBO, com
+// normal ou coordenadas de textura diferentes) também ficam travados e não
+// recebem colapsos: cada canto de triângulo sobre eles mantém o seu vértice
+// original, e os atributos dos dois lados da costura não se misturam.
+std::vector<GLuint> SimplifyMesh(const float* positions, size_t stride, const std::vector<GLuint>& indices, size_t target_index_count)
+{
+    // Unificamos vértices com a mesma posição (o VBO repete vértices por triângulo)
+    std::unordered_map<PositionKey, GLuint, PositionKeyHash> welded_ids;
+    std::vector<double> welded_positions;
+    std::vector<GLuint> representative; // Vértice original que representa cada vértice unificado
+    std::vector<char> seam;             // Mais de um vértice original na mesma posição
+    std::vector<GLuint> triangles(indices.size());
+    std::vector<GLuint> corners(indices);  // Vértice original de cada canto de triângulo
+
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        const float* p = positions + stride*indices[i];
+        PositionKey key = {p[0], p[1], p[2]};
+        auto it = welded_ids.find(key);
+        if (it == welded_ids.end())
+        {
+            GLuint id = representative.size();
+            it = welded_ids.insert(std::make_pair(key, id)).first;
+            representative.push_back(indices[i]);
+            seam.push_back(0);
+            welded_positions.push_back(p[0]);
+            welded_positions.push_back(p[1]);
+            welded_positions.push_back(p[2]);
+        }
+        else if (representative[it->second] != indices[i])
+            seam[it->second] = 1;
+        triangles[i] = it->second;
+    }
+
+    size_t num_vertices = representative.size();
+
+    // Quádrica de cada vértice: soma dos planos dos triângulos adjacentes,
+    // ponderados pela área.
+    Quadric zero;
+    std::memset(&zero, 0, sizeof(zero));
+    std::vector<Quadric> quadrics(num_vertices, zero);
+    for (size_t t = 0; t + 2 < triangles.size(); t += 3)
+    {
+        double n[3];
+        const double* a = &welded_positions[3*triangles[t+0]];
+        const double* b = &welded_positions[3*triangles[t+1]];
+        const double* c = &welded_positions[3*triangles[t+2]];
+        TriangleNormal(a, b, c, n);
+        double length = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+        if (length == 0.0)
+            continue;
+        n[0] /= length; n[1] /= length; n[2] /= length;
+        double d = -(n[0]*a[0] + n[1]*a[1] + n[2]*a[2]);
+        for (int k = 0; k < 3; k++)
+            QuadricAddPlane(quadrics[triangles[t+k]], n[0], n[1], n[2], d, length * 0.5);
+    }
+
+    // Arestas usadas por um único triângulo estão na borda: travamos seus vértices
+    std::unordered_map<unsigned long long, int> edge_count;
+    for (size_t t = 0; t + 2 < triangles.size(); t += 3)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned long long a = triangles[t+k];
+            unsigned long long b = triangles[t+(k+1)%3];
+            edge_count[a < b ? (a << 32) | b : (b << 32) | a]++;
+        }
+    }
+    std::vector<char> locked(seam);
+    for (auto it = edge_count.begin(); it != edge_count.end(); ++it)
+    {
+        if (it->second == 1)
+        {
+            locked[it->first >> 32] = 1;
+            locked[it->first & 0xffffffffull] = 1;
+        }
+    }
+
+    // Passos sucessivos: em cada um, colapsamos as arestas mais baratas cujos
+    // vértices (e vizinhanças) ainda não foram alterados neste passo.
+    std::vector<GLuint> collapse_to(num_vertices);
+    std::vector<char> touched(num_vertices);
+    std::vector<size_t> adjacency_offset(num_vertices + 1);
+    std::vector<GLuint> adjacency;
+    std::vector<Collapse> candidates;
+
+    for (int pass = 0; pass < 64 && triangles.size() > target_index_count; ++pass)
+    {
+        size_t num_triangles = triangles.size() / 3;
+
+        // Lista de triângulos adjacentes a cada vértice (formato CSR)
+        std::fill(adjacency_offset.begin(), adjacency_offset.end(), 0);
+        for (size_t i = 0; i < triangles.size(); ++i)
+            adjacency_offset[triangles[i] + 1]++;
+        for (size_t v = 0; v < num_vertices; ++v)
+            adjacency_offset[v + 1] += adjacency_offset[v];
+        adjacency.resize(triangles.size());
+        std::vector<size_t> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+        for (size_t i = 0; i < triangles.size(); ++i)
+            adjacency[fill[triangles[i]]++] = i / 3;
+
+        // Custo de cada colapso u -> v
+        candidates.clear();
+        for (size_t i = 0; i < triangles.size(); ++i)
+        {
+            GLuint u = triangles[i];
+            GLuint v = triangles[i - i%3 + (i+1)%3];
+            for (int direction = 0; direction < 2; direction++)
+            {
+                if (!locked[u])
+                {
+                    Quadric q = quadrics[u];
+                    QuadricAdd(q, quadrics[v]);
+                    Collapse c = {QuadricError(q, &welded_positions[3*v]), u, v};
+                    candidates.push_back(c);
+                }
+                std::swap(u, v);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        for (size_t v = 0; v < num_vertices; ++v)
+            collapse_to[v] = v;
+        std::fill(touched.begin(), touched.end(), 0);
+
+        size_t triangles_to_remove = num_triangles - target_index_count / 3;
+        size_t removed = 0;
+
+        for (size_t c = 0; c < candidates.size() && removed < triangles_to_remove; ++c)
+        {
+            GLuint u = candidates[c].from;
+            GLuint v = candidates[c].to;
+            if (touched[u] || touched[v] || seam[v])
+                continue;
+
+            // Rejeita colapsos que invertem a orientação de algum triângulo
+            bool flips = false;
+            size_t shared = 0;
+            for (size_t a = adjacency_offset[u]; a < adjacency_offset[u + 1] && !flips; ++a)
+            {
+                const GLuint* tri = &triangles[3*adjacency[a]];
+                if (tri[0] == v || tri[1] == v || tri[2] == v)
+                {
+                    shared++;
+                    continue;
+                }
+                const double* p[3];
+                const double* q[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    p[k] = &welded_positions[3*tri[k]];
+                    q[k] = (tri[k] == u) ? &welded_positions[3*v] : p[k];
+                }
+                double n0[3], n1[3];
+                TriangleNormal(p[0], p[1], p[2], n0);
+                TriangleNormal(q[0], q[1], q[2], n1);
+                if (n0[0]*n1[0] + n0[1]*n1[1] + n0[2]*n1[2] <= 0.0)
+                    flips = true;
+            }
+            if (flips)
+                continue;
+
+            collapse_to[u] = v;
+            QuadricAdd(quadrics[v], quadrics[u]);
+            removed += shared;
+
+            // A vizinhança de u muda: não pode participar de outro colapso neste passo
+            for (size_t a = adjacency_offset[u]; a < adjacency_offset[u + 1]; ++a)
+                for (int k = 0; k < 3; k++)
+                    touched[triangles[3*adjacency[a] + k]] = 1;
+        }
+
+        if (removed == 0)
+            break;
+
+        // Reconstrói a lista de triângulos, descartando os degenerados. Um
+        // canto movido passa para o único vértice original do destino (que
+        // não é de costura); os demais mantêm o seu.
+        size_t write = 0;
+        for (size_t t = 0; t + 2 < triangles.size(); t += 3)
+        {
+            GLuint a = collapse_to[triangles[t+0]];
+            GLuint b = collapse_to[triangles[t+1]];
+            GLuint c = collapse_to[triangles[t+2]];
+            if (a == b || b == c || a == c)
+                continue;
+            for (int k = 0; k < 3; k++)
+                corners[write + k] = (collapse_to[triangles[t+k]] == triangles[t+k]) ? corners[t+k] : representative[collapse_to[triangles[t+k]]];
+            triangles[write++] = a;
+            triangles[write++] = b;
+            triangles[write++] = c;
+        }
+        triangles.resize(write);
+        corners.resize(write);
+    }
+
+    // Os cantos já estão nos índices do VBO original
+    return corners;
+}
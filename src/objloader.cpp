@@ -0,0 +1,420 @@
+// Leitura paralela de arquivos ".obj". O arquivo é mapeado em memória e
+// dividido em trechos que terminam em fim de linha; cada trecho é lido por
+// uma thread e os resultados são concatenados nas estruturas do tinyobjloader
+// (tinyobj::attrib_t e tinyobj::shape_t), de modo que o restante do código
+// não muda. Usada pelo construtor de ObjModel em "main.cpp".
+//
+// São reconhecidos os comandos "v", "vn", "vt", "f", "g" e "o"; faces com
+// mais de três vértices são trianguladas em leque, como faz o tinyobjloader.
+// Arquivos com materiais ("mtllib"/"usemtl") não são tratados aqui: nesse
+// caso LoadObjParallel() retorna false sem mensagem de erro e o chamador deve
+// usar tinyobj::LoadObj().
+#include <cmath>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "tiny_obj_loader.h"
+#include "mappedfile.h"
+
+// Tamanho mínimo de cada trecho: arquivos pequenos são lidos em uma só thread
+#define OBJ_MIN_CHUNK_SIZE (256 * 1024)
+
+namespace {
+
+// Início de um grupo de faces ("g" ou "o") dentro de um trecho
+struct ObjGroup {
+    bool        named;       // false: continuação do grupo do trecho anterior
+    std::string name;
+    size_t      first_index; // Em ObjChunk::indices
+};
+
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+
+    std::vector<float> vertices;
+    std::vector<float> normals;
+    std::vector<float> texcoords;
+    std::vector<tinyobj::index_t> indices; // Três por triângulo
+    std::vector<ObjGroup> groups;
+
+    // Índices negativos ("-1" = último vértice lido) dependem de quantos
+    // vértices os trechos anteriores têm: guardamos a posição em "indices"
+    // (vezes 3, mais 0 = posição, 1 = normal, 2 = textura) para corrigi-los
+    // na junção dos trechos.
+    std::vector<size_t> relative;
+
+    const char* error; // Linha com erro (NULL se a leitura foi bem sucedida)
+    bool unsupported;  // Encontrou comandos de materiais
+};
+
+inline bool IsSpace(char c) { return c == ' ' || c == '\t'; }
+inline bool IsEndOfLine(const char* p, const char* end) { return p == end || *p == '\n' || *p == '\r'; }
+
+inline void SkipSpaces(const char*& p, const char* end)
+{
+    while (p != end && IsSpace(*p))
+        ++p;
+}
+
+// Converte um número em ponto flutuante no formato [-+]ddd[.ddd][(e|E)[-+]ddd],
+// sem depender da locale nem exigir que o texto termine em '\0'. Os primeiros
+// 19 dígitos significativos são acumulados em um inteiro e escalados por uma
+// potência de 10 em double, o que é exato o bastante para floats.
+bool ParseFloat(const char*& p, const char* end, float* value)
+{
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char* s = p;
+    bool negative = false;
+    if (s != end && (*s == '-' || *s == '+'))
+        negative = (*s++ == '-');
+
+    unsigned long long mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any_digit = false;
+
+    for (; s != end && *s >= '0' && *s <= '9'; ++s, any_digit = true)
+    {
+        if (digits < 19) { mantissa = mantissa * 10 + (*s - '0'); if (mantissa) digits++; }
+        else exponent++;
+    }
+    if (s != end && *s == '.')
+    {
+        for (++s; s != end && *s >= '0' && *s <= '9'; ++s, any_digit = true)
+        {
+            if (digits < 19) { mantissa = mantissa * 10 + (*s - '0'); if (mantissa) digits++; exponent--; }
+        }
+    }
+    if (!any_digit)
+        return false;
+
+    if (s != end && (*s == 'e' || *s == 'E'))
+    {
+        const char* e = s + 1;
+        bool exponent_negative = false;
+        if (e != end && (*e == '-' || *e == '+'))
+            exponent_negative = (*e++ == '-');
+        if (e != end && *e >= '0' && *e <= '9')
+        {
+            int explicit_exponent = 0;
+            for (; e != end && *e >= '0' && *e <= '9'; ++e)
+                explicit_exponent = std::min(explicit_exponent * 10 + (*e - '0'), 100000);
+            exponent += exponent_negative ? -explicit_exponent : explicit_exponent;
+            s = e;
+        }
+    }
+
+    double result = (double)mantissa;
+    if (mantissa != 0)
+    {
+        while (exponent > 22) { result *= 1e22; exponent -= 22; }
+        while (exponent < -22) { result /= 1e22; exponent += 22; }
+        result = exponent >= 0 ? result * powers_of_ten[exponent] : result / powers_of_ten[-exponent];
+    }
+
+    *value = (float)(negative ? -result : result);
+    p = s;
+    return true;
+}
+
+bool ParseInt(const char*& p, const char* end, int* value)
+{
+    const char* s = p;
+    bool negative = false;
+    if (s != end && (*s == '-' || *s == '+'))
+        negative = (*s++ == '-');
+    if (s == end || *s < '0' || *s > '9')
+        return false;
+
+    long long result = 0;
+    for (; s != end && *s >= '0' && *s <= '9'; ++s)
+        result = std::min(result * 10 + (*s - '0'), 0x7fffffffLL);
+
+    *value = (int)(negative ? -result : result);
+    p = s;
+    return true;
+}
+
+// Lê "n" floats separados por espaços (valores extras na linha, como o "w"
+// opcional de "v", são ignorados)
+bool ParseFloats(const char*& p, const char* end, int n, std::vector<float>& out)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        SkipSpaces(p, end);
+        float value;
+        if (!ParseFloat(p, end, &value))
+            return false;
+        out.push_back(value);
+    }
+    return true;
+}
+
+// Converte um índice do arquivo (começando em 1, ou negativo para contar a
+// partir do último elemento lido) para um índice começando em 0.
+int ResolveIndex(int index, size_t count, bool* relative)
+{
+    *relative = index < 0;
+    return index > 0 ? index - 1 : (int)count + index;
+}
+
+// Lê um vértice de face: "v", "v/vt", "v//vn" ou "v/vt/vn"
+bool ParseFaceVertex(const char*& p, const char* end, ObjChunk* chunk, tinyobj::index_t* vertex, bool relative[3])
+{
+    int index;
+    vertex->vertex_index = vertex->normal_index = vertex->texcoord_index = -1;
+    relative[0] = relative[1] = relative[2] = false;
+
+    if (!ParseInt(p, end, &index) || index == 0)
+        return false;
+    vertex->vertex_index = ResolveIndex(index, chunk->vertices.size() / 3, &relative[0]);
+
+    if (p == end || *p != '/')
+        return true;
+    ++p;
+    if (p != end && *p != '/')
+    {
+        if (!ParseInt(p, end, &index) || index == 0)
+            return false;
+        vertex->texcoord_index = ResolveIndex(index, chunk->texcoords.size() / 2, &relative[2]);
+    }
+
+    if (p == end || *p != '/')
+        return true;
+    ++p;
+    if (!ParseInt(p, end, &index) || index == 0)
+        return false;
+    vertex->normal_index = ResolveIndex(index, chunk->normals.size() / 3, &relative[1]);
+    return true;
+}
+
+void PushFaceVertex(ObjChunk* chunk, const tinyobj::index_t& vertex, const bool relative[3])
+{
+    for (int k = 0; k < 3; ++k)
+        if (relative[k])
+            chunk->relative.push_back(3 * chunk->indices.size() + k);
+    chunk->indices.push_back(vertex);
+}
+
+// Nome de um grupo: a primeira palavra depois do comando (como no tinyobjloader)
+std::string ParseName(const char* p, const char* end)
+{
+    SkipSpaces(p, end);
+    const char* name_end = p;
+    while (!IsEndOfLine(name_end, end) && !IsSpace(*name_end))
+        ++name_end;
+    return std::string(p, name_end);
+}
+
+bool ParseFace(const char*& p, const char* end, ObjChunk* chunk)
+{
+    tinyobj::index_t first, previous, current;
+    bool first_relative[3], previous_relative[3], current_relative[3];
+    int count = 0;
+
+    for (;;)
+    {
+        SkipSpaces(p, end);
+        if (IsEndOfLine(p, end))
+            break;
+        if (!ParseFaceVertex(p, end, chunk, &current, current_relative))
+            return false;
+
+        // Triangulação em leque: (0, k-1, k)
+        if (count >= 2)
+        {
+            PushFaceVertex(chunk, first, first_relative);
+            PushFaceVertex(chunk, previous, previous_relative);
+            PushFaceVertex(chunk, current, current_relative);
+        }
+        if (count == 0)
+        {
+            first = current;
+            std::copy(current_relative, current_relative + 3, first_relative);
+        }
+        previous = current;
+        std::copy(current_relative, current_relative + 3, previous_relative);
+        count++;
+    }
+    return true;
+}
+
+void ParseChunk(ObjChunk* chunk)
+{
+    const char* end = chunk->end;
+    const char* p = chunk->begin;
+
+    ObjGroup continuation = {false, std::string(), 0};
+    chunk->groups.push_back(continuation);
+
+    while (p != end)
+    {
+        const char* line = p;
+        SkipSpaces(p, end);
+
+        bool ok = true;
+        if (p + 1 < end && p[0] == 'v' && IsSpace(p[1]))
+        {
+            p += 2;
+            ok = ParseFloats(p, end, 3, chunk->vertices);
+        }
+        else if (p + 2 < end && p[0] == 'v' && p[1] == 'n' && IsSpace(p[2]))
+        {
+            p += 3;
+            ok = ParseFloats(p, end, 3, chunk->normals);
+        }
+        else if (p + 2 < end && p[0] == 'v' && p[1] == 't' && IsSpace(p[2]))
+        {
+            p += 3;
+            ok = ParseFloats(p, end, 2, chunk->texcoords);
+        }
+        else if (p + 1 < end && p[0] == 'f' && IsSpace(p[1]))
+        {
+            p += 2;
+            ok = ParseFace(p, end, chunk);
+        }
+        else if (p != end && (p[0] == 'g' || p[0] == 'o') && (p + 1 == end || IsSpace(p[1]) || IsEndOfLine(p + 1, end)))
+        {
+            ObjGroup group = {true, ParseName(p + 1, end), chunk->indices.size()};
+            chunk->groups.push_back(group);
+        }
+        else if (end - p >= 6 && (std::equal(p, p + 6, "mtllib") || std::equal(p, p + 6, "usemtl")))
+        {
+            chunk->unsupported = true;
+            return;
+        }
+        // Comentários e comandos desconhecidos ("s", "l", ...) são ignorados
+
+        if (!ok)
+        {
+            chunk->error = line;
+            return;
+        }
+
+        // Próxima linha
+        while (p != end && *p != '\n')
+            ++p;
+        if (p != end)
+            ++p;
+    }
+}
+
+} // namespace
+
+// Lê um arquivo ".obj" usando várias threads. Retorna false em caso de erro
+// (com a mensagem em "err") ou se o arquivo usa materiais (com "err" vazio).
+bool LoadObjParallel(const char* filename, tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes, std::string* err)
+{
+    MappedFile file;
+    if (!MapFile(filename, &file))
+    {
+        *err = std::string("Cannot open file \"") + filename + "\".";
+        return false;
+    }
+
+    const char* data = (const char*)file.data;
+    const char* data_end = data + file.size;
+
+    // Divisão em trechos de tamanhos próximos, terminados em '\n'
+    size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t num_chunks = std::max<size_t>(1, std::min(num_threads, file.size / OBJ_MIN_CHUNK_SIZE));
+
+    std::vector<ObjChunk> chunks(num_chunks);
+    const char* chunk_begin = data;
+    for (size_t i = 0; i < num_chunks; ++i)
+    {
+        const char* chunk_end = (i + 1 == num_chunks) ? data_end : data + file.size * (i + 1) / num_chunks;
+        chunk_end = std::max(chunk_end, chunk_begin);
+        while (chunk_end != data_end && chunk_end != data && chunk_end[-1] != '\n')
+            ++chunk_end;
+
+        chunks[i].begin = chunk_begin;
+        chunks[i].end = chunk_end;
+        chunks[i].error = NULL;
+        chunks[i].unsupported = false;
+        chunk_begin = chunk_end;
+    }
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < num_chunks; ++i)
+        workers.push_back(std::thread(ParseChunk, &chunks[i]));
+    ParseChunk(&chunks[0]);
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+
+    for (size_t i = 0; i < num_chunks; ++i)
+    {
+        if (chunks[i].unsupported)
+        {
+            err->clear();
+            UnmapFile(&file);
+            return false;
+        }
+        if (chunks[i].error != NULL)
+        {
+            size_t line = 1 + std::count(data, chunks[i].error, '\n');
+            *err = std::string("Parse error in \"") + filename + "\" at line " + std::to_string(line) + ".";
+            UnmapFile(&file);
+            return false;
+        }
+    }
+
+    // Junção: atributos concatenados, índices relativos corrigidos pelo
+    // número de elementos dos trechos anteriores e grupos unidos em shapes
+    attrib->vertices.clear();
+    attrib->normals.clear();
+    attrib->texcoords.clear();
+    shapes->clear();
+
+    tinyobj::shape_t shape;
+    for (size_t i = 0; i < num_chunks; ++i)
+    {
+        ObjChunk& chunk = chunks[i];
+        int base[3] = {(int)attrib->vertices.size() / 3, (int)attrib->normals.size() / 3, (int)attrib->texcoords.size() / 2};
+
+        for (size_t r = 0; r < chunk.relative.size(); ++r)
+        {
+            tinyobj::index_t& index = chunk.indices[chunk.relative[r] / 3];
+            switch (chunk.relative[r] % 3)
+            {
+                case 0: index.vertex_index += base[0]; break;
+                case 1: index.normal_index += base[1]; break;
+                case 2: index.texcoord_index += base[2]; break;
+            }
+        }
+
+        for (size_t g = 0; g < chunk.groups.size(); ++g)
+        {
+            const ObjGroup& group = chunk.groups[g];
+            size_t last_index = (g + 1 < chunk.groups.size()) ? chunk.groups[g + 1].first_index : chunk.indices.size();
+
+            if (group.named)
+            {
+                if (!shape.mesh.indices.empty())
+                    shapes->push_back(shape);
+                shape = tinyobj::shape_t();
+                shape.name = group.name;
+            }
+
+            shape.mesh.indices.insert(shape.mesh.indices.end(), chunk.indices.begin() + group.first_index, chunk.indices.begin() + last_index);
+            shape.mesh.num_face_vertices.resize(shape.mesh.indices.size() / 3, 3);
+            shape.mesh.material_ids.resize(shape.mesh.indices.size() / 3, -1);
+        }
+
+        attrib->vertices.insert(attrib->vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+        attrib->normals.insert(attrib->normals.end(), chunk.normals.begin(), chunk.normals.end());
+        attrib->texcoords.insert(attrib->texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+    }
+    if (!shape.mesh.indices.empty())
+        shapes->push_back(shape);
+
+    UnmapFile(&file);
+    return true;
+}
@@ -13,73 +13,46 @@ in vec4 position_model;
 // Coordenadas de textura obtidas do arquivo OBJ (se existirem!)
 in vec2 texcoords;
 
+// Tipo da parte do jogador (PLAYER_HEAD, PLAYER_ARM, ...) quando object_id == PLAYER
+flat in int player_part;
+
 // Matrizes computadas no código C++ e enviadas para a GPU
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
-// Identificador que define qual objeto está sendo desenhado no momento
-#define COW         1
-#define WALL        10
-#define LOCK        11
-#define DIRTBLOCK   12
-#define FLOOR       13
-#define DIRT        14
-#define WATER       15
-#define LAVA        16
-#define DOOR_RED    17
-#define DOOR_GREEN  18
-#define DOOR_BLUE   19
-#define DOOR_YELLOW 20
-#define BABYCOW     21
-#define JET         22
-#define BEACHBALL   23
-#define VOLLEYBALL  24
-#define GRASS       25
-#define WOOD        26
-#define SNOW        27
-#define DARKFLOOR   28
-#define SNOWBLOCK   29
-#define CRYSTAL     30
-#define DARKDIRT    31
-#define DARKROCK    32
-
-#define KEY_RED     40
-#define KEY_GREEN   41
-#define KEY_BLUE    42
-#define KEY_YELLOW  43
-
-#define PLAYER_HEAD     60
-#define PLAYER_TORSO    61
-#define PLAYER_ARM      62
-#define PLAYER_HAND     63
-#define PLAYER_LEG      64
-#define PLAYER_FOOT     65
-
-#define PARTICLE    80
-
-#define SKYBOX_TOP      100
-#define SKYBOX_BOTTOM   101
-#define SKYBOX_EAST     102
-#define SKYBOX_WEST     103
-#define SKYBOX_SOUTH    104
-#define SKYBOX_NORTH    105
-
+// Identificador que define qual objeto está sendo desenhado no momento. Os
+// #define dos tipos (COW, WALL, ..., PLAYER, SKYBOX) são inseridos pelo C++
+// antes da compilação (veja GetShaderDefines() em "main.cpp").
 uniform int object_id;
 
 // Parâmetros da axis-aligned bounding box (AABB) do modelo
 uniform vec4 bbox_min;
 uniform vec4 bbox_max;
 
-// Variáveis para acesso das imagens de textura
-uniform sampler2D TextureImage0;
-uniform sampler2D TextureImage1;
-uniform sampler2D TextureImage2;
-uniform sampler2D TextureImage3;
-uniform sampler2D TextureImage4;
+// Variáveis para acesso das imagens de textura. Os materiais dos tiles são
+// camadas de TileTextures e os quadros da água são camadas de WaterTextures
+// (veja TileTextureSource() e WaterTextureSource() em "main.cpp").
+uniform sampler2DArray TileTextures;
+uniform sampler2DArray WaterTextures;
+uniform samplerCube SkyboxTexture;
+uniform sampler2D ImpostorAtlas;
+
+// Célula do atlas de impostores (x = ângulo, y = tipo do item)
+uniform ivec2 impostor_cell;
 
-#define WALLGROUNDGRASS_W 841
-#define WALLGROUNDGRASS_H 305
+// Transição entre o modelo de um item e o seu impostor: só são desenhados
+// os pixels cujo limiar no padrão de Bayer 4x4 está em [x, y)
+uniform vec2 dither_range;
+const float BAYER_4X4[16] = float[16]( 0.0,  8.0,  2.0, 10.0,
+                                      12.0,  4.0, 14.0,  6.0,
+                                       3.0, 11.0,  1.0,  9.0,
+                                      15.0,  7.0, 13.0,  5.0);
+
+// Camada de TileTextures de cada material, indexada por object_id (-1 =
+// material sem textura de tile): TILE_LAYERS[TILE_MATERIALS], gerada pelo
+// C++ a partir de OBJECT_TYPE_TABLE, assim como DOOR_FRAME_LAYER, a camada do
+// topo e da base das portas.
 
 
 // Variável de controle da animação
@@ -87,8 +60,6 @@ uniform int anim_timer;
 
 uniform int yellow_particle_color;
 
-uniform int skytheme;
-
 // O valor de saída ("out") de um Fragment Shader é a cor final do fragmento.
 out vec4 color;
 
@@ -98,6 +69,10 @@ out vec4 color;
 
 void main()
 {
+    float dither = (BAYER_4X4[(int(gl_FragCoord.y) & 3) * 4 + (int(gl_FragCoord.x) & 3)] + 0.5) / 16.0;
+    if (dither < dither_range.x || dither >= dither_range.y)
+        discard;
+
     // Obtemos a posição da câmera utilizando a inversa da matriz que define o
     // sistema de coordenadas da câmera.
     vec4 origin = vec4(0.0, 0.0, 0.0, 1.0);
@@ -145,9 +120,7 @@ void main()
 
     if ( object_id == COW )
     {
-        vec4 bbox_center = (bbox_min + bbox_max) / 2.0;
-        vec4 p_vector = position_model - bbox_center;
-
+        // Projeção esférica
         float px = position_model[0];
         float py = position_model[1];
         float pz = position_model[2];
@@ -159,12 +132,9 @@ void main()
         U = (theta + M_PI) / (2 * M_PI);
         V = (phi + M_PI/2) / M_PI;
 
-        U = (U + 3)/ 5;
-        V = (V + 0)/ 4;
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
+        Kd = texture(TileTextures, vec3(U, V, TILE_LAYERS[COW])).rgba;
         Ks = vec4(0.5, 0.5, 0.5, 0.0f);
-        Ka = texture(TextureImage0, vec2(U,V)).rgba;
+        Ka = Kd;
         q = 5.0;
 
         vec4 lambert_diffuse_term = Kd * I * max(0, dot(n, l));
@@ -172,215 +142,20 @@ void main()
         vec4 phong_specular_term  = Ks * I * pow((max(0, dot(r, v))), q);
         color = lambert_diffuse_term + ambient_term + phong_specular_term;
     }
-    else if ( object_id == FLOOR )
-    {
-        U = (texcoords.x + 0)/ 5;
-        V = (texcoords.y + 3)/ 4;
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        color = Kd;
-    }
     else if ( object_id == WATER )
     {
-        int xpos = 0;
-        int ypos = 0;
-
-        switch (anim_timer) {
-        case 0: case 1: case 2: case 3: {ypos = 3; break; }
-        case 4: case 5: case 6: case 7: {ypos = 2; break; }
-        case 8: case 9: case 10: case 11: {ypos = 1; break; }
-        case 12: case 13: case 14: case 15: {ypos = 0; break; }
-        }
-
-        switch (anim_timer) {
-        case 0: case 4: case 8: case 12: {xpos = 0; break; }
-        case 1: case 5: case 9: case 13: {xpos = 1; break; }
-        case 2: case 6: case 10: case 14: {xpos = 2; break; }
-        case 3: case 7: case 11: case 15: {xpos = 3; break; }
-        }
-
-        U = (texcoords.x + xpos)/4;
-        V = (texcoords.y + ypos)/4;
-
-        Kd = texture(TextureImage1, vec2(U,V)).rgba;
-        color = Kd;
-    }
-    else if ( object_id == WALL )
-    {
-        U = (texcoords.x + 1)/5;
-        V = (texcoords.y + 3)/4;
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        color = Kd;
-    }
-    else if ( object_id == DIRT )
-    {
-        U = (texcoords.x + 3)/ 5;
-        V = (texcoords.y + 3)/ 4;
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        color = Kd;
-    }
-    else if ( object_id == SNOWBLOCK )
-    {
-        U = (texcoords.x + 4)/ 5;
-        V = (texcoords.y + 0)/ 4;
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        color = Kd;
-    }
-    else if ( object_id == CRYSTAL )
-    {
-        U = (texcoords.x + 4)/5;
-        V = (texcoords.y + 2)/ 4;
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        color = Kd;
-    }
-    else if ( object_id == DARKDIRT )
-    {
-        U = (texcoords.x + 4)/ 5;
-        V = (texcoords.y + 3)/ 4;
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        color = Kd;
-    }
-    else if ( object_id == SNOW )
-    {
-        U = (texcoords.x + 1)/ 5;
-        V = (texcoords.y + 0)/ 4;
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        color = Kd;
-    }
-    else if ( object_id == DARKROCK )
-    {
-        U = (texcoords.x + 4)/ 5;
-        V = (texcoords.y + 1)/ 4;
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        color = Kd;
+        // Cada quadro da animação é uma camada
+        color = texture(WaterTextures, vec3(texcoords, anim_timer)).rgba;
     }
-    else if ( object_id == GRASS )
+    else if ( object_id >= DOOR_RED && object_id <= DOOR_YELLOW )
     {
-        U = (texcoords.x + 2)/ 5;
-        V = (texcoords.y + 3)/ 4;
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        color = Kd;
-    }
-    else if ( object_id == WOOD )
-    {
-        U = (texcoords.x + 2)/ 5;
-        V = (texcoords.y + 0)/ 4;
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        color = Kd;
-    }
-    else if ( object_id == DIRTBLOCK )
-    {
-        U = (texcoords.x + 0)/ 5;
-        V = (texcoords.y + 2)/ 4;
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        color = Kd;
-    }
-    else if ( object_id == DOOR_RED ) {
-        float x = position_model[0];
-        float y = position_model[1];
-        float z = position_model[2];
-
-        float minx = bbox_min.x;
-        float maxx = bbox_max.x;
-
-        float miny = bbox_min.y;
-        float maxy = bbox_max.y;
-
-        float minz = bbox_min.z;
-        float maxz = bbox_max.z;
-
-        if (y < (maxy - 0.01) && y > (miny+0.01)) {
-            U = (texcoords.x + 2)/ 5;
-            V = (texcoords.y + 2)/ 4;
-        } else {
-            U = (texcoords.x + 2)/ 5;
-            V = (texcoords.y + 1)/ 4;
-        }
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        color = Kd;
-    } else if ( object_id == DOOR_GREEN ) {
-        float x = position_model[0];
+        // O topo e a base da porta usam a textura da moldura
         float y = position_model[1];
-        float z = position_model[2];
-
-        float minx = bbox_min.x;
-        float maxx = bbox_max.x;
-
-        float miny = bbox_min.y;
-        float maxy = bbox_max.y;
-
-        float minz = bbox_min.z;
-        float maxz = bbox_max.z;
-
-        if (y < (maxy - 0.01) && y > (miny+0.01)) {
-            U = (texcoords.x + 3)/ 5;
-            V = (texcoords.y + 2)/ 4;
-        } else {
-            U = (texcoords.x + 2)/ 5;
-            V = (texcoords.y + 1)/ 4;
-        }
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        color = Kd;
-    } else if ( object_id == DOOR_BLUE ) {
-        float x = position_model[0];
-        float y = position_model[1];
-        float z = position_model[2];
-
-        float minx = bbox_min.x;
-        float maxx = bbox_max.x;
+        int layer = DOOR_FRAME_LAYER;
+        if (y < (bbox_max.y - 0.01) && y > (bbox_min.y + 0.01))
+            layer = TILE_LAYERS[object_id];
 
-        float miny = bbox_min.y;
-        float maxy = bbox_max.y;
-
-        float minz = bbox_min.z;
-        float maxz = bbox_max.z;
-
-        if (y < (maxy - 0.01) && y > (miny+0.01)) {
-            U = (texcoords.x + 0)/ 5;
-            V = (texcoords.y + 1)/ 4;
-        } else {
-            U = (texcoords.x + 2)/ 5;
-            V = (texcoords.y + 1)/ 4;
-        }
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        color = Kd;
-    } else if ( object_id == DOOR_YELLOW ) {
-        float x = position_model[0];
-        float y = position_model[1];
-        float z = position_model[2];
-
-        float minx = bbox_min.x;
-        float maxx = bbox_max.x;
-
-        float miny = bbox_min.y;
-        float maxy = bbox_max.y;
-
-        float minz = bbox_min.z;
-        float maxz = bbox_max.z;
-
-        if (y < (maxy - 0.01) && y > (miny+0.01)) {
-            U = (texcoords.x + 1)/ 5;
-            V = (texcoords.y + 1)/ 4;
-        } else {
-            U = (texcoords.x + 2)/ 5;
-            V = (texcoords.y + 1)/ 4;
-        }
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        color = Kd;
+        color = texture(TileTextures, vec3(texcoords, layer)).rgba;
     }
     else if ( object_id == KEY_RED ) {
         Kd = vec4(0.8f, 0.0f, 0.0f, 1.0f);
@@ -448,37 +223,8 @@ void main()
         vec4 ambient_term = Ka * Ia;
         vec4 phong_specular_term  = Ks * I * pow((max(0, dot(r, v))), q);
         color = lambert_diffuse_term + ambient_term + phong_specular_term;
-    } else if ( object_id == BEACHBALL ) {
-        vec4 bbox_center = (bbox_min + bbox_max) / 2.0;
-        vec4 p_vector = position_model - bbox_center;
-
-        float px = position_model[0];
-        float py = position_model[1];
-        float pz = position_model[2];
-
-        float rho = sqrt(pow(px,2) + pow(py,2) + pow(pz, 2));
-        float theta = atan(px, pz);
-        float phi = asin(py/rho);
-
-        U = (theta + M_PI) / (2 * M_PI);
-        V = (phi + M_PI/2) / M_PI;
-
-        U = (U + 3)/ 5;
-        V = (V + 1)/ 4;
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
-        Ks = vec4(0.5, 0.5, 0.7, 1.0f);
-        Ka = texture(TextureImage0, vec2(U,V)).rgba;
-        q = 32.0;
-
-        vec4 lambert_diffuse_term = Kd * I * max(0, dot(n, l));
-        vec4 ambient_term = Ka * Ia;
-        vec4 phong_specular_term  = Ks * I * pow((max(0, dot(r, v))), q);
-        color = lambert_diffuse_term + ambient_term + phong_specular_term;
-    } else if ( object_id == VOLLEYBALL ) {
-        vec4 bbox_center = (bbox_min + bbox_max) / 2.0;
-        vec4 p_vector = position_model - bbox_center;
-
+    } else if ( object_id == BEACHBALL || object_id == VOLLEYBALL ) {
+        // Projeção esférica
         float px = position_model[0];
         float py = position_model[1];
         float pz = position_model[2];
@@ -490,12 +236,9 @@ void main()
         U = (theta + M_PI) / (2 * M_PI);
         V = (phi + M_PI/2) / M_PI;
 
-        U = (U + 0)/ 5;
-        V = (V + 0)/ 4;
-
-        Kd = texture(TextureImage0, vec2(U,V)).rgba;
+        Kd = texture(TileTextures, vec3(U, V, TILE_LAYERS[object_id])).rgba;
         Ks = vec4(0.5, 0.5, 0.7, 1.0f);
-        Ka = texture(TextureImage0, vec2(U,V)).rgba;
+        Ka = Kd;
         q = 32.0;
 
         vec4 lambert_diffuse_term = Kd * I * max(0, dot(n, l));
@@ -503,81 +246,28 @@ void main()
         vec4 phong_specular_term  = Ks * I * pow((max(0, dot(r, v))), q);
         color = lambert_diffuse_term + ambient_term + phong_specular_term;
     }
-    else if ( object_id == PLAYER_HEAD || object_id == PLAYER_FOOT || object_id == PLAYER_HAND) {
-        color = vec4(0.85f, 0.8f, 0.5f, 1.0f);
+    else if ( object_id < TILE_MATERIALS && TILE_LAYERS[object_id] >= 0 ) {
+        // Demais tiles: apenas a textura do material, sem iluminação
+        color = texture(TileTextures, vec3(texcoords, TILE_LAYERS[object_id])).rgba;
     }
-    else if ( object_id == PLAYER_ARM || object_id == PLAYER_TORSO ) {
-        color = vec4(0.05f, 0.4f, 0.1f, 1.0f);
+    else if ( object_id == PLAYER ) {
+        if ( player_part == PLAYER_HEAD || player_part == PLAYER_FOOT || player_part == PLAYER_HAND )
+            color = vec4(0.85f, 0.8f, 0.5f, 1.0f);
+        else if ( player_part == PLAYER_ARM || player_part == PLAYER_TORSO )
+            color = vec4(0.05f, 0.4f, 0.1f, 1.0f);
+        else if ( player_part == PLAYER_LEG )
+            color = vec4(0.4f, 0.3f, 0.1f, 1.0f);
     }
-    else if ( object_id == PLAYER_LEG ) {
-        color = vec4(0.4f, 0.3f, 0.1f, 1.0f);
+    else if ( object_id == IMPOSTOR ) {
+        vec2 uv = (texcoords + vec2(impostor_cell)) / vec2(IMPOSTOR_YAW_STEPS, IMPOSTOR_ROWS);
+        color = texture(ImpostorAtlas, uv);
+        if (color.a < 0.5)
+            discard;
+        color.a = 1.0;
     }
-    else if ( object_id == SKYBOX_TOP ) {
-        U = (texcoords.x + 1)/ 3;
-        V = (texcoords.y + 1)/ 2;
-
-        if (skytheme == 1)
-            Kd = texture(TextureImage2, vec2(U,V)).rgba;
-        else if (skytheme == 3)
-            Kd = texture(TextureImage3, vec2(U,V)).rgba;
-        else if (skytheme == 4)
-            Kd = texture(TextureImage4, vec2(U,V)).rgba;
-        color = Kd;
-    } else if ( object_id == SKYBOX_BOTTOM ) {
-        U = (texcoords.x + 0)/ 3;
-        V = (texcoords.y + 1)/ 2;
-
-        if (skytheme == 1)
-            Kd = texture(TextureImage2, vec2(U,V)).rgba;
-        else if (skytheme == 3)
-            Kd = texture(TextureImage3, vec2(U,V)).rgba;
-        else if (skytheme == 4)
-            Kd = texture(TextureImage4, vec2(U,V)).rgba;
-        color = Kd;
-    } else if ( object_id == SKYBOX_WEST ) {
-        U = (texcoords.x + 2)/ 3;
-        V = (texcoords.y + 1)/ 2;
-
-        if (skytheme == 1)
-            Kd = texture(TextureImage2, vec2(U,V)).rgba;
-        else if (skytheme == 3)
-            Kd = texture(TextureImage3, vec2(U,V)).rgba;
-        else if (skytheme == 4)
-            Kd = texture(TextureImage4, vec2(U,V)).rgba;
-        color = Kd;
-    } else if ( object_id == SKYBOX_EAST ) {
-        U = (texcoords.x + 1)/ 3;
-        V = (texcoords.y + 0)/ 2;
-
-        if (skytheme == 1)
-            Kd = texture(TextureImage2, vec2(U,V)).rgba;
-        else if (skytheme == 3)
-            Kd = texture(TextureImage3, vec2(U,V)).rgba;
-        else if (skytheme == 4)
-            Kd = texture(TextureImage4, vec2(U,V)).rgba;
-        color = Kd;
-    } else if ( object_id == SKYBOX_SOUTH ) {
-        U = (texcoords.x + 2)/ 3;
-        V = (texcoords.y + 0)/ 2;
-
-        if (skytheme == 1)
-            Kd = texture(TextureImage2, vec2(U,V)).rgba;
-        else if (skytheme == 3)
-            Kd = texture(TextureImage3, vec2(U,V)).rgba;
-        else if (skytheme == 4)
-            Kd = texture(TextureImage4, vec2(U,V)).rgba;
-        color = Kd;
-    } else if ( object_id == SKYBOX_NORTH ) {
-        U = (texcoords.x + 0)/ 3;
-        V = (texcoords.y + 0)/ 2;
-
-        if (skytheme == 1)
-            Kd = texture(TextureImage2, vec2(U,V)).rgba;
-        else if (skytheme == 3)
-            Kd = texture(TextureImage3, vec2(U,V)).rgba;
-        else if (skytheme == 4)
-            Kd = texture(TextureImage4, vec2(U,V)).rgba;
-        color = Kd;
+    else if ( object_id == SKYBOX ) {
+        // A posição no modelo (cubo centrado na origem) é a direção de amostragem
+        color = texture(SkyboxTexture, position_model.xyz);
     }
 
     // Cor final com correção gamma, considerando monitor sRGB.
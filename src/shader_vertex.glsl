@@ -1,16 +1,45 @@
 #version 330 core
 
 // Atributos de vrtice recebidos como entrada ("in") pelo Vertex Shader.
-// Veja a funo BuildTrianglesAndAddToVirtualScene() em "main.cpp".
-layout (location = 0) in vec4 model_coefficients;
-layout (location = 1) in vec4 normal_coefficients;
+// Os vrtices so quantizados: veja PackedVertex e PackMeshVertices() em
+// "main.cpp".
+layout (location = 0) in vec3 quantized_position;   // Em [0,1], relativa  caixa abaixo
+layout (location = 1) in vec2 octahedral_normal;    // Em [-1,1]
 layout (location = 2) in vec2 texture_coefficients;
 
+// Somente no modelo do jogador: x = ndice da parte no palette de matrizes,
+// y = tipo da parte (PLAYER_HEAD, PLAYER_ARM, ...). Veja DrawPlayer().
+layout (location = 3) in ivec2 bone_coefficients;
+
+// Caixa do objeto usada para decodificar as posies quantizadas
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+
 // Matrizes computadas no cdigo C++ e enviadas para a GPU
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// Identificador do objeto sendo desenhado (ver "shader_fragment.glsl"). Os
+// #define dos tipos de objetos e das demais constantes comuns com o C++
+// (PLAYER_BONE_COUNT, ANIM_*) so inseridos antes da compilao (veja
+// GetShaderDefines() em "main.cpp").
+uniform int object_id;
+
+// Palette de matrizes de modelagem das partes do jogador
+uniform mat4 bone_matrices[PLAYER_BONE_COUNT];
+
+// Animaes procedurais dos itens (ver DrawAnimatedObject() em "main.cpp").
+// O giro e a flutuao so funes do tempo (em quadros), ento a matriz
+// "model" de cada item no muda de um quadro para o outro.
+#define ITEM_ROTATION_SPEED 0.1
+#define COW_BOB_PERIOD      240.0   // Quadros para subir e descer
+#define COW_BOB_HEIGHT      0.3
+#define M_PI                3.14159265358979323846
+uniform int anim_type;
+uniform float anim_phase;
+uniform float anim_time;
+
 // Atributos de vrtice que sero gerados como sada ("out") pelo Vertex Shader.
 // ** Estes sero interpolados pelo rasterizador! ** gerando, assim, valores
 // para cada fragmento, os quais sero recebidos como entrada pelo Fragment
@@ -19,9 +48,78 @@ out vec4 position_world;
 out vec4 position_model;
 out vec4 normal;
 out vec2 texcoords;
+flat out int player_part;
+
+mat4 translate(float x, float y, float z)
+{
+    return mat4(1.0, 0.0, 0.0, 0.0,
+                0.0, 1.0, 0.0, 0.0,
+                0.0, 0.0, 1.0, 0.0,
+                  x,   y,   z, 1.0);
+}
+
+mat4 rotate_y(float angle)
+{
+    float c = cos(angle);
+    float s = sin(angle);
+    return mat4(  c, 0.0,  -s, 0.0,
+                0.0, 1.0, 0.0, 0.0,
+                  s, 0.0,   c, 0.0,
+                0.0, 0.0, 0.0, 1.0);
+}
+
+mat4 rotate_z(float angle)
+{
+    float c = cos(angle);
+    float s = sin(angle);
+    return mat4(  c,   s, 0.0, 0.0,
+                 -s,   c, 0.0, 0.0,
+                0.0, 0.0, 1.0, 0.0,
+                0.0, 0.0, 0.0, 1.0);
+}
+
+// Inverso da codificao octadrica feita por OctahedronEncode() em "main.cpp"
+vec3 octahedron_decode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if ( n.z < 0.0 )
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
 
 void main()
 {
+    // Decodificao dos atributos quantizados
+    vec4 model_coefficients = vec4(position_offset + position_scale * quantized_position, 1.0);
+    vec4 normal_coefficients = vec4(octahedron_decode(octahedral_normal), 0.0);
+
+    // O jogador  desenhado em uma nica chamada: cada vrtice escolhe a
+    // matriz de modelagem da sua parte no palette.
+    mat4 model_matrix = model;
+    player_part = 0;
+    if ( object_id == PLAYER )
+    {
+        model_matrix = bone_matrices[bone_coefficients.x];
+        player_part = bone_coefficients.y;
+    }
+
+    // Itens giratrios: a rotao  aplicada em coordenadas do modelo
+    float angle = mod(anim_time * ITEM_ROTATION_SPEED + anim_phase, 2.0 * M_PI);
+    if ( anim_type == ANIM_SPIN_KEY )
+        model_matrix = model * translate(0.0, 5.7, 0.0) * rotate_y(angle)
+                     * rotate_z(M_PI / 5.0) * translate(0.0, -5.7, 0.0);
+    else if ( anim_type == ANIM_SPIN_COW )
+        model_matrix = model * translate(-0.2, 0.0, 0.0) * rotate_y(angle) * translate(0.2, 0.0, 0.0);
+    else if ( anim_type == ANIM_SPIN_BOB_COW )
+    {
+        // Gira quatro vezes mais devagar e flutua (onda triangular) para cima
+        // da sua posio inicial
+        float bob = COW_BOB_HEIGHT * (1.0 - abs(1.0 - 2.0 * fract(anim_time / COW_BOB_PERIOD)));
+        float cow_angle = mod(anim_time * ITEM_ROTATION_SPEED / 4.0 + anim_phase, 2.0 * M_PI);
+        model_matrix = translate(0.0, bob, 0.0) * model
+                     * translate(-0.2, 0.0, 0.0) * rotate_y(cow_angle) * translate(0.2, 0.0, 0.0);
+    }
+
     // A varivel gl_Position define a posio final de cada vrtice
     // OBRIGATORIAMENTE em "normalized device coordinates" (NDC), onde cada
     // coeficiente est entre -1 e 1.  (Veja slides 135 e 141 do documento
@@ -34,7 +132,21 @@ void main()
     // de vdeo (GPU) far a diviso por W. Veja slide 178 do documento
     // "Aula_09_Projecoes.pdf").
     //
-    gl_Position = projection * view * model * model_coefficients;
+    gl_Position = projection * view * model_matrix * model_coefficients;
+
+    // A skybox ignora a translao da cmera e fica sempre no far plane
+    // (z = w resulta em profundidade 1.0 aps a diviso por w).
+    if ( object_id == SKYBOX )
+        gl_Position = (projection * mat4(mat3(view)) * model_coefficients).xyww;
+
+    // Impostores: o "plane" (no plano XZ) vira um quad no plano da cmera,
+    // centrado na translao e com o tamanho da escala da matriz "model".
+    if ( object_id == IMPOSTOR )
+    {
+        vec4 center_view = view * vec4(model[3].xyz, 1.0);
+        center_view.xy += vec2(model_coefficients.x * model[0][0], -model_coefficients.z * model[1][1]);
+        gl_Position = projection * center_view;
+    }
 
     // Como as variveis acima  (tipo vec4) so vetores com 4 coeficientes,
     // tambm  possvel acessar e modificar cada coeficiente de maneira
@@ -48,14 +160,14 @@ void main()
     //
 
     // Posio do vrtice atual no sistema de coordenadas global (World).
-    position_world = model * model_coefficients;
+    position_world = model_matrix * model_coefficients;
 
     // Posio do vrtice atual no sistema de coordenadas local do modelo.
     position_model = model_coefficients;
 
     // Normal do vrtice atual no sistema de coordenadas global (World).
     // Veja slide 94 do documento "Aula_07_Transformacoes_Geometricas_3D.pdf".
-    normal = inverse(transpose(model)) * normal_coefficients;
+    normal = inverse(transpose(model_matrix)) * normal_coefficients;
     normal.w = 0.0;
 
     // Coordenadas de textura obtidas do arquivo OBJ (se existirem!)
@@ -0,0 +1,203 @@
+// Geração de mipmaps e compressão de texturas no formato BC1 (S3TC/DXT1),
+// usadas pelo cache de texturas comprimidas (veja LoadCompressedTexture() em
+// "main.cpp"). Todas as imagens são RGB, 3 bytes por pixel, em sRGB.
+//
+// Cada bloco BC1 codifica 4x4 pixels em 8 bytes: duas cores RGB565 (c0 e
+// c1) e um índice de 2 bits por pixel para a paleta {c0, c1, 2/3 c0 + 1/3
+// c1, 1/3 c0 + 2/3 c1}. As cores extremas de cada bloco são escolhidas ao
+// longo do eixo principal das cores do bloco ("range fit").
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+// Tabela de conversão sRGB -> linear. Inicializada uma única vez, mesmo com
+// várias threads comprimindo texturas ao mesmo tempo.
+struct SrgbTable {
+    float linear[256];
+    SrgbTable() {
+        for (int i = 0; i < 256; i++)
+        {
+            float c = i / 255.0f;
+            linear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+        }
+    }
+};
+
+float SrgbToLinear(unsigned char value)
+{
+    static const SrgbTable table;
+    return table.linear[value];
+}
+
+unsigned char LinearToSrgb(float value)
+{
+    value = std::max(0.0f, std::min(1.0f, value));
+    float c = value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+    return (unsigned char)(c * 255.0f + 0.5f);
+}
+
+unsigned short PackRgb565(const float* color)
+{
+    int r = (int)(std::max(0.0f, std::min(255.0f, color[0])) * 31.0f / 255.0f + 0.5f);
+    int g = (int)(std::max(0.0f, std::min(255.0f, color[1])) * 63.0f / 255.0f + 0.5f);
+    int b = (int)(std::max(0.0f, std::min(255.0f, color[2])) * 31.0f / 255.0f + 0.5f);
+    return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+void UnpackRgb565(unsigned short packed, float* color)
+{
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    color[0] = (float)((r << 3) | (r >> 2));
+    color[1] = (float)((g << 2) | (g >> 4));
+    color[2] = (float)((b << 3) | (b >> 2));
+}
+
+// Comprime um bloco de 16 pixels (RGB, em ordem de linhas) em 8 bytes
+void CompressBlockBC1(const unsigned char* pixels, unsigned char* block)
+{
+    // Média e covariância das cores do bloco
+    float mean[3] = {0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; i++)
+        for (int k = 0; k < 3; k++)
+            mean[k] += pixels[3*i + k] / 16.0f;
+
+    float covariance[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f}; // rr rg rb gg gb bb
+    for (int i = 0; i < 16; i++)
+    {
+        float r = pixels[3*i + 0] - mean[0];
+        float g = pixels[3*i + 1] - mean[1];
+        float b = pixels[3*i + 2] - mean[2];
+        covariance[0] += r*r; covariance[1] += r*g; covariance[2] += r*b;
+        covariance[3] += g*g; covariance[4] += g*b; covariance[5] += b*b;
+    }
+
+    // Eixo principal por iteração da potência
+    float axis[3] = {1.0f, 1.0f, 1.0f};
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float x = covariance[0]*axis[0] + covariance[1]*axis[1] + covariance[2]*axis[2];
+        float y = covariance[1]*axis[0] + covariance[3]*axis[1] + covariance[4]*axis[2];
+        float z = covariance[2]*axis[0] + covariance[4]*axis[1] + covariance[5]*axis[2];
+        float length = std::max(fabsf(x), std::max(fabsf(y), fabsf(z)));
+        if (length == 0.0f)
+            break;
+        axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+    }
+
+    // Extremos das projeções das cores sobre o eixo
+    float min_projection = 1e30f, max_projection = -1e30f;
+    int min_pixel = 0, max_pixel = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        float projection = pixels[3*i + 0]*axis[0] + pixels[3*i + 1]*axis[1] + pixels[3*i + 2]*axis[2];
+        if (projection < min_projection) { min_projection = projection; min_pixel = i; }
+        if (projection > max_projection) { max_projection = projection; max_pixel = i; }
+    }
+
+    float endpoint0[3], endpoint1[3];
+    for (int k = 0; k < 3; k++)
+    {
+        endpoint0[k] = pixels[3*max_pixel + k];
+        endpoint1[k] = pixels[3*min_pixel + k];
+    }
+    unsigned short color0 = PackRgb565(endpoint0);
+    unsigned short color1 = PackRgb565(endpoint1);
+
+    // c0 > c1 seleciona o modo de quatro cores (c0 == c1 só ocorre em blocos
+    // de cor única, onde todos os índices são 0)
+    if (color0 < color1)
+        std::swap(color0, color1);
+
+    unsigned int indices = 0;
+    if (color0 != color1)
+    {
+        float palette[4][3];
+        UnpackRgb565(color0, palette[0]);
+        UnpackRgb565(color1, palette[1]);
+        for (int k = 0; k < 3; k++)
+        {
+            palette[2][k] = (2.0f * palette[0][k] + palette[1][k]) / 3.0f;
+            palette[3][k] = (palette[0][k] + 2.0f * palette[1][k]) / 3.0f;
+        }
+
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            float best_distance = 1e30f;
+            for (int p = 0; p < 4; p++)
+            {
+                float dr = pixels[3*i + 0] - palette[p][0];
+                float dg = pixels[3*i + 1] - palette[p][1];
+                float db = pixels[3*i + 2] - palette[p][2];
+                float distance = dr*dr + dg*dg + db*db;
+                if (distance < best_distance) { best_distance = distance; best = p; }
+            }
+            indices |= (unsigned int)best << (2*i);
+        }
+    }
+
+    block[0] = color0 & 0xff; block[1] = color0 >> 8;
+    block[2] = color1 & 0xff; block[3] = color1 >> 8;
+    for (int k = 0; k < 4; k++)
+        block[4 + k] = (indices >> (8*k)) & 0xff;
+}
+
+} // namespace
+
+// Tamanho (em bytes) de uma imagem width x height comprimida em BC1
+size_t CompressedSizeBC1(int width, int height)
+{
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * 8;
+}
+
+// Comprime uma imagem RGB em BC1. Blocos na borda de imagens cujas dimensões
+// não são múltiplas de 4 repetem a última linha/coluna.
+void CompressImageBC1(const unsigned char* rgb, int width, int height, unsigned char* blocks)
+{
+    unsigned char pixels[16 * 3];
+    for (int by = 0; by < height; by += 4)
+    {
+        for (int bx = 0; bx < width; bx += 4)
+        {
+            for (int y = 0; y < 4; y++)
+            {
+                for (int x = 0; x < 4; x++)
+                {
+                    const unsigned char* source = rgb + 3 * ((size_t)std::min(by + y, height - 1) * width + std::min(bx + x, width - 1));
+                    memcpy(&pixels[3 * (4*y + x)], source, 3);
+                }
+            }
+            CompressBlockBC1(pixels, blocks);
+            blocks += 8;
+        }
+    }
+}
+
+// Reduz uma imagem RGB sRGB para o próximo nível de mipmap (metade de cada
+// dimensão, no mínimo 1), fazendo a média de 2x2 pixels em espaço linear.
+void DownsampleImageSrgb(const unsigned char* source, int width, int height, unsigned char* destination)
+{
+    int out_width = std::max(1, width / 2);
+    int out_height = std::max(1, height / 2);
+
+    for (int y = 0; y < out_height; y++)
+    {
+        for (int x = 0; x < out_width; x++)
+        {
+            int x0 = std::min(2*x, width - 1), x1 = std::min(2*x + 1, width - 1);
+            int y0 = std::min(2*y, height - 1), y1 = std::min(2*y + 1, height - 1);
+            for (int k = 0; k < 3; k++)
+            {
+                float sum = SrgbToLinear(source[3 * ((size_t)y0 * width + x0) + k])
+                          + SrgbToLinear(source[3 * ((size_t)y0 * width + x1) + k])
+                          + SrgbToLinear(source[3 * ((size_t)y1 * width + x0) + k])
+                          + SrgbToLinear(source[3 * ((size_t)y1 * width + x1) + k]);
+                destination[3 * ((size_t)y * out_width + x) + k] = LinearToSrgb(sum / 4.0f);
+            }
+        }
+    }
+}